@@ -1,7 +1,20 @@
 #include "recycled/application.h"
+#include "recycled/arena.h"
+#include "recycled/compressor.h"
+#include "recycled/conditional.h"
 #include "recycled/connection.h"
+#include "recycled/coroutine.h"
+#include "recycled/epollserver.h"
 #include "recycled/format.h"
 #include "recycled/handler.h"
 #include "recycled/httpserver.h"
 #include "recycled/ioloop.h"
-#include "recycled/router.h"
\ No newline at end of file
+#include "recycled/multipart.h"
+#include "recycled/router.h"
+#include "recycled/socket.h"
+#include "recycled/spool.h"
+#include "recycled/staticfile.h"
+#include "recycled/stringview.h"
+#include "recycled/timerwheel.h"
+#include "recycled/uring.h"
+#include "recycled/workerpool.h"
\ No newline at end of file
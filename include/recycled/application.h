@@ -1,9 +1,13 @@
 #ifndef RECYCLED_INCLUDE_APPLICATION_H
 #define RECYCLED_INCLUDE_APPLICATION_H
+#include <stdint.h>
+#include <signal.h>
 #include <string>
 #include <functional>
 #include "recycled/handler.h"
+#include "recycled/ioloop.h"
 #include "recycled/router.h"
+#include "recycled/workerpool.h"
 
 namespace recycled {
 class ApplicationException: public std::exception {
@@ -36,34 +40,94 @@ class Application {
          */
         template<typename... Arguments>
         void listen(Arguments... args);
+        /**
+         * 设置运行阻塞处理器(HandlerFlag::Blocking)的工作线程池.
+         * 若有处理器设置了Blocking, 构造时会创建一个默认的线程池
+         *
+         * @param threads 工作线程数, 为0时使用CPU核心数
+         *
+         * @param max_queue 等待队列的最大长度, 队列已满时返回503
+         */
+        void set_workers(size_t threads, size_t max_queue);
+        /**
+         * 调用Server的shutdown方法, 优雅地关闭服务器.
+         * 正在处理的请求完成后IOLoop::start返回
+         *
+         * @param timeout 等待请求完成的最长时间(毫秒)
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool shutdown(uint64_t timeout = 30000);
+        /**
+         * 收到信号时优雅地关闭服务器, 应在IOLoop::start之前调用
+         *
+         * @param signum 信号, 默认为SIGTERM
+         *
+         * @param timeout 等待请求完成的最长时间(毫秒)
+         */
+        void shutdown_on_signal(int signum = SIGTERM, uint64_t timeout = 30000);
+        /**
+         * 取得Server, 用于设置Server特有的选项
+         *
+         * @return Server
+         */
+        T & get_server();
     private:
         T *server;
         Router *router;
+        WorkerPool *workers;
         void server_handler(Connection &conn);
+        bool is_streaming(Connection &conn);
+        void dispatch_blocking(Connection &conn, const RequestHandler &handler);
 };
 
 template<typename T> template<typename... Arguments>
 Application<T>::Application(const std::vector<HandlerStruct> &handlers,
-                            Arguments... args) {
+                            Arguments... args): workers(nullptr) {
     auto handler = std::bind(&Application<T>::server_handler,
                              this, std::placeholders::_1);
     this->router = new Router();
+    bool blocking = false;
+    bool streaming = false;
     for (auto &i: handlers) {
-        if (!router->add(i.pattern, i.handler, i.methods)) {
+        std::string msg;
+        if ((i.flags & Streaming) && (i.flags & Blocking)) {
+            msg = "streaming handler cannot be blocking: " + i.pattern;
+        } else if ((i.flags & Streaming) && !T::SupportsStreaming) {
+            msg = "streaming handler is not supported by the server: " + i.pattern;
+        } else if (!router->add(i.pattern, i.handler, i.methods, i.flags)) {
+            msg = "invalid pattern: " + i.pattern;
+        }
+        if (!msg.empty()) {
             delete this->router;
-            std::string msg = "invalid pattern: " + i.pattern;
             throw ApplicationException(msg);
         }
+        if (i.flags & Blocking) {
+            blocking = true;
+        }
+        if (i.flags & Streaming) {
+            streaming = true;
+        }
     }
     this->server = new T(handler, args...);
     if (!server->initialize()) {
         delete this->server;
+        delete this->router;
         throw ApplicationException("cannot initialize server.");
     }
+    if (streaming) {
+        this->server->set_streaming_checker(
+            std::bind(&Application<T>::is_streaming, this, std::placeholders::_1));
+    }
+    if (blocking) {
+        this->workers = new WorkerPool();
+        this->server->set_worker_pool(this->workers);
+    }
 }
 
 template<typename T>
 Application<T>::~Application() {
+    delete this->workers;
     delete this->server;
     delete this->router;
 }
@@ -75,19 +139,77 @@ void Application<T>::listen(Arguments... args) {
     }
 }
 
+template<typename T>
+void Application<T>::set_workers(size_t threads, size_t max_queue) {
+    delete this->workers;
+    this->workers = new WorkerPool(threads, max_queue);
+    this->server->set_worker_pool(this->workers);
+}
+
+template<typename T>
+bool Application<T>::shutdown(uint64_t timeout) {
+    return this->server->shutdown(timeout);
+}
+
+template<typename T>
+T & Application<T>::get_server() {
+    return *this->server;
+}
+
+template<typename T>
+void Application<T>::shutdown_on_signal(int signum, uint64_t timeout) {
+    auto callback = [this, timeout]() {
+        this->shutdown(timeout);
+    };
+    if (!IOLoop::get_instance().add_signal(signum, callback)) {
+        throw ApplicationException("cannot add signal handler.");
+    }
+}
+
 template<typename T>
 void Application<T>::server_handler(Connection &conn) {
     const std::string &path = conn.get_path();
     HTTPMethod method = conn.get_method();
     SSMap &path_arguments = conn.get_path_arguments();
     const ErrorHandler &error_handler = this->router->get_error_handler();
+    int flags;
     const RequestHandler &handler =
-        this->router->route(path, method, path_arguments);
+        this->router->route(path, method, path_arguments, flags);
     conn.set_error_handler(error_handler);
+    if ((flags & Blocking) && this->workers) {
+        this->dispatch_blocking(conn, handler);
+        return;
+    }
     handler(conn);
-    if (!conn.is_finished()) {
+    if (!conn.is_finished() && !conn.is_deferred()) {
         conn.finish();
     }
 }
+
+template<typename T>
+bool Application<T>::is_streaming(Connection &conn) {
+    SSMap arguments;
+    int flags;
+    this->router->route(conn.get_path(), conn.get_method(), arguments, flags);
+    return flags & Streaming;
+}
+
+template<typename T>
+void Application<T>::dispatch_blocking(Connection &conn,
+                                       const RequestHandler &handler) {
+    ConnectionPtr handle = conn.shared_from_this();
+    bool submitted = this->workers->submit([handle, handler]() {
+        handler(*handle);
+        if (!handle->is_finished()) {
+            handle->finish();
+        }
+    });
+    if (!submitted) {
+        conn.send_error(503);
+        if (!conn.is_finished()) {
+            conn.finish();
+        }
+    }
+}
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 请求级的内存池
+ */
+#ifndef RECYCLED_INCLUDE_ARENA_H
+#define RECYCLED_INCLUDE_ARENA_H
+#include <stdint.h>
+#include <stddef.h>
+#include "recycled/stringview.h"
+
+namespace recycled {
+/**
+ * 只增不减的内存池, 分配时只移动指针, 单独的释放不做任何事,
+ * 所有内存在reset或析构时一起释放. 不是线程安全的
+ */
+class Arena {
+    public:
+        /**
+         * 构造内存池, 第一次分配时才申请内存
+         *
+         * @param block_size 第一个内存块的大小, 之后的内存块逐渐加倍
+         */
+        Arena(size_t block_size = 4096);
+        Arena(const Arena &other) = delete;
+        ~Arena();
+        const Arena & operator=(const Arena &other) = delete;
+        /**
+         * 分配内存, 失败时抛出std::bad_alloc
+         *
+         * @param size 大小
+         *
+         * @param align 对齐, 必须是2的幂
+         *
+         * @return 分配的内存
+         */
+        void * allocate(size_t size, size_t align = alignof(max_align_t));
+        /**
+         * 把一段字符串复制到内存池中
+         *
+         * @param data 字符串
+         *
+         * @param size 长度
+         *
+         * @return 指向副本的视图
+         */
+        StringView copy(const char *data, size_t size);
+        /**
+         * 释放所有分配的内存. 只保留最大的内存块以便重用,
+         * 之前分配的内存全部失效
+         */
+        void reset();
+        /**
+         * 取得已分配的字节数
+         *
+         * @return 字节数
+         */
+        size_t get_used() const;
+    private:
+        struct Block {
+            Block *next;
+            size_t size;
+        };
+        Block *head;
+        char *ptr, *end;
+        size_t block_size, used;
+        void grow(size_t size, size_t align);
+};
+
+/**
+ * 从Arena分配内存的STL分配器, deallocate不释放内存
+ */
+template<typename T>
+class ArenaAllocator {
+    public:
+        typedef T value_type;
+        ArenaAllocator(Arena *arena) noexcept: arena(arena) {}
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) noexcept:
+            arena(other.get_arena()) {}
+        T * allocate(size_t n) {
+            return (T *)this->arena->allocate(n * sizeof(T), alignof(T));
+        }
+        void deallocate(T *p, size_t n) noexcept {}
+        Arena * get_arena() const noexcept {return this->arena;}
+    private:
+        Arena *arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.get_arena() == b.get_arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return a.get_arena() != b.get_arena();
+}
+}
+#endif
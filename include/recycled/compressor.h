@@ -0,0 +1,112 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 响应体的gzip/deflate压缩
+ */
+#ifndef RECYCLED_INCLUDE_COMPRESSOR_H
+#define RECYCLED_INCLUDE_COMPRESSOR_H
+#include <stddef.h>
+#include <zlib.h>
+#include <event2/buffer.h>
+#include "recycled/stringview.h"
+
+namespace recycled {
+enum class ContentEncoding {
+    Identity,
+    Gzip,
+    Deflate
+};
+
+/**
+ * 响应压缩的选项
+ */
+struct CompressionOptions {
+    /**
+     * 小于该长度的完整响应不压缩, 为SIZE_MAX时不压缩任何响应
+     */
+    size_t min_size;
+    /**
+     * zlib的压缩级别
+     */
+    int level;
+};
+
+/**
+ * zlib压缩流. 每个线程(即每个事件循环)有一个压缩流的池,
+ * 放回池中的压缩流只需要deflateReset, 不重新分配zlib的内部状态
+ */
+class Compressor {
+    public:
+        Compressor(const Compressor &other) = delete;
+        ~Compressor();
+        const Compressor & operator=(const Compressor &other) = delete;
+        /**
+         * 从当前线程的池中取得一个压缩流, 池中没有时创建
+         *
+         * @param encoding 压缩方式, 不能是ContentEncoding::Identity
+         *
+         * @param level zlib的压缩级别
+         *
+         * @return 压缩流, 失败时返回NULL
+         */
+        static Compressor * acquire(ContentEncoding encoding, int level);
+        /**
+         * 把压缩流放回当前线程的池中
+         *
+         * @param compressor 压缩流
+         */
+        static void release(Compressor *compressor);
+        /**
+         * 压缩缓冲区中的全部数据并追加到output, 数据从input中移除.
+         * 不结束压缩流时输出同步点, 使已输入的数据都可以被解压
+         *
+         * @param input 输入
+         *
+         * @param output 输出
+         *
+         * @param finish 是否结束压缩流
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool compress(evbuffer *input, evbuffer *output, bool finish);
+    private:
+        z_stream stream;
+        ContentEncoding encoding;
+        int level;
+        Compressor(ContentEncoding encoding, int level);
+        bool initialize();
+};
+
+/**
+ * 判断Accept-Encoding是否接受指定的编码, q=0表示不接受
+ *
+ * @param header Accept-Encoding的值
+ *
+ * @param coding 编码, 不区分大小写
+ *
+ * @return 接受时返回true, 否则返回false
+ */
+bool accepts_encoding(const StringView &header, const char *coding);
+/**
+ * 根据Accept-Encoding选择压缩方式, 都接受时使用gzip
+ *
+ * @param header Accept-Encoding的值
+ *
+ * @return 压缩方式, 都不接受时返回ContentEncoding::Identity
+ */
+ContentEncoding negotiate_encoding(const StringView &header);
+/**
+ * 判断Content-Type的响应体是否值得压缩.
+ * 文本, JSON, JavaScript和XML等返回true, 图片, 音视频和压缩包等已压缩的类型返回false
+ *
+ * @param content_type Content-Type的值
+ *
+ * @return 值得压缩时返回true, 否则返回false
+ */
+bool is_compressible(const StringView &content_type);
+}
+#endif
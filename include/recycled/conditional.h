@@ -0,0 +1,105 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 条件请求使用的ETag和HTTP日期
+ */
+#ifndef RECYCLED_INCLUDE_CONDITIONAL_H
+#define RECYCLED_INCLUDE_CONDITIONAL_H
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "recycled/stringview.h"
+
+namespace recycled {
+/**
+ * 响应体中的一段, 包括first和last
+ */
+struct ByteRange {
+    uint64_t first;
+    uint64_t last;
+};
+
+/**
+ * 用FNV-1a计算数据的哈希, 分段的数据可以把上一段的结果作为hash继续计算
+ *
+ * @param data 数据
+ *
+ * @param size 数据长度
+ *
+ * @param hash 上一段的哈希
+ *
+ * @return 哈希
+ */
+uint64_t hash_data(const char *data, size_t size,
+                   uint64_t hash = 14695981039346656037ULL);
+/**
+ * 把哈希格式化为强ETag, 如"0123456789abcdef-gzip"(包括引号)
+ *
+ * @param hash 哈希
+ *
+ * @param suffix 附加在哈希之后的后缀
+ *
+ * @return ETag
+ */
+std::string format_etag(uint64_t hash, const char *suffix = "");
+/**
+ * 判断If-None-Match是否匹配ETag, 使用弱比较
+ *
+ * @param header If-None-Match的值
+ *
+ * @param etag ETag, 包括引号, 可以是弱ETag
+ *
+ * @return 匹配时返回true, 否则返回false
+ */
+bool etag_matches(const StringView &header, const StringView &etag);
+/**
+ * 把时间格式化为HTTP日期, 如"Sun, 06 Nov 1994 08:49:37 GMT"
+ *
+ * @param stamp 时间
+ *
+ * @return HTTP日期
+ */
+std::string format_http_date(time_t stamp);
+/**
+ * 解析HTTP日期
+ *
+ * @param date HTTP日期
+ *
+ * @return 时间, 格式错误时返回-1
+ */
+time_t parse_http_date(const StringView &date);
+/**
+ * 解析Range请求头. 可以满足的范围按起始位置排序, 重叠或相邻的范围被合并
+ *
+ * @param header Range的值
+ *
+ * @param size 响应体的长度
+ *
+ * @param ranges 保存可以满足的范围
+ *
+ * @return 有可以满足的范围时返回1, 都不能满足时返回-1(应返回416),
+ *         格式错误, 不是bytes单位或范围太多时返回0(应忽略Range)
+ */
+int parse_range(const StringView &header, uint64_t size,
+                std::vector<ByteRange> &ranges);
+/**
+ * 判断If-Range是否匹配响应的验证器. ETag使用强比较, 日期必须与Last-Modified相同
+ *
+ * @param header If-Range的值
+ *
+ * @param etag 响应的ETag, 可以为空
+ *
+ * @param last_modified 响应的Last-Modified, 可以为空
+ *
+ * @return 匹配时返回true, 否则返回false
+ */
+bool if_range_matches(const StringView &header, const StringView &etag,
+                      const StringView &last_modified);
+}
+#endif
@@ -9,11 +9,16 @@
  */
 #ifndef RECYCLED_INCLUDE_CONNECTION_H
 #define RECYCLED_INCLUDE_CONNECTION_H
+#include <sys/types.h>
 #include <string>
 #include <vector>
 #include <set>
 #include <map>
+#include <memory>
+#include <functional>
 #include "recycled/handler.h"
+#include "recycled/stringview.h"
+#include "recycled/arena.h"
 
 namespace recycled {
 /**
@@ -21,6 +26,16 @@ namespace recycled {
  */
 enum class HTTPMethod {GET, POST, PUT, PATCH, DELETE, HEAD, OPTIONS, Other};
 
+/**
+ * 常用的HTTP请求头, 解析请求时识别并放入固定的位置
+ */
+enum class HTTPHeader {
+    Host, Connection, ContentType, ContentLength, TransferEncoding, Cookie,
+    Accept, AcceptEncoding, AcceptLanguage, UserAgent, Referer, Origin,
+    Authorization, IfNoneMatch, IfModifiedSince, IfMatch, IfUnmodifiedSince,
+    IfRange, Range, Expect, Other
+};
+
 static const std::set<int> StatusCodes = {
     100, 101,
     200, 201, 202, 203, 204, 205, 206,
@@ -74,21 +89,114 @@ static const std::map<int, const char *> StatusReasons = {
 };
 
 typedef std::vector<std::string> SVector;
+/**
+ * 多个响应共享的只读数据, 如预先生成的JSON
+ */
+typedef std::shared_ptr<const std::string> SharedBuffer;
+/**
+ * 输出响应体中从offset开始的length个字节, 成功返回true
+ */
+typedef std::function<bool (uint64_t offset, uint64_t length)> RangeWriter;
 typedef std::map<std::string, std::string> SSMap;
 typedef std::multimap<std::string, std::string> SSMultiMap;
+typedef std::pair<const StringView, StringView> ViewPair;
+/**
+ * 键和值都是视图, 节点从Arena分配的Map, 用于请求级的数据
+ */
+typedef std::map<StringView, StringView, std::less<StringView>,
+                 ArenaAllocator<ViewPair>> ViewMap;
+typedef std::multimap<StringView, StringView, std::less<StringView>,
+                      ArenaAllocator<ViewPair>> ViewMultiMap;
 
 struct UploadFile {
     std::string filename; /**< 文件名 */
     std::string content_type; /**< 文件的Content-Type */
-    const char *data; /**< 文件数据 */
+    const char *data; /**< 文件数据, 指向请求Body或映射到内存的临时文件 */
     size_t size; /**< 文件大小 */
+    /**
+     * 文件较大时保存在这个临时文件中, 否则为空. 处理器可以在请求结束前
+     * 把它rename或link到其他位置, 不需要复制; 请求结束时临时文件被删除
+     */
+    std::string path;
+};
+
+/**
+ * 遍历同名参数的迭代器, 依次给出每个参数值的视图, 不分配内存.
+ * 可以连续遍历两段范围(如URL Query参数之后是Body参数)
+ */
+class ArgumentIterator {
+    public:
+        typedef ViewMultiMap::const_iterator BaseIterator;
+        ArgumentIterator(BaseIterator it, BaseIterator end,
+                         BaseIterator next, BaseIterator next_end):
+            it(it), end(end), next(next), next_end(next_end), second(false) {
+            this->skip();
+        }
+        StringView operator*() const {return this->it->second;}
+        ArgumentIterator & operator++() {
+            ++this->it;
+            this->skip();
+            return *this;
+        }
+        bool operator==(const ArgumentIterator &other) const {
+            // 不同范围的迭代器可能属于不同的容器, 不能直接比较
+            return this->second == other.second && this->it == other.it;
+        }
+        bool operator!=(const ArgumentIterator &other) const {
+            return !(*this == other);
+        }
+    private:
+        BaseIterator it, end, next, next_end;
+        bool second;
+        void skip() {
+            if (!this->second && this->it == this->end) {
+                this->it = this->next;
+                this->end = this->next_end;
+                this->second = true;
+            }
+        }
 };
 
+/**
+ * 同名参数的范围, 可用于range-based for.
+ * 在所属的Connection有效期间有效
+ */
+class ArgumentRange {
+    public:
+        typedef ArgumentIterator::BaseIterator BaseIterator;
+        ArgumentRange(BaseIterator begin, BaseIterator end):
+            first_begin(begin), first_end(end),
+            second_begin(end), second_end(end) {}
+        ArgumentRange(BaseIterator first_begin, BaseIterator first_end,
+                      BaseIterator second_begin, BaseIterator second_end):
+            first_begin(first_begin), first_end(first_end),
+            second_begin(second_begin), second_end(second_end) {}
+        ArgumentIterator begin() const {
+            return ArgumentIterator(this->first_begin, this->first_end,
+                                    this->second_begin, this->second_end);
+        }
+        ArgumentIterator end() const {
+            return ArgumentIterator(this->second_end, this->second_end,
+                                    this->second_end, this->second_end);
+        }
+        bool empty() const {return !(this->begin() != this->end());}
+    private:
+        BaseIterator first_begin, first_end, second_begin, second_end;
+};
+
+class Connection;
+/**
+ * Connection的引用计数句柄
+ */
+typedef std::shared_ptr<Connection> ConnectionPtr;
+
 /**
  * 规范HTTP Connection的借口
+ * Connection由服务器通过std::shared_ptr持有
  */
-class Connection {
+class Connection: public std::enable_shared_from_this<Connection> {
     public:
+        virtual ~Connection() {}
         /**
          * 向响应Body输出数据
          *
@@ -107,6 +215,58 @@ class Connection {
          * @return 输出成功返回true, 否则返回false
          */
         virtual bool write(const std::string &str) = 0;
+        /**
+         * 以引用的方式向响应Body输出数据, 不复制.
+         * 数据在发送完成(或响应被放弃)前必须保持有效, 之后调用release
+         *
+         * @param data 要输出的数据
+         *
+         * @param size 输出数据的大小
+         *
+         * @param release 数据不再被引用时调用, 在连接所属的事件循环线程中调用.
+         * 为空时表示数据一直有效(如静态数据). 输出失败时不调用
+         *
+         * @return 输出成功返回true, 否则返回false
+         */
+        virtual bool write_reference(const char *data, size_t size,
+                                     const std::function<void ()> &release = nullptr) = 0;
+        /**
+         * 向响应Body输出共享的数据, 不复制, 发送完成前持有一个引用
+         *
+         * @param data 共享的数据
+         *
+         * @return 输出成功返回true, 否则返回false
+         */
+        virtual bool write_shared(const SharedBuffer &data) = 0;
+        /**
+         * 向响应Body输出文件的一段, 不读入用户空间的缓冲区, 可能时使用sendfile发送.
+         * 文件描述符的所有权转移给连接, 发送完成后关闭, 输出失败时也会关闭
+         *
+         * @param fd 打开的文件描述符
+         *
+         * @param offset 起始位置
+         *
+         * @param length 长度, 为-1时到文件末尾
+         *
+         * @return 输出成功返回true, 否则返回false
+         */
+        virtual bool write_file(int fd, off_t offset = 0, off_t length = -1) = 0;
+        /**
+         * 按请求的Range输出长度为size的响应体, 用于断点续传和拖动播放.
+         * 应在设置Content-Type, ETag和Last-Modified之后调用, If-Range与它们比较.
+         * 没有Range, Range无效或If-Range不匹配时输出整个响应体; 一个范围时返回206和
+         * Content-Range; 多个范围时返回206并以multipart/byteranges输出; 都不能满足时返回416.
+         * 同时设置Accept-Ranges和Content-Length. writer被调用输出每个范围,
+         * 可以使用write, write_reference或write_file. 只处理GET和HEAD的Range,
+         * HEAD请求得到与GET相同的响应头, 不调用writer
+         *
+         * @param size 完整响应体的长度
+         *
+         * @param writer 输出响应体一部分的函数
+         *
+         * @return 输出成功返回true, 否则(包括writer返回false)返回false
+         */
+        virtual bool write_ranges(uint64_t size, const RangeWriter &writer) = 0;
         /**
          * 设置HTTP响应状态
          *
@@ -124,9 +284,10 @@ class Connection {
          */
         virtual HTTPMethod get_method() const = 0;
         /**
-         * 取得请求Body
+         * 取得请求Body. 指向连接的输入缓冲区, 不复制, 不以'\0'结尾,
+         * 在连接释放后失效
          *
-         * @return 请求Body的指针
+         * @return 请求Body的指针, 没有Body时为nullptr
          */
         virtual const char * get_body() const = 0;
         /**
@@ -135,6 +296,12 @@ class Connection {
          * @return 请求Body的大小(以sizeof(char)为单位)
          */
         virtual size_t get_body_size() const = 0;
+        /**
+         * 复制请求Body, 需要在连接释放后继续使用Body时调用
+         *
+         * @return 请求Body的副本
+         */
+        virtual std::string copy_body() const = 0;
         /**
          * 取得上传的文件
          *
@@ -193,7 +360,8 @@ class Connection {
         /**
          * 取得HTTP请求头
          *
-         * @param key 请求头名(若一个请求头名有多个值返回最后一个)
+         * @param key 请求头名, 不区分大小写(若一个请求头名有多个值, 值为列表的
+         *            常用请求头如Accept, Cookie返回合并后的值, 其余返回第一个)
          *
          * @return 请求头值(无此请求头返回空字符串)
          */
@@ -256,6 +424,90 @@ class Connection {
          * @return Path参数Map的引用(可修改)
          */
         virtual SSMap & get_path_arguments() = 0;
+        /**
+         * 以下get_*_view与对应的get_*相同, 但返回指向Connection内部存储的视图,
+         * 不复制字符串. 视图在Connection释放前有效
+         *
+         * @return HTTP请求路径的视图
+         */
+        virtual StringView get_path_view() const = 0;
+        /**
+         * @return HTTP请求URI的视图
+         */
+        virtual StringView get_uri_view() const = 0;
+        /**
+         * @param key 参数名
+         *
+         * @return URL Query参数值的视图(多个值时为最后一个, 没有时为空)
+         */
+        virtual StringView get_query_argument_view(const std::string &key) const = 0;
+        /**
+         * @param key 参数名
+         *
+         * @return Body参数值的视图(多个值时为最后一个, 没有时为空)
+         */
+        virtual StringView get_body_argument_view(const std::string &key) const = 0;
+        /**
+         * @param key 参数名
+         *
+         * @return URL Query或Body参数值的视图(优先考虑URL Query参数)
+         */
+        virtual StringView get_argument_view(const std::string &key) const = 0;
+        /**
+         * @param key 参数名
+         *
+         * @return Path参数值的视图
+         */
+        virtual StringView get_path_argument_view(const std::string &key) const = 0;
+        /**
+         * @param key 请求头名, 不区分大小写
+         *
+         * @return 请求头值的视图
+         */
+        virtual StringView get_header_view(const std::string &key) const = 0;
+        /**
+         * 直接取得常用的请求头, 不需要比较请求头名
+         *
+         * @param header 请求头, 不能为HTTPHeader::Other
+         *
+         * @return 请求头值的视图
+         */
+        virtual StringView get_header_view(HTTPHeader header) const = 0;
+        /**
+         * @param key Cookie名
+         *
+         * @return Cookie值的视图
+         */
+        virtual StringView get_cookie_view(const std::string &key) const = 0;
+        /**
+         * 遍历所有指定名字的URL Query参数, 不分配内存
+         * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.cpp}
+         * for (StringView value: conn.get_query_arguments_view("id")) {
+         *     ...
+         * }
+         * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+         *
+         * @param key 参数名
+         *
+         * @return 参数值的范围
+         */
+        virtual ArgumentRange get_query_arguments_view(const std::string &key) const = 0;
+        /**
+         * 遍历所有指定名字的Body参数, 不分配内存
+         *
+         * @param key 参数名
+         *
+         * @return 参数值的范围
+         */
+        virtual ArgumentRange get_body_arguments_view(const std::string &key) const = 0;
+        /**
+         * 遍历所有指定名字的URL Query及Body参数, 不分配内存
+         *
+         * @param key 参数名
+         *
+         * @return 参数值的范围, 先是URL Query参数, 然后是Body参数
+         */
+        virtual ArgumentRange get_arguments_view(const std::string &key) const = 0;
         /**
          * 设置错误处理器
          *
@@ -334,7 +586,8 @@ class Connection {
         /**
          * 将缓冲区的内容全部发送并清空缓冲区.
          * flush后将不能增加, 删除响应头,
-         * 也不能使用重定向、发送错误或修改响应状态
+         * 也不能使用重定向、发送错误或修改响应状态.
+         * 可以在工作线程中调用, 数据会在连接所属的事件循环线程中发送
          *
          * @return 发送成功返回true, 否则返回false
          */
@@ -342,7 +595,8 @@ class Connection {
         /**
          * 完成响应.
          * finish后将不能增加, 删除响应头, 不能向Body输出数据
-         * 也不能使用重定向、发送错误或修改响应状态
+         * 也不能使用重定向、发送错误或修改响应状态.
+         * 可以在工作线程中调用, 响应会在连接所属的事件循环线程中发送
          *
          * @return 完成响应成功返回true, 否则返回false
          */
@@ -365,12 +619,77 @@ class Connection {
          * @return 重定向成功返回true, 否则返回false
          */
         virtual bool redirect(const std::string &url, int status=302) = 0;
+        /**
+         * 用调用者提供的验证器检查客户端缓存的响应是否仍然有效, 应在生成响应体之前调用.
+         * 设置ETag和Last-Modified响应头; GET和HEAD请求的If-None-Match匹配etag,
+         * 或没有If-None-Match而If-Modified-Since不早于last_modified时, 把状态码设为304,
+         * 此时处理器不需要再输出响应体
+         *
+         * @param etag 响应的ETag, 没有引号时自动加上, 为空时不使用
+         *
+         * @param last_modified 响应的最后修改时间, 为0时不使用
+         *
+         * @return 客户端的缓存有效返回true, 否则返回false
+         */
+        virtual bool check_not_modified(const std::string &etag,
+                                        time_t last_modified = 0) = 0;
+        /**
+         * 判断请求的If-None-Match或If-Modified-Since是否表明客户端缓存的响应仍然有效,
+         * 不修改响应. 有If-None-Match时忽略If-Modified-Since, 只对GET和HEAD请求返回true
+         *
+         * @param etag 响应的ETag(带引号), 为空时不比较
+         *
+         * @param last_modified 响应的最后修改时间, 为-1时不比较
+         *
+         * @return 客户端的缓存有效返回true, 否则返回false
+         */
+        virtual bool is_not_modified(const StringView &etag,
+                                     time_t last_modified) const = 0;
          /**
          * 判断是否已经完成相应
          *
          * @return 响应已完成返回true, 否则返回false
          */
         virtual bool is_finished() const = 0;
+        /**
+         * 延迟完成响应.
+         * 调用后处理器返回时不会自动完成响应, 请求会一直保持,
+         * 直到通过返回的句柄调用finish. 若所有句柄都被释放时仍未完成响应,
+         * 响应会自动完成. 除finish和flush外, 句柄应在连接所属的事件循环线程中使用
+         *
+         * @return 连接的引用计数句柄
+         */
+        virtual ConnectionPtr defer() = 0;
+        /**
+         * 判断是否已经延迟完成响应
+         *
+         * @return 调用过defer返回true, 否则返回false
+         */
+        virtual bool is_deferred() const = 0;
+        /**
+         * 设置流式接收请求体的回调, 用于设置了HandlerFlag::Streaming的处理器.
+         * 每收到一段请求体调用一次on_data, 请求体结束后调用on_end; 调用前已经收到的部分
+         * 立即交出. 服务器在调用处理器前已经收完请求体时(如HTTPServer),
+         * 整个请求体作为一段立即交出. 回调在连接所属的事件循环线程中调用,
+         * 数据只在回调期间有效. 调用后响应延迟完成(同defer), 处理器通常在on_end中完成响应
+         *
+         * @param on_data 收到一段请求体的回调
+         *
+         * @param on_end 请求体结束的回调
+         *
+         * @return 设置成功返回true, 否则返回false
+         */
+        virtual bool set_body_handler(const BodyDataHandler &on_data,
+                                      const BodyEndHandler &on_end) = 0;
+        /**
+         * 暂停接收请求体, 处理器来不及处理时调用, 对端会因TCP流量控制而停止发送.
+         * 可以在任意线程中调用
+         */
+        virtual void pause_body() = 0;
+        /**
+         * 恢复接收请求体. 可以在任意线程中调用
+         */
+        virtual void resume_body() = 0;
 };
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,602 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 基于C++20协程的请求处理器.
+ * 仅在以C++20(或更新标准)编译时可用, 协程总是在所属IOLoop的线程中恢复执行
+ */
+#ifndef RECYCLED_INCLUDE_COROUTINE_H
+#define RECYCLED_INCLUDE_COROUTINE_H
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <stdint.h>
+#include <string>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <event2/util.h>
+#include <event2/keyvalq_struct.h>
+#include "recycled/connection.h"
+#include "recycled/handler.h"
+#include "recycled/ioloop.h"
+#include "recycled/workerpool.h"
+
+namespace recycled {
+class CoroutineException: public std::exception {
+    public:
+        CoroutineException(const std::string &msg): msg(msg) {}
+        ~CoroutineException() noexcept {}
+        const char * what() const noexcept {return this->msg.c_str();}
+    private:
+        std::string msg;
+};
+
+/**
+ * 协程帧内存池.
+ * 每个线程(即每个事件循环)一个, 按64字节分级缓存已释放的协程帧
+ */
+class FramePool {
+    public:
+        FramePool(const FramePool &other) = delete;
+        const FramePool & operator=(const FramePool &other) = delete;
+        ~FramePool() {
+            for (size_t i = 0; i < ClassCount; ++i) {
+                while (this->free_lists[i]) {
+                    Node *node = this->free_lists[i];
+                    this->free_lists[i] = node->next;
+                    ::operator delete(node);
+                }
+            }
+        }
+        /**
+         * 取得当前线程的内存池
+         *
+         * @return 当前线程的内存池
+         */
+        static FramePool & local() {
+            static thread_local FramePool pool;
+            return pool;
+        }
+        void * allocate(size_t size) {
+            size_t index = (size + Granularity - 1) / Granularity;
+            if (index >= ClassCount) {
+                return ::operator new(size);
+            }
+            Node *node = this->free_lists[index];
+            if (node) {
+                this->free_lists[index] = node->next;
+                return node;
+            }
+            return ::operator new(index * Granularity);
+        }
+        void deallocate(void *ptr, size_t size) {
+            size_t index = (size + Granularity - 1) / Granularity;
+            if (index >= ClassCount) {
+                ::operator delete(ptr);
+                return;
+            }
+            Node *node = (Node *)ptr;
+            node->next = this->free_lists[index];
+            this->free_lists[index] = node;
+        }
+    private:
+        struct Node {
+            Node *next;
+        };
+        static const size_t Granularity = 64;
+        static const size_t ClassCount = 64;
+        Node *free_lists[ClassCount] = {};
+        FramePool() = default;
+};
+
+template<typename T = void>
+class Task;
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    static void * operator new(size_t size) {
+        return FramePool::local().allocate(size);
+    }
+    static void operator delete(void *ptr, size_t size) {
+        FramePool::local().deallocate(ptr, size);
+    }
+    struct FinalAwaiter {
+        bool await_ready() noexcept {return false;}
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> continuation = h.promise().continuation;
+            if (continuation) {
+                return continuation;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    std::suspend_always initial_suspend() noexcept {return {};}
+    FinalAwaiter final_suspend() noexcept {return {};}
+    void unhandled_exception() {
+        this->exception = std::current_exception();
+    }
+};
+
+template<typename T>
+struct TaskPromise: TaskPromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    template<typename U>
+    void return_value(U &&v) {
+        this->value.emplace(std::forward<U>(v));
+    }
+    T result() {
+        if (this->exception) {
+            std::rethrow_exception(this->exception);
+        }
+        return std::move(*this->value);
+    }
+};
+
+template<>
+struct TaskPromise<void>: TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (this->exception) {
+            std::rethrow_exception(this->exception);
+        }
+    }
+};
+
+/**
+ * 惰性启动的协程任务, 被co_await时才开始执行
+ */
+template<typename T>
+class Task {
+    public:
+        typedef TaskPromise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> Handle;
+        explicit Task(Handle handle): handle(handle) {}
+        Task(Task &&other) noexcept: handle(other.handle) {
+            other.handle = nullptr;
+        }
+        Task(const Task &other) = delete;
+        ~Task() {
+            if (this->handle) {
+                this->handle.destroy();
+            }
+        }
+        Task & operator=(Task &&other) noexcept {
+            if (this != &other) {
+                if (this->handle) {
+                    this->handle.destroy();
+                }
+                this->handle = other.handle;
+                other.handle = nullptr;
+            }
+            return *this;
+        }
+        const Task & operator=(const Task &other) = delete;
+        bool await_ready() const noexcept {
+            return !this->handle || this->handle.done();
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            this->handle.promise().continuation = awaiting;
+            return this->handle;
+        }
+        T await_resume() {
+            return this->handle.promise().result();
+        }
+    private:
+        Handle handle;
+};
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+struct DetachedTask {
+    struct promise_type {
+        static void * operator new(size_t size) {
+            return FramePool::local().allocate(size);
+        }
+        static void operator delete(void *ptr, size_t size) {
+            FramePool::local().deallocate(ptr, size);
+        }
+        DetachedTask get_return_object() {return {};}
+        std::suspend_never initial_suspend() noexcept {return {};}
+        std::suspend_never final_suspend() noexcept {return {};}
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+};
+
+inline DetachedTask run_detached(Task<void> task) {
+    try {
+        co_await task;
+    } catch (...) {
+    }
+}
+
+/**
+ * 立即开始执行一个任务, 不等待其完成. 任务中未捕获的异常会被忽略
+ *
+ * @param task 要执行的任务
+ */
+inline void spawn(Task<void> task) {
+    run_detached(std::move(task));
+}
+
+class DelayAwaiter {
+    public:
+        explicit DelayAwaiter(uint64_t milliseconds): milliseconds(milliseconds) {}
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            IOLoop *loop = IOLoop::current();
+            if (!loop) {
+                throw CoroutineException("not in an IOLoop thread");
+            }
+            loop->call_later(this->milliseconds, [h]() {
+                h.resume();
+            });
+        }
+        void await_resume() const noexcept {}
+    private:
+        uint64_t milliseconds;
+};
+
+class FDAwaiter {
+    public:
+        FDAwaiter(evutil_socket_t fd, short events, int64_t milliseconds):
+            fd(fd), events(events), milliseconds(milliseconds), result(0) {}
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            IOLoop *loop = IOLoop::current();
+            if (!loop) {
+                throw CoroutineException("not in an IOLoop thread");
+            }
+            this->handle = h;
+            timeval tv, *ptv = nullptr;
+            if (this->milliseconds >= 0) {
+                tv.tv_sec = this->milliseconds / 1000;
+                tv.tv_usec = (this->milliseconds % 1000) * 1000;
+                ptv = &tv;
+            }
+            if (event_base_once(loop->get_base(), this->fd, this->events,
+                                callback, this, ptv) != 0) {
+                throw CoroutineException("cannot add event");
+            }
+        }
+        bool await_resume() const noexcept {
+            return (this->result & this->events) != 0;
+        }
+    private:
+        evutil_socket_t fd;
+        short events;
+        int64_t milliseconds;
+        short result;
+        std::coroutine_handle<> handle;
+        static void callback(evutil_socket_t fd, short what, void *arg) {
+            FDAwaiter *awaiter = (FDAwaiter *)arg;
+            awaiter->result = what;
+            awaiter->handle.resume();
+        }
+};
+
+template<typename F>
+class WorkerAwaiter {
+    public:
+        typedef std::invoke_result_t<F> Result;
+        WorkerAwaiter(WorkerPool &pool, F job): pool(pool), job(std::move(job)) {}
+        bool await_ready() const noexcept {return false;}
+        bool await_suspend(std::coroutine_handle<> h) {
+            IOLoop *loop = IOLoop::current();
+            if (!loop) {
+                this->exception = std::make_exception_ptr(
+                    CoroutineException("not in an IOLoop thread"));
+                return false;
+            }
+            bool submitted = this->pool.submit([this, h, loop]() {
+                try {
+                    if constexpr (std::is_void_v<Result>) {
+                        this->job();
+                    } else {
+                        this->value.emplace(this->job());
+                    }
+                } catch (...) {
+                    this->exception = std::current_exception();
+                }
+                loop->post([h]() {
+                    h.resume();
+                });
+            });
+            if (!submitted) {
+                this->exception = std::make_exception_ptr(
+                    CoroutineException("worker pool queue is full"));
+                return false;
+            }
+            return true;
+        }
+        Result await_resume() {
+            if (this->exception) {
+                std::rethrow_exception(this->exception);
+            }
+            if constexpr (!std::is_void_v<Result>) {
+                return std::move(*this->value);
+            }
+        }
+    private:
+        typedef std::conditional_t<std::is_void_v<Result>,
+                                   bool, std::optional<Result>> Storage;
+        WorkerPool &pool;
+        F job;
+        Storage value;
+        std::exception_ptr exception;
+};
+
+/**
+ * 上游HTTP请求的响应
+ */
+struct FetchResponse {
+    int status; /**< 状态码, 连接失败或超时时为0 */
+    SSMap headers; /**< 响应头 */
+    std::string body; /**< 响应Body */
+    bool timed_out; /**< 是否因超时失败 */
+};
+
+class FetchAwaiter {
+    public:
+        FetchAwaiter(const std::string &url, HTTPMethod method,
+                     const std::string &body, uint64_t timeout):
+            url(url), method(method), body(body), timeout(timeout),
+            response({0, {}, "", false}), loop(nullptr), connection(nullptr),
+            timer(0) {}
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(std::coroutine_handle<> h) {
+            IOLoop *loop = IOLoop::current();
+            if (!loop) {
+                throw CoroutineException("not in an IOLoop thread");
+            }
+            this->handle = h;
+            evhttp_uri *uri = evhttp_uri_parse(this->url.c_str());
+            if (!uri || !evhttp_uri_get_host(uri)) {
+                if (uri) {
+                    evhttp_uri_free(uri);
+                }
+                throw CoroutineException("invalid url: " + this->url);
+            }
+            // 只支持明文的HTTP, 不能把https的请求以明文发送到80端口
+            const char *scheme = evhttp_uri_get_scheme(uri);
+            if (!scheme || evutil_ascii_strcasecmp(scheme, "http") != 0) {
+                evhttp_uri_free(uri);
+                throw CoroutineException("unsupported scheme: " + this->url);
+            }
+            std::string host = evhttp_uri_get_host(uri);
+            int port = evhttp_uri_get_port(uri);
+            std::string target = evhttp_uri_get_path(uri);
+            if (target.empty()) {
+                target = "/";
+            }
+            const char *query = evhttp_uri_get_query(uri);
+            if (query) {
+                target += "?";
+                target += query;
+            }
+            evhttp_uri_free(uri);
+            evhttp_connection *evcon =
+                evhttp_connection_base_new(loop->get_base(), NULL,
+                                           host.c_str(), port < 0 ? 80 : port);
+            if (!evcon) {
+                throw CoroutineException("cannot connect to " + host);
+            }
+            timeval tv;
+            tv.tv_sec = this->timeout / 1000;
+            tv.tv_usec = (this->timeout % 1000) * 1000;
+            evhttp_connection_set_timeout_tv(evcon, &tv);
+            evhttp_request *req = evhttp_request_new(callback, this);
+            evhttp_request_set_error_cb(req, error_callback);
+            evhttp_add_header(evhttp_request_get_output_headers(req),
+                              "Host", host.c_str());
+            if (!this->body.empty()) {
+                evbuffer_add(evhttp_request_get_output_buffer(req),
+                             this->body.data(), this->body.size());
+            }
+            this->loop = loop;
+            this->connection = evcon;
+            // 连接, 发送和等待响应的总时间, evhttp的超时不包括连接失败的情况
+            this->timer = loop->call_later(this->timeout, [this]() {
+                this->response.timed_out = true;
+                // 释放连接时不会调用请求的回调
+                evhttp_connection_free(this->connection);
+                this->handle.resume();
+            });
+            // 连接失败时回调可能在evhttp_make_request中就被调用并恢复协程,
+            // 成功返回后不能再访问this
+            if (evhttp_make_request(evcon, req, command(this->method),
+                                    target.c_str()) != 0) {
+                loop->cancel_timer(this->timer);
+                evhttp_connection_free(evcon);
+                throw CoroutineException("cannot make request to " + this->url);
+            }
+        }
+        FetchResponse await_resume() {
+            return std::move(this->response);
+        }
+    private:
+        std::string url;
+        HTTPMethod method;
+        std::string body;
+        uint64_t timeout;
+        FetchResponse response;
+        std::coroutine_handle<> handle;
+        IOLoop *loop;
+        evhttp_connection *connection;
+        TimerID timer;
+        static evhttp_cmd_type command(HTTPMethod method) {
+            switch (method) {
+                case HTTPMethod::POST:
+                    return EVHTTP_REQ_POST;
+                case HTTPMethod::PUT:
+                    return EVHTTP_REQ_PUT;
+                case HTTPMethod::PATCH:
+                    return EVHTTP_REQ_PATCH;
+                case HTTPMethod::DELETE:
+                    return EVHTTP_REQ_DELETE;
+                case HTTPMethod::HEAD:
+                    return EVHTTP_REQ_HEAD;
+                case HTTPMethod::OPTIONS:
+                    return EVHTTP_REQ_OPTIONS;
+                default:
+                    return EVHTTP_REQ_GET;
+            }
+        }
+        static void callback(evhttp_request *req, void *arg) {
+            FetchAwaiter *awaiter = (FetchAwaiter *)arg;
+            if (req && evhttp_request_get_response_code(req)) {
+                FetchResponse &response = awaiter->response;
+                response.status = evhttp_request_get_response_code(req);
+                evkeyvalq *headers = evhttp_request_get_input_headers(req);
+                for (evkeyval *i = headers->tqh_first; i; i = i->next.tqe_next) {
+                    response.headers[i->key] = i->value;
+                }
+                evbuffer *input = evhttp_request_get_input_buffer(req);
+                size_t length = evbuffer_get_length(input);
+                response.body.resize(length);
+                evbuffer_copyout(input, &response.body[0], length);
+            }
+            awaiter->loop->cancel_timer(awaiter->timer);
+            // 回调返回后evhttp还会使用连接, 连接失败时也不会自动释放,
+            // 所以在下一次事件循环迭代中释放
+            evhttp_connection *connection = awaiter->connection;
+            awaiter->loop->call_soon([connection]() {
+                evhttp_connection_free(connection);
+            });
+            awaiter->handle.resume();
+        }
+        static void error_callback(evhttp_request_error error, void *arg) {
+            // evhttp自己的读写超时可能先于定时器, 在callback之前调用
+            if (error == EVREQ_HTTP_TIMEOUT) {
+                ((FetchAwaiter *)arg)->response.timed_out = true;
+            }
+        }
+};
+
+/**
+ * 等待一段时间
+ *
+ * @param milliseconds 等待的毫秒数
+ */
+inline DelayAwaiter delay(uint64_t milliseconds) {
+    return DelayAwaiter(milliseconds);
+}
+
+/**
+ * 等待文件描述符可读
+ *
+ * @param fd 文件描述符
+ *
+ * @param milliseconds 超时毫秒数, 为负数时不超时
+ *
+ * @return co_await的结果: 可读返回true, 超时返回false
+ */
+inline FDAwaiter wait_readable(evutil_socket_t fd, int64_t milliseconds = -1) {
+    return FDAwaiter(fd, EV_READ, milliseconds);
+}
+
+/**
+ * 等待文件描述符可写
+ *
+ * @param fd 文件描述符
+ *
+ * @param milliseconds 超时毫秒数, 为负数时不超时
+ *
+ * @return co_await的结果: 可写返回true, 超时返回false
+ */
+inline FDAwaiter wait_writable(evutil_socket_t fd, int64_t milliseconds = -1) {
+    return FDAwaiter(fd, EV_WRITE, milliseconds);
+}
+
+/**
+ * 在工作线程池中运行一个任务, 完成后在当前IOLoop的线程中恢复执行
+ *
+ * @param pool 工作线程池
+ *
+ * @param job 任务, co_await的结果为其返回值.
+ * 等待队列已满时co_await抛出CoroutineException
+ */
+template<typename F>
+WorkerAwaiter<F> run_in_worker(WorkerPool &pool, F job) {
+    return WorkerAwaiter<F>(pool, std::move(job));
+}
+
+/**
+ * 发送上游HTTP请求(仅支持http, 其他scheme抛出CoroutineException)
+ *
+ * @param url 请求的URL
+ *
+ * @param method HTTP请求方法
+ *
+ * @param body 请求Body
+ *
+ * @param timeout 超时毫秒数, 从连接到收到完整响应的总时间.
+ * 超时后协程恢复, 结果的status为0, timed_out为true
+ *
+ * @return co_await的结果为FetchResponse
+ */
+inline FetchAwaiter fetch(const std::string &url,
+                          HTTPMethod method = HTTPMethod::GET,
+                          const std::string &body = "",
+                          uint64_t timeout = 30000) {
+    return FetchAwaiter(url, method, body, timeout);
+}
+
+/**
+ * 协程请求处理器
+ */
+typedef std::function<Task<void> (Connection &conn)> CoroutineHandler;
+
+inline Task<void> run_coroutine_handler(CoroutineHandler handler,
+                                        ConnectionPtr conn) {
+    bool failed = false;
+    try {
+        co_await handler(*conn);
+    } catch (...) {
+        failed = true;
+    }
+    if (failed) {
+        conn->send_error(500);
+    }
+    if (!conn->is_finished()) {
+        conn->finish();
+    }
+}
+
+/**
+ * 将协程处理器转换为RequestHandler.
+ * 处理器在第一次挂起前同步运行, 协程结束时自动完成响应,
+ * 未捕获的异常会发送500错误
+ *
+ * @param handler 协程处理器, 如Task<void> handler(Connection &conn)
+ *
+ * @return 请求处理器
+ */
+inline RequestHandler coroutine_handler(const CoroutineHandler &handler) {
+    return [handler](Connection &conn) {
+        spawn(run_coroutine_handler(handler, conn.defer()));
+    };
+}
+}
+#endif
+#endif
@@ -0,0 +1,222 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 直接基于epoll的HTTP服务器
+ */
+#ifndef RECYCLED_INCLUDE_EPOLLSERVER_H
+#define RECYCLED_INCLUDE_EPOLLSERVER_H
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <event2/event.h>
+#include <event2/keyvalq_struct.h>
+#include "recycled/handler.h"
+#include "recycled/httpconnection.h"
+#include "recycled/workerpool.h"
+
+namespace recycled {
+struct EpollContext;
+struct EpollSession;
+typedef std::shared_ptr<EpollContext> EpollContextPtr;
+typedef std::shared_ptr<EpollSession> EpollSessionPtr;
+
+/**
+ * EpollServer的I/O后端
+ */
+enum class IOBackend {
+    /**
+     * 边缘触发的epoll
+     */
+    Epoll,
+    /**
+     * io_uring: 多次accept, 使用内核选择的缓冲区多次接收, 批量提交发送.
+     * 需要Linux 6.0以上, 不支持时退回到epoll
+     */
+    IOUring
+};
+
+/**
+ * EpollServer的请求.
+ * 请求的解析和响应的构造与HTTPConnection相同, 只是响应直接写入socket
+ */
+class EpollConnection: public HTTPConnection {
+    public:
+        EpollConnection(const EpollSessionPtr &session);
+        EpollConnection(const EpollConnection &other) = delete;
+        ~EpollConnection();
+        const EpollConnection & operator=(const EpollConnection &other) = delete;
+        bool initialize();
+        void reset();
+        /**
+         * 为重用的连接设置新的请求所属的连接, 之后需要重新调用initialize
+         *
+         * @param session 请求所属的连接
+         */
+        void set_session(const EpollSessionPtr &session);
+        /**
+         * 把连接上已经收完的请求体移动到请求对象中
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool take_body();
+        void pause_body();
+        void resume_body();
+    protected:
+        void send_chunk(bool start, evbuffer *chunk);
+        void send_reply();
+    private:
+        EpollSessionPtr session;
+        evkeyvalq headers;
+        void write_head(bool chunked);
+};
+
+/**
+ * 直接基于epoll的HTTP服务器, 可以代替HTTPServer作为Application的模板参数.
+ * 每个IOLoop线程有一个epoll实例和一个启用SO_REUSEPORT的listen socket,
+ * 连接使用边缘触发的非阻塞socket, 请求由自己的状态机解析, 支持keep-alive,
+ * pipelining和分块传输编码
+ */
+class EpollServer {
+    public:
+        /**
+         * 收到请求头后就可以调用处理器, 支持HandlerFlag::Streaming
+         */
+        static const bool SupportsStreaming = true;
+        /**
+         * 构造一个服务器
+         *
+         * @param request_handler 请求处理器
+         *
+         * @param backend I/O后端, 默认为epoll
+         */
+        EpollServer(const RequestHandler &request_handler,
+                    IOBackend backend = IOBackend::Epoll);
+        EpollServer(const EpollServer &other) = delete;
+        /**
+         * 析构服务器, 相当于调用close
+         */
+        ~EpollServer();
+        const EpollServer & operator=(const EpollServer &other) = delete;
+        /**
+         * 初始化服务器
+         *
+         * @return 初始化成功则返回true, 否则返回false
+         */
+        bool initialize();
+        /**
+         * 指定绑listen的端口和IP
+         *
+         * @param port 端口
+         * @param ip 绑定的IP, 默认为0.0.0.0
+         *
+         * @return listen成功返回true, 否则返回false
+         */
+        bool listen(uint16_t port, const std::string &ip = "0.0.0.0");
+        /**
+         * 立即关闭服务器, 停止接受新连接并关闭所有连接, 未完成的请求将被放弃.
+         * 应在事件循环结束后调用
+         */
+        void close();
+        /**
+         * 优雅地关闭服务器, 可以在任意线程中调用.
+         * 停止接受新连接, 等待正在处理的请求完成, 然后关闭所有连接并结束所有IOLoop的
+         * 事件循环, 使IOLoop::start返回
+         *
+         * @param timeout 等待请求完成的最长时间(毫秒), 超时后未完成的请求将被放弃
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool shutdown(uint64_t timeout);
+        /**
+         * 设置空闲连接的超时时间, 默认为60秒
+         *
+         * @param timeout 超时时间(毫秒), 为0时不超时
+         */
+        void set_timeout(uint64_t timeout);
+        /**
+         * 设置请求体的最大长度, 超过时返回413. 默认不限制
+         *
+         * @param size 请求体的最大长度
+         */
+        void set_max_body_size(size_t size);
+        /**
+         * 设置请求体落盘的阈值, 默认不落盘.
+         * 请求体可能超过阈值(Content-Length超过阈值或使用分块传输编码)时边接收边保存,
+         * 超过阈值的部分写入临时文件, 处理时映射到内存. multipart/form-data的请求体
+         * 边接收边解析, 超过阈值的上传文件各自保存为一个临时文件, 见UploadFile::path;
+         * 此时get_body返回NULL
+         *
+         * @param size 阈值
+         *
+         * @param directory 临时文件所在的目录
+         */
+        void set_spill_threshold(size_t size, const std::string &directory = "/tmp");
+        /**
+         * 设置判断请求是否流式接收请求体的函数, Application根据HandlerFlag::Streaming设置.
+         * 有请求体的请求在收到请求头后先创建请求对象并调用checker, 返回true时立即调用处理器,
+         * 请求体之后通过Connection::set_body_handler设置的回调交出, 不保存也不落盘
+         *
+         * @param checker 判断函数
+         */
+        void set_streaming_checker(const StreamingChecker &checker);
+        /**
+         * 设置运行阻塞处理器的线程池, Application在有Blocking处理器时设置.
+         * 优雅关闭超时后丢弃还没开始的任务, 等正在运行的任务结束后再结束事件循环
+         *
+         * @param workers 线程池, 由调用者持有, 为NULL时不等待
+         */
+        void set_worker_pool(WorkerPool *workers);
+        /**
+         * 启用响应压缩, 默认不压缩.
+         * 按Accept-Encoding使用gzip或deflate压缩响应体, 分块发送的响应逐块压缩.
+         * 小于min_size的完整响应, 已压缩的Content-Type(图片, 音视频和压缩包等),
+         * 已设置Content-Encoding或Content-Length的响应和write_file发送的文件不压缩
+         *
+         * @param min_size 压缩的最小长度, 为SIZE_MAX时不压缩
+         *
+         * @param level zlib的压缩级别
+         */
+        void set_compression(size_t min_size = 1024,
+                             int level = Z_DEFAULT_COMPRESSION);
+        /**
+         * 设置是否自动生成ETag, 默认不生成, 应在listen之前调用.
+         * 启用时没有设置ETag的GET请求的200响应在发送前计算响应体的哈希作为ETag,
+         * 请求的If-None-Match匹配(或处理器设置了Last-Modified且If-Modified-Since不早于它)时
+         * 改为发送没有响应体的304. 分块发送的响应和write_file发送的文件不生成ETag.
+         * 处理器可以用Connection::check_not_modified在生成响应体之前检查
+         *
+         * @param enabled 是否启用
+         */
+        void set_auto_etag(bool enabled = true);
+        /**
+         * 取得实际使用的I/O后端, 初始化前返回构造时指定的后端.
+         * 指定io_uring但内核不支持时返回IOBackend::Epoll
+         *
+         * @return 实际使用的I/O后端
+         */
+        IOBackend get_backend() const;
+    private:
+        friend struct EpollContext;
+        friend struct EpollSession;
+        RequestHandler request_handler;
+        std::vector<EpollContextPtr> contexts;
+        uint64_t timeout;
+        size_t max_body_size;
+        size_t spill_threshold;
+        std::string spill_directory;
+        CompressionOptions compression;
+        bool auto_etag;
+        StreamingChecker streaming_checker;
+        WorkerPool *workers;
+        IOBackend backend;
+        std::atomic<size_t> draining;
+        bool event_add_handler(event_base *base);
+};
+}
+#endif
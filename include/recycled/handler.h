@@ -1,5 +1,6 @@
 #ifndef RECYCLED_INCLUDE_HANDLER_H
 #define RECYCLED_INCLUDE_HANDLER_H
+#include <stddef.h>
 #include <functional>
 namespace recycled {
 class Connection;
@@ -12,6 +13,18 @@ typedef std::function<void (Connection &conn)> RequestHandler;
  * 可通过std::bind转换为RequestHandler
  */
 typedef std::function<void (int code, Connection &conn)> ErrorHandler;
+/**
+ * 流式接收请求体时, 收到一段请求体的回调
+ */
+typedef std::function<void (const char *data, size_t size)> BodyDataHandler;
+/**
+ * 流式接收请求体时, 请求体结束的回调
+ */
+typedef std::function<void ()> BodyEndHandler;
+/**
+ * 收到请求头后判断请求是否由流式接收请求体的处理器处理
+ */
+typedef std::function<bool (Connection &conn)> StreamingChecker;
 /**
  * 基于类的请求处理器
  * 可以隐式转换为ReuestHandler
@@ -5,11 +5,15 @@
 #include <vector>
 #include <tuple>
 #include <map>
+#include <functional>
 #include <event2/event.h>
 #include <event2/keyvalq_struct.h>
 #include <event2/buffer.h>
 #include <event2/http.h>
 #include "recycled/connection.h"
+#include "recycled/ioloop.h"
+#include "recycled/spool.h"
+#include "recycled/compressor.h"
 
 namespace recycled {
 static const std::map<evhttp_cmd_type, HTTPMethod> Methods = {
@@ -22,6 +26,24 @@ static const std::map<evhttp_cmd_type, HTTPMethod> Methods = {
     {EVHTTP_REQ_PATCH,   HTTPMethod::PATCH}
 };
 
+/**
+ * 识别常用的请求头
+ *
+ * @param name 请求头名, 不区分大小写
+ *
+ * @return 对应的HTTPHeader, 不是常用的请求头时返回HTTPHeader::Other
+ */
+HTTPHeader find_known_header(const StringView &name);
+
+/**
+ * 取得同名请求头合并成一个时使用的分隔符
+ *
+ * @param header 请求头
+ *
+ * @return 值为列表的请求头返回", ", Cookie返回"; ", 不能合并的请求头返回空
+ */
+StringView header_separator(HTTPHeader header);
+
 typedef std::tuple<std::string,
                    bool,
                    time_t,
@@ -29,19 +51,53 @@ typedef std::tuple<std::string,
                    std::string,
                    bool> CookieInfo;
 
+typedef std::map<StringView, UploadFile, std::less<StringView>,
+                 ArenaAllocator<std::pair<const StringView, UploadFile>>> FileMap;
+
 class HTTPConnection: public Connection {
     public:
         HTTPConnection(evhttp_request *evreq);
         HTTPConnection(const HTTPConnection &other) = delete;
-        ~HTTPConnection();
+        virtual ~HTTPConnection();
         const HTTPConnection & operator=(const HTTPConnection &other) = delete;
-        bool initialize();
+        virtual bool initialize();
+        /**
+         * 结束当前请求并清空所有请求相关的状态, 以便在同一个IOLoop中重用.
+         * 缓冲区, 内存池和容器占用的内存被保留. 只在所属IOLoop的线程中调用
+         */
+        virtual void reset();
+        /**
+         * 为重用的连接设置新的请求, 之后需要重新调用initialize
+         *
+         * @param evreq evhttp的请求
+         */
+        void set_request(evhttp_request *evreq);
+        /**
+         * 设置响应压缩的选项, 服务器在创建连接时调用
+         *
+         * @param options 压缩选项, 由服务器持有, 为NULL时不压缩
+         */
+        void set_compression(const CompressionOptions *options);
+        /**
+         * 设置是否自动生成ETag, 服务器在创建连接时调用.
+         * 启用时完整发送的200响应在发送前计算响应体的哈希作为ETag,
+         * 与If-None-Match匹配时改为发送没有响应体的304
+         *
+         * @param enabled 是否启用
+         */
+        void set_auto_etag(bool enabled);
         bool write(const char *data, size_t size);
         bool write(const std::string &str);
+        bool write_reference(const char *data, size_t size,
+                             const std::function<void ()> &release = nullptr);
+        bool write_shared(const SharedBuffer &data);
+        bool write_file(int fd, off_t offset = 0, off_t length = -1);
+        bool write_ranges(uint64_t size, const RangeWriter &writer);
         bool set_status(int status_code, const std::string &reason = "");
         HTTPMethod get_method() const;
         const char * get_body() const;
         size_t get_body_size() const;
+        std::string copy_body() const;
         const UploadFile * get_file(const std::string &name) const;
         std::string get_path() const;
         std::string get_uri() const;
@@ -58,6 +114,18 @@ class HTTPConnection: public Connection {
         const SSMap & get_headers() const;
         const SSMap & get_cookies() const;
         SSMap & get_path_arguments();
+        StringView get_path_view() const;
+        StringView get_uri_view() const;
+        StringView get_query_argument_view(const std::string &key) const;
+        StringView get_body_argument_view(const std::string &key) const;
+        StringView get_argument_view(const std::string &key) const;
+        StringView get_path_argument_view(const std::string &key) const;
+        StringView get_header_view(const std::string &key) const;
+        StringView get_header_view(HTTPHeader header) const;
+        StringView get_cookie_view(const std::string &key) const;
+        ArgumentRange get_query_arguments_view(const std::string &key) const;
+        ArgumentRange get_body_arguments_view(const std::string &key) const;
+        ArgumentRange get_arguments_view(const std::string &key) const;
         bool set_error_handler(const ErrorHandler &handler);
         bool set_cookie(const std::string &key,
                         const std::string &value,
@@ -77,27 +145,228 @@ class HTTPConnection: public Connection {
         bool send_error(int status=500);
         void finish();
         bool redirect(const std::string &url, int status=302);
+        bool check_not_modified(const std::string &etag, time_t last_modified = 0);
+        bool is_not_modified(const StringView &etag, time_t last_modified) const;
         bool is_finished() const;
-    private:
+        ConnectionPtr defer();
+        bool is_deferred() const;
+        bool set_body_handler(const BodyDataHandler &on_data,
+                              const BodyEndHandler &on_end);
+        virtual void pause_body();
+        virtual void resume_body();
+        /**
+         * 服务器在收完请求体之前调用处理器时, 在调用处理器前调用.
+         * 之后的请求体通过receive_body交给连接, 最后调用end_body
+         */
+        void begin_body();
+        /**
+         * 交给连接收到的一段请求体, 数据从缓冲区中移除.
+         * 处理器还没有设置回调时暂存在连接中
+         *
+         * @param data 缓冲区
+         */
+        void receive_body(evbuffer *data);
+        /**
+         * 请求体结束
+         */
+        void end_body();
+        /**
+         * 放弃请求, 之后不再发送任何响应.
+         * 服务器在请求所属的evhttp被释放前调用
+         */
+        void abandon();
+    protected:
+        /**
+         * evhttp的请求, 只在所属IOLoop的线程中访问.
+         * 阻塞处理器在工作线程中只修改连接自己的缓冲区和响应头
+         */
         evhttp_request *evreq;
+        IOLoop *loop;
         ErrorHandler error_handler;
         std::string uri, path;
-        char *input_body;
+        /**
+         * uri中的查询字符串
+         */
+        StringView query;
+        /**
+         * 请求体所在的缓冲区, 由连接持有. input_body指向其中连续的内存
+         */
+        evbuffer *input_buffer;
+        mutable const char *input_body;
         size_t input_body_size;
+        /**
+         * 边接收边保存的请求体, 由连接持有. 请求体和上传文件的视图指向其中
+         */
+        BodySpool *spool;
         evbuffer *output_buffer;
+        /**
+         * write_file创建文件段时使用的EVBUF_FS_*选项
+         */
+        int file_flags;
+        const CompressionOptions *compression;
+        /**
+         * 当前响应使用的压缩流, 不压缩或压缩结束后为NULL
+         */
+        Compressor *compressor;
+        /**
+         * 保存压缩结果的缓冲区, 在重用的连接之间保留
+         */
+        evbuffer *compressed_buffer;
+        /**
+         * 是否已决定当前响应是否压缩
+         */
+        bool compression_decided;
+        /**
+         * 响应体中是否有write_file写入的文件段, 有文件段的响应不压缩
+         */
+        bool file_written;
+        bool auto_etag;
+        /**
+         * 指向当前响应头的链表, HTTPConnection中为response_headers
+         */
         evkeyvalq *output_headers;
-        SSMap input_headers;
-        SSMultiMap query_arguments, body_arguments;
+        /**
+         * 连接自己的响应头, 发送时才移动到evhttp的请求中,
+         * 以免evhttp已释放请求时工作线程还在修改它
+         */
+        evkeyvalq response_headers;
+        /**
+         * 请求的各部分在第一次访问时才解析, parsed记录已解析的部分
+         */
+        enum {
+            ParsedHeaders = 1,
+            ParsedQuery = 2,
+            ParsedBody = 4,
+            ParsedCookies = 8,
+            HeaderMap = 16,
+            CookieMap = 32
+        };
+        mutable int parsed;
+        /**
+         * 请求级的内存池, 下面的视图Map的节点和解码后的参数都分配在这里,
+         * 必须在它们之前构造
+         */
+        mutable Arena arena;
+        /**
+         * evhttp的请求头, 在连接释放前一直有效, 请求头的视图指向其中的字符串
+         */
+        mutable evkeyvalq raw_headers;
+        /**
+         * 兼容get_headers的请求头Map, 只在需要时构造(EpollServer直接提供,
+         * 此时在parsed中标记HeaderMap)
+         */
+        mutable SSMap input_headers;
+        /**
+         * 常用请求头的值, 以HTTPHeader为下标
+         */
+        mutable StringView known_headers[(size_t)HTTPHeader::Other];
+        /**
+         * 其他请求头, 按名字忽略大小写顺序查找
+         */
+        mutable std::vector<std::pair<StringView, StringView>> other_headers;
+        mutable ViewMultiMap query_arguments, body_arguments;
         SSMap path_arguments;
-        SSMap input_cookies;
-        std::map<std::string, UploadFile> files;
+        mutable ViewMap cookie_views;
+        mutable SSMap input_cookies;
+        mutable FileMap files;
         std::multimap<std::string, CookieInfo> output_cookies;
+        /**
+         * 生成Set-Cookie的缓冲区, 在重用的连接之间保留容量
+         */
+        std::string cookie_header;
         int status_code;
         std::string status_reason;
         HTTPMethod method;
         bool finished;
         bool chunked;
-        void parse_input_body();
+        bool deferred;
+        /**
+         * 是否还在流式接收请求体, 此时input_buffer暂存处理器还没有取走的部分
+         */
+        bool receiving_body;
+        BodyDataHandler body_data_handler;
+        BodyEndHandler body_end_handler;
+        /**
+         * 解析请求的URI并取得请求体. 查询参数, 请求体和Cookie留到第一次访问时解析.
+         * 请求头应已放入raw_headers, 或已放入input_headers并在parsed中标记HeaderMap
+         *
+         * @param uri 请求的URI
+         *
+         * @param body 请求体, 可以为NULL, 其内容被移动到连接中
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool parse_request(const char *uri, evbuffer *body);
+        /**
+         * 把请求体移动到连接中
+         *
+         * @param body 请求体, 可以为NULL
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool set_body(evbuffer *body);
+        /**
+         * 使用接收时已经保存的请求体代替parse_request中的body.
+         * multipart/form-data的参数和上传文件在这里直接放入连接中
+         *
+         * @param spool 保存的请求体, 由连接持有
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool set_spool(BodySpool *spool);
+        void parse_headers() const;
+        void add_header_view(const StringView &key, const StringView &value) const;
+        void parse_query() const;
+        void parse_cookies() const;
+        void parse_body() const;
+        void run_in_loop(const std::function<void ()> &callback);
+        void add_cookie_headers();
+        void add_date_header();
+        /**
+         * 发送状态行前把响应头交给evhttp, 并交还请求头.
+         * evhttp按请求的Connection决定是否保持连接, 所以需要完整的请求头
+         */
+        void hand_over_headers();
+        /**
+         * 根据请求和响应头选择当前响应的压缩方式, 需要压缩时设置响应头
+         *
+         * @param body 响应体(或第一个分块)
+         *
+         * @param complete 是否是完整的响应体
+         *
+         * @return 压缩方式
+         */
+        ContentEncoding select_encoding(evbuffer *body, bool complete);
+        /**
+         * 启用自动ETag时, 在发送完整的响应前计算ETag并处理If-None-Match和If-Modified-Since,
+         * 只在所属IOLoop的线程中调用
+         */
+        void add_etag_header();
+        /**
+         * 发送前压缩响应体, 只在所属IOLoop的线程中调用.
+         * 第一次调用时决定是否压缩, 压缩时设置Content-Encoding并使用当前线程的压缩流.
+         * 不压缩的响应体保持不变
+         *
+         * @param chunk 要发送的数据, 内容被替换为压缩后的数据
+         *
+         * @param start 是否是响应的开始(完整的响应或第一个分块)
+         *
+         * @param end 是否是响应的结束
+         */
+        void compress_output(evbuffer *chunk, bool start, bool end);
+        /**
+         * 发送一个分块, 只在所属IOLoop的线程中调用.
+         * 派生类可以重写以使用其他的传输方式
+         *
+         * @param start 是否是第一个分块, 第一个分块之前需要发送状态行和响应头
+         *
+         * @param chunk 分块的内容, 发送后被清空
+         */
+        virtual void send_chunk(bool start, evbuffer *chunk);
+        /**
+         * 发送完整的响应或最后一个分块, 只在所属IOLoop的线程中调用
+         */
+        virtual void send_reply();
 };
 }
 #endif
\ No newline at end of file
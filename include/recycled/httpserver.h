@@ -11,13 +11,26 @@
 #define RECYCLED_INCLUDE_HTTPSERVER_H
 #include <stdint.h>
 #include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <atomic>
 #include <event2/event.h>
 #include <event2/http.h>
 #include "recycled/handler.h"
+#include "recycled/ioloop.h"
+#include "recycled/compressor.h"
+#include "recycled/workerpool.h"
 
 namespace recycled {
+class HTTPConnection;
+
 class HTTPServer {
     public:
+        /**
+         * evhttp在调用处理器前总是收完整个请求体, 不支持HandlerFlag::Streaming
+         */
+        static const bool SupportsStreaming = false;
         /**
          * 构造一个服务器
          *
@@ -25,7 +38,10 @@ class HTTPServer {
          */
         HTTPServer(const RequestHandler &request_handler);
         HTTPServer(const HTTPServer &other) = delete;
-        ~HTTPServer() = default;
+        /**
+         * 析构服务器, 相当于调用close
+         */
+        ~HTTPServer();
         const HTTPServer & operator=(const HTTPServer &other) = delete;
         /**
          * 初始化服务器
@@ -35,6 +51,8 @@ class HTTPServer {
         bool initialize();
         /**
          * 指定绑listen的端口和IP
+         * 若IOLoop有多个线程, 每个线程绑定一个启用SO_REUSEPORT的socket,
+         * 由内核在线程间分配连接
          *
          * @param port 端口
          * @param ip 绑定的IP, 默认为0.0.0.0
@@ -42,11 +60,92 @@ class HTTPServer {
          * @return listen成功返回true, 否则返回false
          */
         bool listen(uint16_t port, const std::string &ip = "0.0.0.0");
+        /**
+         * 立即关闭服务器, 停止接受新连接并关闭所有连接, 未完成的请求将被放弃.
+         * 应在事件循环结束后调用
+         */
+        void close();
+        /**
+         * 优雅地关闭服务器, 可以在任意线程中调用.
+         * 停止接受新连接, 等待正在处理的请求完成, 然后关闭所有连接(包括空闲的
+         * keep-alive连接)并结束所有IOLoop的事件循环, 使IOLoop::start返回
+         *
+         * @param timeout 等待请求完成的最长时间(毫秒), 超时后未完成的请求将被放弃
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool shutdown(uint64_t timeout);
+        /**
+         * 设置判断请求是否流式接收请求体的函数. 只为与EpollServer有相同的接口,
+         * 不会被调用, Application拒绝在HTTPServer上注册Streaming处理器
+         *
+         * @param checker 判断函数
+         */
+        void set_streaming_checker(const StreamingChecker &checker);
+        /**
+         * 设置运行阻塞处理器的线程池, Application在有Blocking处理器时设置.
+         * 优雅关闭超时后丢弃还没开始的任务, 等正在运行的任务结束后再释放evhttp
+         *
+         * @param workers 线程池, 由调用者持有, 为NULL时不等待
+         */
+        void set_worker_pool(WorkerPool *workers);
+        /**
+         * 启用响应压缩, 默认不压缩.
+         * 按Accept-Encoding使用gzip或deflate压缩响应体, 分块发送的响应逐块压缩.
+         * 小于min_size的完整响应, 已压缩的Content-Type(图片, 音视频和压缩包等),
+         * 已设置Content-Encoding或Content-Length的响应和write_file发送的文件不压缩
+         *
+         * @param min_size 压缩的最小长度, 为SIZE_MAX时不压缩
+         *
+         * @param level zlib的压缩级别
+         */
+        void set_compression(size_t min_size = 1024,
+                             int level = Z_DEFAULT_COMPRESSION);
+        /**
+         * 设置是否自动生成ETag, 默认不生成, 应在listen之前调用.
+         * 启用时没有设置ETag的GET请求的200响应在发送前计算响应体的哈希作为ETag,
+         * 请求的If-None-Match匹配(或处理器设置了Last-Modified且If-Modified-Since不早于它)时
+         * 改为发送没有响应体的304. 分块发送的响应和write_file发送的文件不生成ETag.
+         * 处理器可以用Connection::check_not_modified在生成响应体之前检查
+         *
+         * @param enabled 是否启用
+         */
+        void set_auto_etag(bool enabled = true);
     private:
+        /**
+         * 每个IOLoop线程上的服务器状态, 只在该线程中访问
+         */
+        struct Context: public std::enable_shared_from_this<Context> {
+            HTTPServer *server;
+            IOLoop *loop;
+            evhttp *event_http;
+            std::vector<evhttp_bound_socket *> sockets;
+            std::set<HTTPConnection *> connections;
+            /**
+             * 已结束的请求对象, 下一个请求直接重用
+             */
+            std::vector<HTTPConnection *> free_connections;
+            size_t pending;
+            bool closing;
+            TimerID deadline;
+        };
+        typedef std::shared_ptr<Context> ContextPtr;
         RequestHandler request_handler;
-        evhttp *event_http;
+        CompressionOptions compression;
+        bool auto_etag;
+        WorkerPool *workers;
+        std::vector<ContextPtr> contexts;
+        std::atomic<size_t> draining;
         bool event_add_handler(event_base *base);
+        void drain(Context *context, uint64_t timeout);
+        void check_drained(Context *context);
+        void expire(Context *context);
+        void finish_drain(Context *context);
+        static void close_context(Context *context);
+        static void release_connection(const ContextPtr &context,
+                                       HTTPConnection *conn);
         static void evhttp_handler(evhttp_request *req, void *arg);
+        static void request_complete(evhttp_request *req, void *arg);
 };
 }
 #endif
\ No newline at end of file
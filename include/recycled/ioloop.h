@@ -1,23 +1,60 @@
 #ifndef RECYCLED_INCLUDE_IOLOOP_H
 #define RECYCLED_INCLUDE_IOLOOP_H
+#include <time.h>
+#include <vector>
+#include <utility>
+#include <thread>
+#include <mutex>
 #include <functional>
 #include <event2/event.h>
+#include "recycled/timerwheel.h"
 
 namespace recycled {
 /**
  * 基于libevent的事件循环类
+ * 每个事件循环线程拥有一个IOLoop和独立的event_base,
+ * get_instance返回的主IOLoop负责管理其他线程的IOLoop
  */
 class IOLoop {
     public:
         typedef std::function<bool (event_base *base)> EventAddHandler;
+        typedef std::function<void ()> Callback;
         /**
          *取得IOLoop示例
          *
          * @return IOLoop实例
          */
         static IOLoop & get_instance();
+        /**
+         * 取得运行在当前线程的IOLoop
+         *
+         * @return 当前线程的IOLoop, 若当前线程不是事件循环线程返回空指针
+         */
+        static IOLoop * current();
+        /**
+         * 设置事件循环线程数.
+         * 必须在add_event(即构造Application)之前调用
+         *
+         * @param count 线程数, 为0时使用CPU核心数
+         *
+         * @return 设置成功返回true, 否则返回false
+         */
+        bool set_threads(size_t count);
+        /**
+         * 取得事件循环线程数
+         *
+         * @return 事件循环线程数
+         */
+        size_t get_threads() const;
+        /**
+         * 取得该IOLoop的event_base
+         *
+         * @return event_base指针
+         */
+        event_base * get_base() const;
         /**
          * 增加一个事件循环
+         * 主IOLoop会对每个线程的event_base各调用一次handler
          *
          * @param handler 增加时调用的回调函数, 参数中包含event_base *
          *
@@ -26,14 +63,140 @@ class IOLoop {
         bool add_event(EventAddHandler handler);
         /**
          * 开始事件循环
+         * 其他线程的事件循环在新线程中运行, 主事件循环在当前线程中运行,
+         * 所有事件循环结束后返回
          *
          * @return 开始循环成功返回true, 否则返回false
          */
         bool start();
+        /**
+         * 结束事件循环, 可以在任意线程中调用.
+         * 主IOLoop会同时结束所有线程的事件循环
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool stop();
+        /**
+         * 取得所有线程的IOLoop(第一个为主IOLoop)
+         *
+         * @return 所有线程的IOLoop
+         */
+        std::vector<IOLoop *> get_loops();
+        /**
+         * 收到信号时在主IOLoop的线程中运行回调函数.
+         * 只能在主IOLoop上调用, 且应在start之前调用
+         *
+         * @param signum 信号, 如SIGTERM
+         *
+         * @param callback 回调函数
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool add_signal(int signum, const Callback &callback);
+        /**
+         * 在该IOLoop的线程中运行回调函数, 可以在任意线程中调用
+         *
+         * @param callback 回调函数
+         *
+         * @return 投递成功返回true, 否则返回false
+         */
+        bool post(const Callback &callback);
+        /**
+         * 在下一次事件循环迭代中运行回调函数.
+         * 在其他线程中调用时等同于post
+         *
+         * @param callback 回调函数
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool call_soon(const Callback &callback);
+        /**
+         * 在指定时间后运行回调函数.
+         * 定时器由每个IOLoop一个的分层时间轮管理, 精度为1毫秒.
+         * 只能在该IOLoop的线程中(或start之前)调用
+         *
+         * @param delay 延迟的毫秒数
+         *
+         * @param callback 回调函数
+         *
+         * @return 定时器ID, 可以用于cancel_timer
+         */
+        TimerID call_later(uint64_t delay, const Callback &callback);
+        /**
+         * 每隔一段时间运行回调函数, 直到被取消.
+         * 只能在该IOLoop的线程中(或start之前)调用
+         *
+         * @param interval 间隔的毫秒数(至少为1)
+         *
+         * @param callback 回调函数
+         *
+         * @return 定时器ID, 可以用于cancel_timer
+         */
+        TimerID call_every(uint64_t interval, const Callback &callback);
+        /**
+         * 取消call_later或call_every增加的定时器
+         * 只能在该IOLoop的线程中(或start之前)调用
+         *
+         * @param id 定时器ID
+         *
+         * @return 取消成功返回true, 定时器不存在或已触发返回false
+         */
+        bool cancel_timer(TimerID id);
+        /**
+         * 取得单调时钟的当前时间
+         *
+         * @return 毫秒数
+         */
+        static uint64_t monotonic_time();
+        /**
+         * 取得当前时间. 使用libevent在每次事件循环迭代时缓存的时间, 不需要系统调用.
+         * 以下时间相关方法只能在该IOLoop的线程中(或start之前)调用
+         *
+         * @return UNIX时间(秒)
+         */
+        time_t get_time();
+        /**
+         * 取得当前时间的HTTP日期(RFC 7231), 如"Sun, 06 Nov 1994 08:49:37 GMT".
+         * 每秒最多格式化一次, 返回的字符串在下次调用前有效
+         *
+         * @return HTTP日期
+         */
+        const char * get_http_date();
+        /**
+         * 取得当前时间之后若干秒的Cookie日期, 如"Sun, 06-Nov-1994 08:49:37 GMT".
+         * 缓存最近一次的结果, 返回的字符串在下次调用前有效
+         *
+         * @param offset 距当前时间的秒数
+         *
+         * @return Cookie日期
+         */
+        const char * get_cookie_date(time_t offset);
     private:
         IOLoop();
         ~IOLoop();
         event_base *base;
+        std::vector<IOLoop *> children;
+        bool event_added;
+        int wakeup_fd;
+        event *wakeup_event;
+        std::mutex posted_mutex;
+        std::vector<Callback> posted;
+        std::vector<Callback> soon;
+        event *soon_event;
+        TimerWheel timers;
+        event *timer_event;
+        uint64_t timer_armed;
+        std::vector<std::pair<event *, Callback> *> signals;
+        time_t http_date_time;
+        char http_date[32];
+        time_t cookie_date_time;
+        char cookie_date[32];
+        bool run();
+        void schedule_timer();
+        static void wakeup_handler(evutil_socket_t fd, short what, void *arg);
+        static void soon_handler(evutil_socket_t fd, short what, void *arg);
+        static void timer_handler(evutil_socket_t fd, short what, void *arg);
+        static void signal_handler(evutil_socket_t fd, short what, void *arg);
 };
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,137 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 增量的multipart/form-data解析器
+ */
+#ifndef RECYCLED_INCLUDE_MULTIPART_H
+#define RECYCLED_INCLUDE_MULTIPART_H
+#include <stddef.h>
+#include <string>
+#include <functional>
+#include "recycled/stringview.h"
+
+namespace recycled {
+/**
+ * multipart/form-data中一个部分的头信息.
+ * 视图指向解析器内部的缓冲区, 只在回调期间有效
+ */
+struct MultipartPart {
+    /**
+     * Content-Disposition中的name
+     */
+    StringView name;
+    /**
+     * Content-Disposition中的filename, 不是文件时为空
+     */
+    StringView filename;
+    /**
+     * 这个部分的Content-Type
+     */
+    StringView content_type;
+};
+
+/**
+ * 增量的multipart/form-data解析器.
+ * 数据可以分成任意大小的块传入, 每个部分的内容通过回调交出, 不做复制;
+ * 只有跨越两块数据的分隔符前缀会暂存在内部. 不是线程安全的
+ */
+class MultipartParser {
+    public:
+        typedef std::function<void (const MultipartPart &part)> PartHandler;
+        typedef std::function<void (const char *data, size_t size)> DataHandler;
+        typedef std::function<void ()> EndHandler;
+        /**
+         * 构造一个解析器
+         *
+         * @param boundary 分隔符, 不含前面的"--"
+         */
+        MultipartParser(const StringView &boundary);
+        MultipartParser(const MultipartParser &other) = delete;
+        ~MultipartParser() = default;
+        const MultipartParser & operator=(const MultipartParser &other) = delete;
+        /**
+         * 初始化解析器
+         *
+         * @return 分隔符有效返回true, 否则返回false
+         */
+        bool initialize();
+        /**
+         * 设置开始一个部分时的回调
+         *
+         * @param handler 回调函数
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool set_part_handler(const PartHandler &handler);
+        /**
+         * 设置收到部分内容时的回调. 一个部分的内容可能分多次交出,
+         * 一次传入完整的数据时每个部分的内容只交出一次, 并指向传入的数据
+         *
+         * @param handler 回调函数
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool set_data_handler(const DataHandler &handler);
+        /**
+         * 设置一个部分结束时的回调
+         *
+         * @param handler 回调函数
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool set_end_handler(const EndHandler &handler);
+        /**
+         * 传入一块数据
+         *
+         * @param data 数据
+         *
+         * @param size 数据长度
+         *
+         * @return 成功返回true, 数据格式错误返回false, 之后不再接受数据
+         */
+        bool feed(const char *data, size_t size);
+        /**
+         * 是否已经读到结束分隔符
+         *
+         * @return 已结束返回true, 否则返回false
+         */
+        bool is_finished() const;
+        /**
+         * 从Content-Type中取得分隔符
+         *
+         * @param content_type 请求的Content-Type
+         *
+         * @return 分隔符的视图, 没有分隔符时为空
+         */
+        static StringView get_boundary(const StringView &content_type);
+    private:
+        enum class State {
+            Preamble, Body, AfterBoundary, AfterDash, AfterCR, Headers, End,
+            Error
+        };
+        State state;
+        /**
+         * "\r\n--"加上分隔符
+         */
+        std::string delimiter;
+        /**
+         * 上一块数据末尾可能属于分隔符的部分
+         */
+        std::string pending;
+        std::string headers;
+        PartHandler part_handler;
+        DataHandler data_handler;
+        EndHandler end_handler;
+        size_t find_delimiter(const char *data, size_t size, bool &partial) const;
+        size_t feed_body(const char *data, size_t size);
+        size_t feed_headers(const char *data, size_t size);
+        void parse_headers();
+        void emit(const char *data, size_t size);
+        void end_body();
+};
+}
+#endif
@@ -8,10 +8,24 @@
 #include "recycled/handler.h"
 
 namespace recycled {
+/**
+ * 请求处理器选项, 可以按位或组合
+ */
+enum HandlerFlag {
+    Blocking = 0x1, /**< 在工作线程池中运行处理器, 用于会阻塞的处理器 */
+    /**
+     * 收到请求头后就调用处理器, 请求体通过Connection::set_body_handler边接收边交出.
+     * 处理器总是在IOLoop的线程中运行, 不能与Blocking同时设置.
+     * 只有EpollServer支持, Application拒绝在HTTPServer上注册
+     */
+    Streaming = 0x2
+};
+
 struct HandlerStruct {
     std::string pattern;
     RequestHandler handler;
     std::set<HTTPMethod> methods;
+    int flags; /**< HandlerFlag的组合, 省略时为0 */
 };
 
 /**
@@ -58,10 +72,12 @@ class Router {
          *
          * @param methods 该处理器允许的HTTP请求方法
          *
+         * @param flags 处理器选项(HandlerFlag的组合)
+         *
          * @return 增加成功返回true, 否则返回false
          */
         bool add(const std::string &pattern, const RequestHandler &handler,
-                 const std::set<HTTPMethod> &methods);
+                 const std::set<HTTPMethod> &methods, int flags = 0);
         /**
          * 通过提供的路径和HTTP请求方法路由到请求处理器
          *
@@ -77,11 +93,29 @@ class Router {
         RequestHandler route(const std::string &path,
                              HTTPMethod method,
                              std::map<std::string, std::string> &arguments) const;
+        /**
+         * 通过提供的路径和HTTP请求方法路由到请求处理器, 同时取得处理器选项
+         *
+         * @param path 路径
+         *
+         * @param method HTTP请求方法
+         *
+         * @param arguments Path参数的输出Map
+         *
+         * @param flags 处理器选项的输出(未匹配时为0)
+         *
+         * @return 同route(path, method, arguments)
+         */
+        RequestHandler route(const std::string &path,
+                             HTTPMethod method,
+                             std::map<std::string, std::string> &arguments,
+                             int &flags) const;
     private:
         typedef std::tuple<pcre *,
                            RequestHandler,
                            std::set<HTTPMethod>,
-                           std::vector<std::string>> HandlerTuple;
+                           std::vector<std::string>,
+                           int> HandlerTuple;
         std::vector<HandlerTuple> handlers;
         ErrorHandler error_handler;
         static void default_error_handler(int code, Connection &conn);
@@ -0,0 +1,23 @@
+#ifndef RECYCLED_INCLUDE_SOCKET_H
+#define RECYCLED_INCLUDE_SOCKET_H
+#include <stdint.h>
+#include <string>
+#include <event2/util.h>
+
+namespace recycled {
+/**
+ * 创建一个非阻塞的listen socket
+ *
+ * @param ip 绑定的IP
+ *
+ * @param port 端口
+ *
+ * @param reuse_port 是否启用SO_REUSEPORT, 启用后多个socket可以绑定同一个端口,
+ *        由内核在它们之间分配连接
+ *
+ * @return 成功返回socket, 否则返回-1
+ */
+evutil_socket_t listen_socket(const std::string &ip, uint16_t port,
+                              bool reuse_port);
+}
+#endif
@@ -0,0 +1,178 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 把较大的请求体和上传文件保存到临时文件
+ */
+#ifndef RECYCLED_INCLUDE_SPOOL_H
+#define RECYCLED_INCLUDE_SPOOL_H
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <event2/buffer.h>
+#include "recycled/stringview.h"
+#include "recycled/multipart.h"
+
+namespace recycled {
+/**
+ * 临时文件, 析构时删除.
+ * 如果文件已被rename到其他位置, 或原路径已是另一个文件, 则不删除
+ */
+class TempFile {
+    public:
+        TempFile();
+        TempFile(const TempFile &other) = delete;
+        ~TempFile();
+        const TempFile & operator=(const TempFile &other) = delete;
+        /**
+         * 在指定目录中创建临时文件
+         *
+         * @param directory 目录
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool initialize(const std::string &directory);
+        /**
+         * 在文件末尾写入数据
+         *
+         * @param data 数据
+         *
+         * @param size 数据长度
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool write(const char *data, size_t size);
+        /**
+         * 把缓冲区中的数据写入文件末尾, 写入的数据从缓冲区中移除
+         *
+         * @param buffer 缓冲区
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool write(evbuffer *buffer);
+        /**
+         * 把文件只读映射到内存, 之后不能再写入
+         *
+         * @return 映射的内存, 文件为空或映射失败时返回nullptr
+         */
+        const char * map();
+        const std::string & get_path() const;
+        size_t get_size() const;
+    private:
+        int fd;
+        std::string path;
+        size_t size;
+        void *data;
+};
+
+/**
+ * 边接收边保存请求体.
+ * 普通的请求体先放在内存中, 超过阈值后写入一个临时文件;
+ * multipart/form-data的请求体边接收边解析, 每个部分超过阈值后各自写入临时文件,
+ * 不保留原始的请求体
+ */
+class BodySpool {
+    public:
+        /**
+         * multipart/form-data中的一个部分
+         */
+        struct Part {
+            std::string name;
+            std::string filename;
+            std::string content_type;
+            /**
+             * 内容, 写入临时文件后为空
+             */
+            std::string value;
+            TempFile *file;
+            /**
+             * 是否读到了这个部分的结尾
+             */
+            bool complete;
+        };
+        /**
+         * 构造请求体的缓存
+         *
+         * @param directory 临时文件所在的目录
+         *
+         * @param threshold 内存中保存的最大长度
+         */
+        BodySpool(const std::string &directory, size_t threshold);
+        BodySpool(const BodySpool &other) = delete;
+        ~BodySpool();
+        const BodySpool & operator=(const BodySpool &other) = delete;
+        /**
+         * 初始化
+         *
+         * @param content_type 请求的Content-Type
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool initialize(const StringView &content_type);
+        /**
+         * 写入收到的一段请求体, 写入的数据从缓冲区中移除
+         *
+         * @param data 缓冲区
+         *
+         * @return 成功返回true, 写入临时文件失败或multipart格式错误返回false
+         */
+        bool write(evbuffer *data);
+        /**
+         * multipart/form-data的格式是否错误
+         *
+         * @return 错误返回true, 否则返回false
+         */
+        bool is_malformed() const;
+        /**
+         * 写入全部请求体后检查是否完整, multipart/form-data需要读到结束分隔符
+         *
+         * @return 完整返回true, 否则返回false
+         */
+        bool is_complete() const;
+        /**
+         * 取得已写入的总长度
+         *
+         * @return 长度
+         */
+        size_t get_size() const;
+        /**
+         * 是否按multipart/form-data解析
+         *
+         * @return 是返回true, 否则返回false
+         */
+        bool is_multipart() const;
+        /**
+         * 取得内存中的请求体, 写入临时文件或按multipart解析时为空
+         *
+         * @return 缓冲区
+         */
+        evbuffer * get_buffer();
+        /**
+         * 取得保存请求体的临时文件
+         *
+         * @return 临时文件, 请求体在内存中时返回nullptr
+         */
+        TempFile * get_file();
+        /**
+         * 取得multipart/form-data的各个部分
+         *
+         * @return 各个部分
+         */
+        std::vector<Part> & get_parts();
+    private:
+        std::string directory;
+        size_t threshold;
+        size_t size;
+        bool failed;
+        bool malformed;
+        evbuffer *buffer;
+        TempFile *file;
+        MultipartParser *parser;
+        std::vector<Part> parts;
+        TempFile * create_file();
+};
+}
+#endif
@@ -0,0 +1,219 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 静态文件处理器
+ */
+#ifndef RECYCLED_INCLUDE_STATICFILE_H
+#define RECYCLED_INCLUDE_STATICFILE_H
+#include <time.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <event2/event.h>
+#include "recycled/handler.h"
+#include "recycled/connection.h"
+#include "recycled/stringview.h"
+
+namespace recycled {
+/**
+ * 发送根目录下的静态文件, 可以隐式转换为RequestHandler.
+ * 文件通过Connection::write_file发送, 不读入用户空间. 打开的文件和stat结果被缓存,
+ * 超过缓存时间后重新stat, 文件改变时重新打开; 缓存的文件数有上限, 超过时关闭
+ * 最久未使用的文件. 可以在多个事件循环线程中使用
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.cpp}
+ * StaticFileHandler assets("/var/www/static");
+ * Application<EpollServer> app({
+ *     {"/static/<.+:path>", assets, {HTTPMethod::GET, HTTPMethod::HEAD}}
+ * });
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ * 处理器转换为RequestHandler时只保存指针, 必须在Application之后析构
+ */
+class StaticFileHandler {
+    public:
+        /**
+         * 构造一个静态文件处理器
+         *
+         * @param root 根目录
+         *
+         * @param argument 保存相对路径的Path参数名
+         */
+        StaticFileHandler(const std::string &root,
+                          const std::string &argument = "path");
+        StaticFileHandler(const StaticFileHandler &other) = delete;
+        /**
+         * 析构处理器, 关闭缓存的文件
+         */
+        ~StaticFileHandler();
+        const StaticFileHandler & operator=(const StaticFileHandler &other) = delete;
+        /**
+         * 设置缓存的有效时间, 默认为1秒. 为0时每个请求都重新stat
+         *
+         * @param seconds 秒数
+         */
+        void set_cache_time(time_t seconds);
+        /**
+         * 处理请求. 相对路径中有".."或文件不是普通文件时返回404,
+         * If-Modified-Since不早于文件的修改时间时返回304,
+         * 支持Range和If-Range, 每个范围都通过write_file发送
+         *
+         * @param conn 连接
+         */
+        void handle(Connection &conn);
+        operator RequestHandler();
+        /**
+         * 根据扩展名取得Content-Type
+         *
+         * @param path 文件路径
+         *
+         * @return Content-Type, 未知的扩展名返回"application/octet-stream"
+         */
+        static const char * get_content_type(const StringView &path);
+    private:
+        struct File {
+            int fd;
+            off_t size;
+            time_t mtime;
+            dev_t device;
+            ino_t inode;
+            /**
+             * 上次stat的时间
+             */
+            time_t checked;
+            const char *content_type;
+            std::string last_modified;
+        };
+        struct CachedFile {
+            File file;
+            std::list<std::string>::iterator position;
+        };
+        std::string root;
+        std::string argument;
+        time_t cache_time;
+        std::mutex mutex;
+        std::unordered_map<std::string, CachedFile> files;
+        /**
+         * 最近使用的在前
+         */
+        std::list<std::string> recent;
+        bool open_file(const std::string &path, File &file);
+        int acquire(const std::string &path, File &file);
+        void erase(std::unordered_map<std::string, CachedFile>::iterator it);
+};
+
+/**
+ * 把根目录下的静态文件缓存在内存中, 可以隐式转换为RequestHandler.
+ * 每个文件的ETag在加载时计算; 离线压缩好的同名文件(X.gz为gzip, X.zz为deflate)
+ * 作为X的压缩版本一起加载, 按Accept-Encoding选择, 请求时不读磁盘也不压缩.
+ * 响应通过write_shared发送, 不复制. 缓存的总大小有上限, 超过时淘汰最久未使用的文件;
+ * 文件改变时通过inotify使缓存失效, 下次请求时重新加载. 超过上限的文件
+ * 交给StaticFileHandler从磁盘发送. 可以在多个事件循环线程中使用
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~{.cpp}
+ * AssetCache assets("/var/www/static", 64 * 1024 * 1024);
+ * Application<EpollServer> app({
+ *     {"/static/<.+:path>", assets, {HTTPMethod::GET, HTTPMethod::HEAD}}
+ * });
+ * assets.initialize(true);
+ * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+ */
+class AssetCache {
+    public:
+        /**
+         * 构造一个静态文件缓存
+         *
+         * @param root 根目录
+         *
+         * @param max_size 缓存的最大字节数(包括压缩版本)
+         *
+         * @param argument 保存相对路径的Path参数名
+         */
+        AssetCache(const std::string &root, size_t max_size,
+                   const std::string &argument = "path");
+        AssetCache(const AssetCache &other) = delete;
+        ~AssetCache();
+        const AssetCache & operator=(const AssetCache &other) = delete;
+        /**
+         * 初始化缓存, 在主IOLoop上监视根目录的改变. 应在IOLoop::start之前调用
+         *
+         * @param preload 是否立即加载整个目录树(直到达到最大字节数), 否则在第一次请求时加载
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool initialize(bool preload = false);
+        /**
+         * 处理请求. If-None-Match与ETag相同, 或没有If-None-Match而If-Modified-Since
+         * 不早于文件的修改时间时返回304, 支持Range和If-Range
+         *
+         * @param conn 连接
+         */
+        void handle(Connection &conn);
+        operator RequestHandler();
+        /**
+         * 使缓存的文件失效
+         *
+         * @param path 相对于根目录的路径, 为空时清空整个缓存
+         */
+        void invalidate(const std::string &path = "");
+        /**
+         * 取得缓存的总字节数
+         *
+         * @return 字节数
+         */
+        size_t get_size();
+    private:
+        struct Asset {
+            std::string data;
+            std::string gzip;
+            std::string deflate;
+            std::string etag;
+            std::string gzip_etag;
+            std::string deflate_etag;
+            time_t mtime;
+            std::string last_modified;
+            const char *content_type;
+            size_t size;
+        };
+        typedef std::shared_ptr<const Asset> AssetPtr;
+        struct Entry {
+            AssetPtr asset;
+            std::list<std::string>::iterator position;
+        };
+        std::string root;
+        size_t max_size;
+        std::string argument;
+        StaticFileHandler fallback;
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> assets;
+        /**
+         * 最近使用的在前
+         */
+        std::list<std::string> recent;
+        size_t size;
+        /**
+         * 每次失效时增加, 加载期间发生失效的文件不放入缓存
+         */
+        uint64_t generation;
+        int inotify_fd;
+        event *watch_event;
+        /**
+         * inotify的监视描述符对应的目录(相对于根目录, 根目录为空)
+         */
+        std::unordered_map<int, std::string> watches;
+        AssetPtr find(const std::string &path);
+        int load(const std::string &path, AssetPtr &asset);
+        void insert(const std::string &path, const AssetPtr &asset,
+                    uint64_t generation);
+        void erase(std::unordered_map<std::string, Entry>::iterator it);
+        void preload(const std::string &directory);
+        void watch(const std::string &directory);
+        static void watch_handler(evutil_socket_t fd, short what, void *arg);
+};
+}
+#endif
@@ -0,0 +1,140 @@
+/**
+ * @file
+ * @author Falconly members
+ * @version 0.1
+ *
+ * @section DESCRIPTION
+ *
+ * 不持有内存的只读字符串视图
+ */
+#ifndef RECYCLED_INCLUDE_STRINGVIEW_H
+#define RECYCLED_INCLUDE_STRINGVIEW_H
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <ostream>
+
+namespace recycled {
+/**
+ * 指向一段已有字符串的只读视图, 构造和复制都不分配内存.
+ * 视图不持有内存, 只在被指向的字符串有效期间有效, 也不保证以'\0'结尾
+ */
+class StringView {
+    public:
+        typedef const char * const_iterator;
+        static const size_t npos = std::string::npos;
+        StringView(): ptr(nullptr), len(0) {}
+        StringView(const char *data, size_t size): ptr(data), len(size) {}
+        StringView(const char *str): ptr(str), len(str ? strlen(str) : 0) {}
+        StringView(const std::string &str): ptr(str.data()), len(str.length()) {}
+        const char * data() const {return this->ptr;}
+        size_t size() const {return this->len;}
+        size_t length() const {return this->len;}
+        bool empty() const {return !this->len;}
+        const_iterator begin() const {return this->ptr;}
+        const_iterator end() const {return this->ptr + this->len;}
+        char operator[](size_t pos) const {return this->ptr[pos];}
+        /**
+         * 复制为std::string
+         *
+         * @return 视图内容的副本
+         */
+        std::string str() const {
+            return this->len ? std::string(this->ptr, this->len) : std::string();
+        }
+        explicit operator std::string() const {return this->str();}
+        /**
+         * 取得子视图
+         *
+         * @param pos 起始位置, 超过长度时返回空视图
+         *
+         * @param count 长度, 超过剩余长度时取到末尾
+         *
+         * @return 子视图
+         */
+        StringView substr(size_t pos, size_t count = npos) const {
+            if (pos >= this->len) {
+                return StringView();
+            }
+            size_t rest = this->len - pos;
+            return StringView(this->ptr + pos, count < rest ? count : rest);
+        }
+        /**
+         * 查找字符
+         *
+         * @param ch 要查找的字符
+         *
+         * @param pos 开始查找的位置
+         *
+         * @return 字符的位置, 没有找到返回npos
+         */
+        size_t find(char ch, size_t pos = 0) const {
+            if (pos >= this->len) {
+                return npos;
+            }
+            const void *p = memchr(this->ptr + pos, ch, this->len - pos);
+            return p ? (const char *)p - this->ptr : npos;
+        }
+        /**
+         * 从后向前查找字符
+         *
+         * @param ch 要查找的字符
+         *
+         * @return 最后一个该字符的位置, 没有找到返回npos
+         */
+        size_t rfind(char ch) const {
+            const void *p = this->len ? memrchr(this->ptr, ch, this->len) : nullptr;
+            return p ? (const char *)p - this->ptr : npos;
+        }
+        int compare(const StringView &other) const {
+            size_t n = this->len < other.len ? this->len : other.len;
+            int result = n ? memcmp(this->ptr, other.ptr, n) : 0;
+            if (result) {
+                return result;
+            }
+            return this->len < other.len ? -1 : (this->len > other.len ? 1 : 0);
+        }
+    private:
+        const char *ptr;
+        size_t len;
+};
+
+inline bool operator==(const StringView &a, const StringView &b) {
+    return a.size() == b.size() && a.compare(b) == 0;
+}
+
+inline bool operator!=(const StringView &a, const StringView &b) {
+    return !(a == b);
+}
+
+inline bool operator<(const StringView &a, const StringView &b) {
+    return a.compare(b) < 0;
+}
+
+/**
+ * 忽略大小写比较两个视图, 只比较ASCII字母
+ */
+inline bool equals_ignore_case(const StringView &a, const StringView &b) {
+    return a.size() == b.size() &&
+           (!a.size() || !strncasecmp(a.data(), b.data(), a.size()));
+}
+
+/**
+ * 去掉两端的空格和制表符
+ */
+inline StringView trim(const StringView &str) {
+    size_t begin = 0, end = str.size();
+    while (begin < end && (str[begin] == ' ' || str[begin] == '\t')) {
+        ++begin;
+    }
+    while (end > begin && (str[end - 1] == ' ' || str[end - 1] == '\t')) {
+        --end;
+    }
+    return str.substr(begin, end - begin);
+}
+
+inline std::ostream & operator<<(std::ostream &os, const StringView &view) {
+    return os.write(view.data(), view.size());
+}
+}
+#endif
@@ -0,0 +1,115 @@
+#ifndef RECYCLED_INCLUDE_TIMERWHEEL_H
+#define RECYCLED_INCLUDE_TIMERWHEEL_H
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <functional>
+
+namespace recycled {
+/**
+ * 定时器ID, 0为无效ID
+ */
+typedef uint64_t TimerID;
+
+/**
+ * 分层时间轮.
+ * 第0层有256个槽, 每槽1个tick; 之后4层各有64个槽, 每层的槽跨度是上一层的一整圈.
+ * 增加, 取消定时器都是O(1)的, 不是线程安全的
+ */
+class TimerWheel {
+    public:
+        typedef std::function<void ()> Callback;
+        /**
+         * 构造一个时间轮
+         *
+         * @param now 当前tick, 之前的tick视为已经处理过
+         */
+        TimerWheel(uint64_t now = 0);
+        TimerWheel(const TimerWheel &other) = delete;
+        ~TimerWheel() = default;
+        const TimerWheel & operator=(const TimerWheel &other) = delete;
+        /**
+         * 增加一个定时器
+         *
+         * @param expires 到期的tick, 早于当前tick时在下一个tick触发
+         *
+         * @param interval 重复触发的间隔, 为0时只触发一次
+         *
+         * @param callback 回调函数
+         *
+         * @return 定时器ID
+         */
+        TimerID add(uint64_t expires, uint64_t interval, const Callback &callback);
+        /**
+         * 取消一个定时器
+         *
+         * @param id 定时器ID
+         *
+         * @return 取消成功返回true, 定时器不存在或已触发返回false
+         */
+        bool cancel(TimerID id);
+        /**
+         * 推进时间轮到指定的tick, 并触发其间到期的定时器
+         *
+         * @param now 当前tick
+         */
+        void advance(uint64_t now);
+        /**
+         * 取得下一次需要推进时间轮的tick
+         *
+         * @return 下一次需要推进的tick, 没有定时器时返回0
+         */
+        uint64_t next_tick() const;
+        /**
+         * 取得时间轮当前的tick
+         *
+         * @return 当前tick
+         */
+        uint64_t get_tick() const;
+        /**
+         * 取得定时器数量
+         *
+         * @return 定时器数量
+         */
+        size_t size() const;
+    private:
+        enum class State {Free, Pending, Firing, Cancelled};
+        struct Node {
+            uint64_t expires;
+            uint64_t interval;
+            Callback callback;
+            uint32_t prev, next;
+            uint32_t generation;
+            uint32_t slot;
+            State state;
+        };
+        static const uint32_t Invalid = UINT32_MAX;
+        static const int RootBits = 8;
+        static const int LevelBits = 6;
+        static const int Levels = 5;
+        static const uint32_t RootSize = 1 << RootBits;
+        static const uint32_t RootMask = RootSize - 1;
+        static const uint32_t LevelSize = 1 << LevelBits;
+        static const uint32_t LevelMask = LevelSize - 1;
+        static const uint32_t SlotCount = RootSize + LevelSize * (Levels - 1);
+        static const uint32_t Running = SlotCount;
+        static const uint32_t ChunkBits = 8;
+        static const uint32_t ChunkSize = 1 << ChunkBits;
+        std::vector<std::unique_ptr<Node[]>> chunks;
+        uint32_t free_head;
+        uint32_t capacity;
+        uint32_t slots[SlotCount + 1];
+        uint64_t root_bitmap[RootSize / 64];
+        uint64_t current;
+        size_t count;
+        Node & node(uint32_t index) const;
+        uint32_t allocate();
+        void release(uint32_t index);
+        void link(uint32_t index);
+        void unlink(uint32_t index);
+        void cascade();
+        void fire(uint32_t slot, uint64_t tick);
+        uint64_t next_root_tick() const;
+};
+}
+#endif
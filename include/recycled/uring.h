@@ -0,0 +1,171 @@
+#ifndef RECYCLED_INCLUDE_URING_H
+#define RECYCLED_INCLUDE_URING_H
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct msghdr;
+
+namespace recycled {
+/**
+ * 一个完成事件
+ */
+struct IOCompletion {
+    /**
+     * 提交时指定的用户数据, 不大于65536的值保留给内部使用
+     */
+    uint64_t user_data;
+    /**
+     * 操作的结果, 失败时为负的errno
+     */
+    int result;
+    /**
+     * 多次操作(accept, recv)之后是否还会有完成事件
+     */
+    bool more;
+    /**
+     * 内核选择的接收缓冲区ID, 没有时为-1
+     */
+    int buffer;
+};
+
+/**
+ * 直接使用系统调用的io_uring封装, 不依赖liburing.
+ * 只在一个线程中使用, 不是线程安全的
+ */
+class IOUring {
+    public:
+        typedef std::function<void (const IOCompletion &completion)> CompletionHandler;
+        IOUring();
+        IOUring(const IOUring &other) = delete;
+        ~IOUring();
+        const IOUring & operator=(const IOUring &other) = delete;
+        /**
+         * 创建io_uring实例
+         *
+         * @param entries 提交队列的长度
+         *
+         * @return 成功返回true, 内核或头文件不支持时返回false
+         */
+        bool initialize(unsigned entries);
+        /**
+         * 提供一组由内核选择的接收缓冲区(provided buffers)
+         *
+         * @param count 缓冲区数量, 不超过65536
+         *
+         * @param size 每个缓冲区的大小
+         *
+         * @param group 缓冲区组ID
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool setup_buffers(unsigned count, unsigned size, uint16_t group);
+        /**
+         * 取得io_uring的文件描述符, 有完成事件时可读
+         *
+         * @return 文件描述符, 未初始化时返回-1
+         */
+        int get_fd() const;
+        /**
+         * 准备一个多次accept, 每个新连接产生一个完成事件, result为新的socket
+         *
+         * @param fd listen socket
+         *
+         * @param user_data 用户数据
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool prepare_accept(int fd, uint64_t user_data);
+        /**
+         * 准备一个多次接收, 数据放在内核从缓冲区组中选择的缓冲区里.
+         * 需要先调用setup_buffers
+         *
+         * @param fd socket
+         *
+         * @param user_data 用户数据
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool prepare_recv(int fd, uint64_t user_data);
+        /**
+         * 准备一个sendmsg, 完成前msg及其指向的数据必须保持有效
+         *
+         * @param fd socket
+         *
+         * @param msg 要发送的消息
+         *
+         * @param user_data 用户数据
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool prepare_sendmsg(int fd, const msghdr *msg, uint64_t user_data);
+        /**
+         * 准备取消一个未完成的操作
+         *
+         * @param target 要取消的操作的用户数据
+         *
+         * @param user_data 用户数据
+         *
+         * @return 成功返回true, 否则返回false
+         */
+        bool prepare_cancel(uint64_t target, uint64_t user_data);
+        /**
+         * 提交所有未提交的提交项
+         *
+         * @return 提交的数量, 失败时返回-1
+         */
+        int submit();
+        /**
+         * 取得还没有提交的提交项数量
+         *
+         * @return 未提交的数量
+         */
+        unsigned get_pending() const;
+        /**
+         * 处理所有已完成的事件
+         *
+         * @param handler 每个完成事件调用一次
+         *
+         * @return 处理的完成事件数量
+         */
+        size_t reap(const CompletionHandler &handler);
+        /**
+         * 取得一个接收缓冲区的地址
+         *
+         * @param id 缓冲区ID, 即完成事件flags的高16位
+         *
+         * @return 缓冲区地址
+         */
+        char * get_buffer(uint16_t id) const;
+        /**
+         * 把用完的接收缓冲区还给内核, 和下一批提交项一起提交.
+         * 提交队列已满或者归还失败时, 在下一次提交时重试
+         *
+         * @param id 缓冲区ID
+         */
+        void recycle_buffer(uint16_t id);
+    private:
+        int fd;
+        void *sq_ptr, *cq_ptr;
+        size_t sq_size, cq_size;
+        io_uring_sqe *sqes;
+        size_t sqes_size;
+        unsigned *sq_head, *sq_tail, *sq_mask;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        io_uring_cqe *cqes;
+        unsigned sq_entries;
+        unsigned sqe_tail, sqe_submitted;
+        char *buffers;
+        unsigned buf_count, buf_size;
+        uint16_t buf_group;
+        std::vector<uint16_t> recycling;
+        io_uring_sqe * get_sqe();
+        bool provide_buffer(uint16_t id);
+        void flush_recycling();
+        void release();
+};
+}
+#endif
@@ -0,0 +1,71 @@
+#ifndef RECYCLED_INCLUDE_WORKERPOOL_H
+#define RECYCLED_INCLUDE_WORKERPOOL_H
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace recycled {
+/**
+ * 有界工作线程池, 用于运行会阻塞事件循环的任务
+ */
+class WorkerPool {
+    public:
+        typedef std::function<void ()> Job;
+        /**
+         * 构造一个线程池并启动工作线程
+         *
+         * @param threads 工作线程数, 为0时使用CPU核心数
+         *
+         * @param max_queue 等待队列的最大长度
+         */
+        WorkerPool(size_t threads = 0, size_t max_queue = 1024);
+        WorkerPool(const WorkerPool &other) = delete;
+        /**
+         * 等待已提交的任务完成并结束工作线程
+         */
+        ~WorkerPool();
+        const WorkerPool & operator=(const WorkerPool &other) = delete;
+        /**
+         * 提交一个任务
+         *
+         * @param job 任务
+         *
+         * @return 提交成功返回true, 等待队列已满时返回false
+         */
+        bool submit(const Job &job);
+        /**
+         * 取得等待中的任务数
+         *
+         * @return 等待中的任务数
+         */
+        size_t get_queue_size();
+        /**
+         * 丢弃还没开始的任务, 正在运行的任务不受影响
+         *
+         * @return 丢弃的任务数
+         */
+        size_t cancel();
+        /**
+         * 是否没有等待中和正在运行的任务. 任务在释放它持有的对象之后才计为结束
+         *
+         * @return 空闲返回true, 否则返回false
+         */
+        bool is_idle();
+    private:
+        std::vector<std::thread> threads;
+        std::deque<Job> jobs;
+        std::mutex mutex;
+        std::condition_variable cond;
+        size_t max_queue;
+        /**
+         * 正在运行的任务数
+         */
+        size_t active;
+        bool stopped;
+        void run();
+};
+}
+#endif
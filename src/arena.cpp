@@ -0,0 +1,89 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "recycled/arena.h"
+
+using namespace recycled;
+
+static const size_t MaxBlockSize = 64 * 1024;
+
+Arena::Arena(size_t block_size):
+    head(nullptr), ptr(nullptr), end(nullptr),
+    block_size(block_size ? block_size : 4096), used(0) {}
+
+Arena::~Arena() {
+    while (this->head) {
+        Block *next = this->head->next;
+        free(this->head);
+        this->head = next;
+    }
+}
+
+void * Arena::allocate(size_t size, size_t align) {
+    uintptr_t p = ((uintptr_t)this->ptr + align - 1) & ~(uintptr_t)(align - 1);
+    if (!this->ptr || p + size > (uintptr_t)this->end) {
+        this->grow(size, align);
+        p = ((uintptr_t)this->ptr + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    this->ptr = (char *)(p + size);
+    this->used += size;
+    return (void *)p;
+}
+
+StringView Arena::copy(const char *data, size_t size) {
+    if (!size) {
+        return StringView();
+    }
+    char *p = (char *)this->allocate(size, 1);
+    memcpy(p, data, size);
+    return StringView(p, size);
+}
+
+void Arena::reset() {
+    // 保留最大的内存块, 下一个请求通常不再需要申请内存
+    Block *largest = nullptr;
+    for (Block *block = this->head; block; block = block->next) {
+        if (!largest || block->size > largest->size) {
+            largest = block;
+        }
+    }
+    while (this->head) {
+        Block *next = this->head->next;
+        if (this->head != largest) {
+            free(this->head);
+        }
+        this->head = next;
+    }
+    this->head = largest;
+    if (largest) {
+        largest->next = nullptr;
+        this->ptr = (char *)(largest + 1);
+        this->end = (char *)largest + largest->size;
+    }
+    this->used = 0;
+}
+
+size_t Arena::get_used() const {
+    return this->used;
+}
+
+void Arena::grow(size_t size, size_t align) {
+    size_t need = sizeof(Block) + size + align;
+    size_t block_size = this->head ? this->head->size * 2 : this->block_size;
+    if (block_size > MaxBlockSize) {
+        block_size = MaxBlockSize;
+    }
+    if (block_size < need) {
+        block_size = need;
+    }
+    Block *block = (Block *)malloc(block_size);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    block->size = block_size;
+    block->next = this->head;
+    this->head = block;
+    this->ptr = (char *)(block + 1);
+    this->end = (char *)block + block_size;
+}
@@ -0,0 +1,193 @@
+#include <stddef.h>
+#include <vector>
+#include "recycled/compressor.h"
+
+using namespace recycled;
+
+static const size_t MaxPooledCompressors = 8;
+static const size_t OutputReserve = 16384;
+static const size_t PeekVectors = 8;
+
+static const char *CompressibleTypes[] = {
+    "application/json",
+    "application/javascript",
+    "application/x-javascript",
+    "application/ecmascript",
+    "application/xml",
+    "application/wasm",
+    "application/vnd.ms-fontobject",
+    "font/ttf",
+    "font/otf",
+    "image/x-icon",
+    "image/vnd.microsoft.icon"
+};
+
+/**
+ * 当前线程的压缩流池, 线程结束时释放
+ */
+struct CompressorPool {
+    std::vector<Compressor *> compressors;
+    ~CompressorPool() {
+        for (Compressor *compressor: this->compressors) {
+            delete compressor;
+        }
+    }
+};
+
+static thread_local CompressorPool pool;
+
+Compressor::Compressor(ContentEncoding encoding, int level):
+    encoding(encoding), level(level) {
+    this->stream.zalloc = Z_NULL;
+    this->stream.zfree = Z_NULL;
+    this->stream.opaque = Z_NULL;
+}
+
+Compressor::~Compressor() {
+    deflateEnd(&this->stream);
+}
+
+bool Compressor::initialize() {
+    // windowBits加16时输出gzip格式, 否则输出zlib格式(HTTP的deflate)
+    int window_bits = this->encoding == ContentEncoding::Gzip ? 15 + 16 : 15;
+    return deflateInit2(&this->stream, this->level, Z_DEFLATED, window_bits, 8,
+                        Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+Compressor * Compressor::acquire(ContentEncoding encoding, int level) {
+    std::vector<Compressor *> &compressors = pool.compressors;
+    for (size_t i = compressors.size(); i > 0; --i) {
+        Compressor *compressor = compressors[i - 1];
+        if (compressor->encoding == encoding && compressor->level == level) {
+            compressors.erase(compressors.begin() + (i - 1));
+            return compressor;
+        }
+    }
+    Compressor *compressor = new Compressor(encoding, level);
+    if (!compressor->initialize()) {
+        // 初始化失败时zlib已释放内部状态, deflateEnd只返回错误
+        delete compressor;
+        return nullptr;
+    }
+    return compressor;
+}
+
+void Compressor::release(Compressor *compressor) {
+    std::vector<Compressor *> &compressors = pool.compressors;
+    if (deflateReset(&compressor->stream) != Z_OK ||
+        compressors.size() >= MaxPooledCompressors) {
+        delete compressor;
+        return;
+    }
+    compressors.push_back(compressor);
+}
+
+bool Compressor::compress(evbuffer *input, evbuffer *output, bool finish) {
+    size_t remaining = evbuffer_get_length(input);
+    do {
+        evbuffer_iovec in[PeekVectors];
+        int count = remaining ? evbuffer_peek(input, -1, NULL, in, PeekVectors) : 0;
+        if (count > (int)PeekVectors) {
+            count = PeekVectors;
+        }
+        size_t consumed = 0;
+        for (int i = 0; i <= count; ++i) {
+            // 最后一轮没有输入, 只输出同步点或压缩流的尾部
+            bool last = i == count;
+            if (last && remaining > consumed) {
+                break;
+            }
+            this->stream.next_in = last ? Z_NULL : (Bytef *)in[i].iov_base;
+            this->stream.avail_in = last ? 0 : in[i].iov_len;
+            int flush = !last ? Z_NO_FLUSH : finish ? Z_FINISH : Z_SYNC_FLUSH;
+            do {
+                evbuffer_iovec out;
+                if (evbuffer_reserve_space(output, OutputReserve, &out, 1) < 1) {
+                    return false;
+                }
+                this->stream.next_out = (Bytef *)out.iov_base;
+                this->stream.avail_out = out.iov_len;
+                int rc = deflate(&this->stream, flush);
+                out.iov_len -= this->stream.avail_out;
+                evbuffer_commit_space(output, &out, 1);
+                if (rc == Z_STREAM_ERROR) {
+                    return false;
+                }
+            } while (!this->stream.avail_out);
+            if (!last) {
+                consumed += in[i].iov_len;
+            }
+        }
+        if (!consumed && remaining) {
+            return false;
+        }
+        evbuffer_drain(input, consumed);
+        remaining -= consumed;
+    } while (remaining);
+    return true;
+}
+
+bool recycled::accepts_encoding(const StringView &header, const char *coding) {
+    int accepted = -1, wildcard = -1;
+    size_t begin = 0;
+    while (begin < header.size()) {
+        size_t end = header.find(',', begin);
+        if (end == StringView::npos) {
+            end = header.size();
+        }
+        StringView item = header.substr(begin, end - begin);
+        begin = end + 1;
+        size_t semicolon = item.find(';');
+        StringView name = trim(item.substr(0, semicolon));
+        bool zero = false;
+        if (semicolon != StringView::npos) {
+            StringView param = trim(item.substr(semicolon + 1));
+            if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') &&
+                param[1] == '=') {
+                StringView q = param.substr(2);
+                zero = !q.empty() && q[0] == '0';
+                for (size_t i = 1; zero && i < q.size(); ++i) {
+                    zero = q[i] == '0' || (i == 1 && q[i] == '.');
+                }
+            }
+        }
+        if (equals_ignore_case(name, coding)) {
+            accepted = !zero;
+        } else if (name == "*") {
+            wildcard = !zero;
+        }
+    }
+    return accepted >= 0 ? accepted : wildcard > 0;
+}
+
+ContentEncoding recycled::negotiate_encoding(const StringView &header) {
+    if (header.empty()) {
+        return ContentEncoding::Identity;
+    }
+    if (accepts_encoding(header, "gzip")) {
+        return ContentEncoding::Gzip;
+    }
+    if (accepts_encoding(header, "deflate")) {
+        return ContentEncoding::Deflate;
+    }
+    return ContentEncoding::Identity;
+}
+
+bool recycled::is_compressible(const StringView &content_type) {
+    StringView type = trim(content_type.substr(0, content_type.find(';')));
+    if (type.size() > 5 && equals_ignore_case(type.substr(0, 5), "text/")) {
+        return true;
+    }
+    if ((type.size() > 5 &&
+         equals_ignore_case(type.substr(type.size() - 5), "+json")) ||
+        (type.size() > 4 &&
+         equals_ignore_case(type.substr(type.size() - 4), "+xml"))) {
+        return true;
+    }
+    for (const char *compressible: CompressibleTypes) {
+        if (equals_ignore_case(type, compressible)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "recycled/conditional.h"
+
+using namespace recycled;
+
+static const size_t MaxRanges = 16;
+
+/**
+ * 解析十进制的非负整数
+ *
+ * @return 成功返回true, 为空, 有其他字符或溢出时返回false
+ */
+static bool parse_number(const StringView &str, uint64_t &value) {
+    if (str.empty()) {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] < '0' || str[i] > '9' || value > (UINT64_MAX - 9) / 10) {
+            return false;
+        }
+        value = value * 10 + (str[i] - '0');
+    }
+    return true;
+}
+
+static StringView strip_weak(const StringView &etag) {
+    if (etag.size() >= 2 && etag[0] == 'W' && etag[1] == '/') {
+        return etag.substr(2);
+    }
+    return etag;
+}
+
+uint64_t recycled::hash_data(const char *data, size_t size, uint64_t hash) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string recycled::format_etag(uint64_t hash, const char *suffix) {
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%016llx%s\"", (unsigned long long)hash,
+             suffix);
+    return etag;
+}
+
+bool recycled::etag_matches(const StringView &header, const StringView &etag) {
+    StringView opaque = strip_weak(etag);
+    size_t begin = 0;
+    while (begin < header.size()) {
+        size_t end = header.find(',', begin);
+        if (end == StringView::npos) {
+            end = header.size();
+        }
+        StringView tag = strip_weak(trim(header.substr(begin, end - begin)));
+        if (tag == "*" || (!tag.empty() && tag == opaque)) {
+            return true;
+        }
+        begin = end + 1;
+    }
+    return false;
+}
+
+std::string recycled::format_http_date(time_t stamp) {
+    tm t;
+    char date[64];
+    gmtime_r(&stamp, &t);
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &t);
+    return date;
+}
+
+time_t recycled::parse_http_date(const StringView &date) {
+    char buffer[64];
+    StringView value = trim(date);
+    if (value.size() >= sizeof(buffer)) {
+        return -1;
+    }
+    memcpy(buffer, value.data(), value.size());
+    buffer[value.size()] = '\0';
+    tm t;
+    memset(&t, 0, sizeof(t));
+    const char *end = strptime(buffer, "%a, %d %b %Y %H:%M:%S GMT", &t);
+    if (!end || *end) {
+        return -1;
+    }
+    return timegm(&t);
+}
+
+int recycled::parse_range(const StringView &header, uint64_t size,
+                          std::vector<ByteRange> &ranges) {
+    ranges.clear();
+    StringView value = trim(header);
+    if (value.size() < 6 || !equals_ignore_case(value.substr(0, 6), "bytes=")) {
+        return 0;
+    }
+    size_t count = 0;
+    size_t begin = 6;
+    while (begin < value.size()) {
+        size_t end = value.find(',', begin);
+        if (end == StringView::npos) {
+            end = value.size();
+        }
+        StringView item = trim(value.substr(begin, end - begin));
+        begin = end + 1;
+        if (item.empty()) {
+            continue;
+        }
+        if (++count > MaxRanges) {
+            return 0;
+        }
+        size_t dash = item.find('-');
+        if (dash == StringView::npos) {
+            return 0;
+        }
+        uint64_t first, last;
+        if (!dash) {
+            // 最后的n个字节
+            if (!parse_number(item.substr(1), last)) {
+                return 0;
+            }
+            if (!last || !size) {
+                continue;
+            }
+            ranges.push_back({last < size ? size - last : 0, size - 1});
+            continue;
+        }
+        if (!parse_number(item.substr(0, dash), first)) {
+            return 0;
+        }
+        if (dash + 1 == item.size()) {
+            last = UINT64_MAX;
+        } else if (!parse_number(item.substr(dash + 1), last) || last < first) {
+            return 0;
+        }
+        if (first >= size) {
+            continue;
+        }
+        ranges.push_back({first, last < size ? last : size - 1});
+    }
+    if (!count) {
+        return 0;
+    }
+    if (ranges.empty()) {
+        return -1;
+    }
+    std::sort(ranges.begin(), ranges.end(),
+              [](const ByteRange &a, const ByteRange &b) {
+                  return a.first < b.first;
+              });
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[merged].last + 1) {
+            ranges[merged].last = std::max(ranges[merged].last, ranges[i].last);
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
+    ranges.resize(merged + 1);
+    return 1;
+}
+
+bool recycled::if_range_matches(const StringView &header, const StringView &etag,
+                                const StringView &last_modified) {
+    StringView value = trim(header);
+    if (value.empty()) {
+        return false;
+    }
+    if (value[0] == '"' || (value.size() >= 2 && value[0] == 'W' &&
+                            value[1] == '/')) {
+        // 弱ETag不能用于If-Range
+        return value[0] == '"' && !etag.empty() && etag[0] == '"' &&
+               value == etag;
+    }
+    if (last_modified.empty()) {
+        return false;
+    }
+    time_t since = parse_http_date(value);
+    return since >= 0 && since == parse_http_date(last_modified);
+}
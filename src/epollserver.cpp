@@ -0,0 +1,1515 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <event2/keyvalq_struct.h>
+#include "recycled/epollserver.h"
+#include "recycled/ioloop.h"
+#include "recycled/socket.h"
+#include "recycled/spool.h"
+#include "recycled/uring.h"
+
+namespace recycled {
+static const size_t MaxHeaderSize = 64 * 1024;
+static const size_t MaxChunkLineSize = 1024;
+static const int MaxEvents = 256;
+static const int MaxAccepts = 64;
+static const unsigned RingEntries = 1024;
+static const unsigned RingBuffers = 256;
+static const unsigned RingBufferSize = 16 * 1024;
+static const uint16_t RingBufferGroup = 0;
+static const int MaxIOVecs = 16;
+static const size_t MaxFreeConnections = 256;
+/**
+ * 关闭超时后等待工作线程的检查间隔(毫秒)
+ */
+static const uint64_t WorkerPollInterval = 10;
+
+/**
+ * io_uring的用户数据为对象指针和操作类型的组合
+ */
+enum RingOperation {RingAccept = 1, RingRecv = 2, RingSend = 3, RingCancel = 4};
+static const uint64_t RingOperationMask = 7;
+
+/**
+ * 一个线程上的服务器状态, 只在该线程中访问
+ */
+struct EpollContext: public std::enable_shared_from_this<EpollContext> {
+    EpollServer *server;
+    IOLoop *loop;
+    int epoll_fd;
+    event *poll_event;
+    evutil_socket_t listen_fd;
+    std::unordered_map<EpollSession *, EpollSessionPtr> sessions;
+    /**
+     * io_uring后端, 为nullptr时使用epoll
+     */
+    IOUring *ring;
+    bool reaping;
+    bool submit_scheduled;
+    /**
+     * 已关闭但还有未完成的io_uring操作的连接
+     */
+    std::unordered_map<EpollSession *, EpollSessionPtr> zombies;
+    /**
+     * 已结束的请求对象, 下一个请求直接重用
+     */
+    std::vector<EpollConnection *> free_connections;
+    bool closing;
+    bool closed;
+    TimerID deadline;
+    EpollContext(EpollServer *server, IOLoop *loop);
+    ~EpollContext();
+    bool initialize();
+    bool initialize_ring();
+    EpollSessionPtr add_session(evutil_socket_t fd);
+    void accept_sessions();
+    void arm_accept();
+    void schedule_submit();
+    void complete(const IOCompletion &completion);
+    void drain(uint64_t timeout);
+    void check_drained();
+    void expire();
+    void finish_drain();
+    void close();
+    static void epoll_handler(evutil_socket_t fd, short what, void *arg);
+    static void ring_handler(evutil_socket_t fd, short what, void *arg);
+};
+
+/**
+ * 一个TCP连接, 同一时间只处理一个请求, pipelining的请求在前一个请求完成后处理
+ */
+struct EpollSession: public std::enable_shared_from_this<EpollSession> {
+    enum class State {Head, Body, ChunkSize, ChunkData, ChunkEnd, Trailer};
+    EpollContextPtr context;
+    evutil_socket_t fd;
+    evbuffer *input, *output, *body;
+    /**
+     * 请求体可能超过阈值时边接收边保存, 否则为nullptr
+     */
+    BodySpool *spool;
+    /**
+     * io_uring后端正在发送的数据, 发送完成前不能修改
+     */
+    evbuffer *sending;
+    iovec iov[MaxIOVecs];
+    msghdr msg;
+    int operations;
+    TimerID timer;
+    State state;
+    size_t remaining;
+    bool closed;
+    bool busy;
+    bool processing;
+    bool read_closed;
+    bool keep_alive;
+    bool close_after_write;
+    bool head_request;
+    int minor_version;
+    HTTPMethod method;
+    std::string uri;
+    SSMap headers;
+    /**
+     * 正在流式接收请求体的请求, 处理器已经调用过
+     */
+    std::shared_ptr<EpollConnection> stream;
+    /**
+     * 收到请求头时已经创建, 等请求体收完再处理的请求
+     */
+    std::shared_ptr<EpollConnection> pending;
+    /**
+     * 已经流式交出的请求体长度
+     */
+    size_t streamed;
+    /**
+     * 处理器暂停了接收请求体
+     */
+    bool paused;
+    /**
+     * io_uring后端是否有正在进行的接收
+     */
+    bool receiving;
+    EpollSession(const EpollContextPtr &context, evutil_socket_t fd);
+    ~EpollSession();
+    void handle(uint32_t events);
+    void read();
+    void write();
+    void process();
+    int parse();
+    int parse_head();
+    int parse_chunk_size();
+    int parse_trailer();
+    int start_stream();
+    void dispatch();
+    std::shared_ptr<EpollConnection> create_connection();
+    void pause_reading();
+    void resume_reading();
+    void finish_request();
+    int reply_error(int status);
+    void arm_timer();
+    void close();
+    const char * find_header(const char *key) const;
+    void arm_recv();
+    void send();
+    void complete_recv(const IOCompletion &completion);
+    void complete_send(const IOCompletion &completion);
+    void finish_operation();
+};
+
+static HTTPMethod parse_method(const char *method, size_t length) {
+    static const struct {
+        const char *name;
+        HTTPMethod method;
+    } names[] = {
+        {"GET",     HTTPMethod::GET},
+        {"POST",    HTTPMethod::POST},
+        {"HEAD",    HTTPMethod::HEAD},
+        {"PUT",     HTTPMethod::PUT},
+        {"DELETE",  HTTPMethod::DELETE},
+        {"OPTIONS", HTTPMethod::OPTIONS},
+        {"PATCH",   HTTPMethod::PATCH}
+    };
+    for (auto &n: names) {
+        if (strlen(n.name) == length && memcmp(n.name, method, length) == 0) {
+            return n.method;
+        }
+    }
+    return HTTPMethod::Other;
+}
+
+static void release_connection(const EpollContextPtr &context,
+                               EpollConnection *conn) {
+    auto release = [context, conn]() {
+        if (!context->closed &&
+            context->free_connections.size() < MaxFreeConnections) {
+            conn->reset();
+            context->free_connections.push_back(conn);
+        } else {
+            delete conn;
+        }
+    };
+    if (IOLoop::current() == context->loop) {
+        release();
+    } else {
+        context->loop->post(release);
+    }
+}
+
+EpollContext::EpollContext(EpollServer *server, IOLoop *loop):
+    server(server), loop(loop), epoll_fd(-1), poll_event(nullptr),
+    listen_fd(-1), ring(nullptr), reaping(false), submit_scheduled(false),
+    closing(false), closed(false), deadline(0) {}
+
+EpollContext::~EpollContext() {
+    this->close();
+}
+
+bool EpollContext::initialize() {
+    if (this->server->backend == IOBackend::IOUring && this->initialize_ring()) {
+        return true;
+    }
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd < 0) {
+        return false;
+    }
+    this->poll_event = event_new(this->loop->get_base(), this->epoll_fd,
+                                  EV_READ | EV_PERSIST, epoll_handler, this);
+    if (!this->poll_event || event_add(this->poll_event, NULL) != 0) {
+        return false;
+    }
+    return true;
+}
+
+bool EpollContext::initialize_ring() {
+    IOUring *ring = new IOUring();
+    if (!ring->initialize(RingEntries) ||
+        !ring->setup_buffers(RingBuffers, RingBufferSize, RingBufferGroup)) {
+        delete ring;
+        return false;
+    }
+    this->poll_event = event_new(this->loop->get_base(), ring->get_fd(),
+                                 EV_READ | EV_PERSIST, ring_handler, this);
+    if (!this->poll_event || event_add(this->poll_event, NULL) != 0) {
+        if (this->poll_event) {
+            event_free(this->poll_event);
+            this->poll_event = nullptr;
+        }
+        delete ring;
+        return false;
+    }
+    this->ring = ring;
+    return true;
+}
+
+EpollSessionPtr EpollContext::add_session(evutil_socket_t fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    EpollSessionPtr session(new EpollSession(this->shared_from_this(), fd));
+    if (!session->input || !session->output || !session->sending) {
+        session->closed = true;
+        ::close(fd);
+        return nullptr;
+    }
+    if (this->ring) {
+        this->sessions[session.get()] = session;
+        session->arm_recv();
+    } else {
+        ::epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = session.get();
+        if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            session->closed = true;
+            ::close(fd);
+            return nullptr;
+        }
+        this->sessions[session.get()] = session;
+    }
+    session->arm_timer();
+    return session;
+}
+
+void EpollContext::accept_sessions() {
+    for (int i = 0; i < MaxAccepts && this->listen_fd >= 0; ++i) {
+        int fd = accept4(this->listen_fd, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            break;
+        }
+        this->add_session(fd);
+    }
+}
+
+void EpollContext::arm_accept() {
+    if (this->listen_fd < 0 || this->closing || this->closed) {
+        return;
+    }
+    this->ring->prepare_accept(this->listen_fd, (uint64_t)this | RingAccept);
+    this->schedule_submit();
+}
+
+void EpollContext::schedule_submit() {
+    // 在完成事件的回调中产生的提交项在回调结束后一起提交
+    if (this->reaping || this->submit_scheduled) {
+        return;
+    }
+    this->submit_scheduled = true;
+    EpollContextPtr self = this->shared_from_this();
+    this->loop->call_soon([self]() {
+        self->submit_scheduled = false;
+        if (self->ring) {
+            self->ring->submit();
+        }
+    });
+}
+
+void EpollContext::complete(const IOCompletion &completion) {
+    uint64_t operation = completion.user_data & RingOperationMask;
+    void *target = (void *)(completion.user_data & ~RingOperationMask);
+    switch (operation) {
+        case RingAccept:
+            if (completion.result >= 0) {
+                if (this->closing || this->closed) {
+                    ::close(completion.result);
+                } else {
+                    this->add_session(completion.result);
+                }
+            }
+            if (!completion.more && completion.result != -ECANCELED) {
+                if (completion.result >= 0) {
+                    this->arm_accept();
+                } else {
+                    // 例如文件描述符用完, 稍后再重新accept
+                    EpollContextPtr self = this->shared_from_this();
+                    this->loop->call_later(10, [self]() {
+                        self->arm_accept();
+                    });
+                }
+            }
+            break;
+        case RingRecv:
+            ((EpollSession *)target)->complete_recv(completion);
+            break;
+        case RingSend:
+            ((EpollSession *)target)->complete_send(completion);
+            break;
+        default:
+            break;
+    }
+}
+
+void EpollContext::drain(uint64_t timeout) {
+    if (this->closed || this->closing) {
+        this->finish_drain();
+        return;
+    }
+    this->closing = true;
+    if (this->listen_fd >= 0) {
+        if (this->ring) {
+            this->ring->prepare_cancel((uint64_t)this | RingAccept,
+                                       (uint64_t)this | RingCancel);
+            this->ring->submit();
+        } else {
+            epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, this->listen_fd, NULL);
+        }
+        evutil_closesocket(this->listen_fd);
+        this->listen_fd = -1;
+    }
+    std::vector<EpollSessionPtr> idle;
+    for (auto &p: this->sessions) {
+        if (!p.second->busy) {
+            idle.push_back(p.second);
+        }
+    }
+    for (const EpollSessionPtr &session: idle) {
+        session->close();
+    }
+    EpollContextPtr self = this->shared_from_this();
+    this->deadline = this->loop->call_later(timeout, [self]() {
+        self->deadline = 0;
+        self->expire();
+    });
+    this->check_drained();
+}
+
+void EpollContext::expire() {
+    // 超时后关闭所有连接. 阻塞处理器可能还在工作线程中使用请求对象,
+    // 丢弃还没开始的任务, 等正在运行的任务结束后再结束事件循环
+    this->close();
+    WorkerPool *workers = this->server->workers;
+    if (workers) {
+        workers->cancel();
+    }
+    EpollContextPtr self = this->shared_from_this();
+    if (workers && !workers->is_idle()) {
+        this->deadline = this->loop->call_later(WorkerPollInterval, [self]() {
+            self->deadline = 0;
+            self->expire();
+        });
+        return;
+    }
+    // 工作线程结束前投递的回调(释放请求对象)先执行
+    this->loop->post([self]() {
+        self->finish_drain();
+    });
+}
+
+void EpollContext::check_drained() {
+    if (!this->closing || this->closed || !this->sessions.empty()) {
+        return;
+    }
+    EpollContextPtr self = this->shared_from_this();
+    this->loop->call_soon([self]() {
+        if (!self->closed && self->sessions.empty()) {
+            self->finish_drain();
+        }
+    });
+}
+
+void EpollContext::finish_drain() {
+    if (!this->closed) {
+        if (this->deadline) {
+            this->loop->cancel_timer(this->deadline);
+            this->deadline = 0;
+        }
+        this->close();
+    }
+    if (--this->server->draining == 0) {
+        IOLoop::get_instance().stop();
+    }
+}
+
+void EpollContext::close() {
+    if (this->closed) {
+        return;
+    }
+    this->closed = true;
+    std::vector<EpollSessionPtr> sessions;
+    for (auto &p: this->sessions) {
+        sessions.push_back(p.second);
+    }
+    for (const EpollSessionPtr &session: sessions) {
+        session->close();
+    }
+    if (this->listen_fd >= 0) {
+        evutil_closesocket(this->listen_fd);
+        this->listen_fd = -1;
+    }
+    if (this->poll_event) {
+        event_free(this->poll_event);
+        this->poll_event = nullptr;
+    }
+    if (this->ring) {
+        // 释放io_uring会取消所有未完成的操作, 之后可以关闭剩下的连接
+        delete this->ring;
+        this->ring = nullptr;
+        for (auto &p: this->zombies) {
+            evutil_closesocket(p.second->fd);
+            p.second->operations = 0;
+        }
+        this->zombies.clear();
+    }
+    for (EpollConnection *conn: this->free_connections) {
+        delete conn;
+    }
+    this->free_connections.clear();
+    if (this->epoll_fd >= 0) {
+        ::close(this->epoll_fd);
+        this->epoll_fd = -1;
+    }
+}
+
+void EpollContext::epoll_handler(evutil_socket_t fd, short what, void *arg) {
+    EpollContext *context = (EpollContext *)arg;
+    EpollContextPtr self = context->shared_from_this();
+    ::epoll_event events[MaxEvents];
+    int n = epoll_wait(context->epoll_fd, events, MaxEvents, 0);
+    for (int i = 0; i < n && !context->closed; ++i) {
+        if (!events[i].data.ptr) {
+            context->accept_sessions();
+            continue;
+        }
+        EpollSession *session = (EpollSession *)events[i].data.ptr;
+        session->handle(events[i].events);
+    }
+}
+
+void EpollContext::ring_handler(evutil_socket_t fd, short what, void *arg) {
+    EpollContext *context = (EpollContext *)arg;
+    EpollContextPtr self = context->shared_from_this();
+    context->reaping = true;
+    context->ring->reap([context](const IOCompletion &completion) {
+        context->complete(completion);
+    });
+    context->reaping = false;
+    if (context->ring) {
+        context->ring->submit();
+    }
+}
+
+EpollSession::EpollSession(const EpollContextPtr &context, evutil_socket_t fd):
+    context(context), fd(fd), input(evbuffer_new()), output(evbuffer_new()),
+    body(nullptr), spool(nullptr), sending(evbuffer_new()), operations(0), timer(0),
+    state(State::Head), remaining(0), closed(false), busy(false),
+    processing(false), read_closed(false), keep_alive(true),
+    close_after_write(false), head_request(false), minor_version(1),
+    method(HTTPMethod::Other), streamed(0), paused(false), receiving(false) {}
+
+EpollSession::~EpollSession() {
+    if (this->input) {
+        evbuffer_free(this->input);
+    }
+    if (this->output) {
+        evbuffer_free(this->output);
+    }
+    if (this->body) {
+        evbuffer_free(this->body);
+    }
+    delete this->spool;
+    if (this->sending) {
+        evbuffer_free(this->sending);
+    }
+}
+
+void EpollSession::handle(uint32_t events) {
+    if (this->closed) {
+        return;
+    }
+    if (events & EPOLLERR) {
+        this->close();
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        this->read();
+    }
+    if (!this->closed && (events & EPOLLOUT)) {
+        this->write();
+    }
+}
+
+void EpollSession::read() {
+    // 暂停时把数据留在内核中, 由TCP流量控制让对端停止发送
+    while (!this->read_closed && !this->paused) {
+        int n = evbuffer_read(this->input, this->fd, -1);
+        if (n > 0) {
+            continue;
+        }
+        if (n == 0) {
+            this->read_closed = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            this->close();
+            return;
+        }
+    }
+    this->process();
+}
+
+void EpollSession::write() {
+    if (this->context->ring) {
+        this->send();
+        return;
+    }
+    while (!this->closed && evbuffer_get_length(this->output)) {
+        int n = evbuffer_write(this->output, this->fd);
+        if (n >= 0) {
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            this->close();
+        }
+        return;
+    }
+    if (this->close_after_write && !this->busy) {
+        this->close();
+    }
+}
+
+void EpollSession::process() {
+    if (this->processing || this->closed) {
+        return;
+    }
+    EpollSessionPtr self = this->shared_from_this();
+    this->processing = true;
+    // 流式接收请求体时处理器已经在运行, 继续解析请求体
+    while (!this->closed && (!this->busy || this->stream) &&
+           !this->close_after_write) {
+        if (this->parse() <= 0) {
+            break;
+        }
+    }
+    this->processing = false;
+    if (!this->closed && !this->busy && this->read_closed) {
+        // 对端已关闭, 发送完已有的响应后关闭连接
+        this->close_after_write = true;
+        this->write();
+    }
+}
+
+int EpollSession::parse() {
+    while (true) {
+        switch (this->state) {
+            case State::Head: {
+                int rc = this->parse_head();
+                if (rc <= 0 || this->state == State::Head) {
+                    return rc;
+                }
+                break;
+            }
+            case State::Body: {
+                if (this->paused) {
+                    return 0;
+                }
+                size_t length = evbuffer_get_length(this->input);
+                size_t n = length < this->remaining ? length : this->remaining;
+                evbuffer_remove_buffer(this->input, this->body, n);
+                if (n) {
+                    // 请求体还在到达, 重新开始计时
+                    this->arm_timer();
+                }
+                if (this->stream) {
+                    this->streamed += n;
+                    this->stream->receive_body(this->body);
+                } else if (this->spool && !this->spool->write(this->body)) {
+                    return this->reply_error(this->spool->is_malformed() ? 400 : 500);
+                }
+                this->remaining -= n;
+                if (this->remaining) {
+                    return 0;
+                }
+                this->dispatch();
+                return 1;
+            }
+            case State::ChunkSize: {
+                int rc = this->parse_chunk_size();
+                if (rc <= 0) {
+                    return rc;
+                }
+                break;
+            }
+            case State::ChunkData: {
+                if (this->paused) {
+                    return 0;
+                }
+                size_t length = evbuffer_get_length(this->input);
+                size_t n = length < this->remaining ? length : this->remaining;
+                evbuffer_remove_buffer(this->input, this->body, n);
+                if (n) {
+                    // 请求体还在到达, 重新开始计时
+                    this->arm_timer();
+                }
+                if (this->stream) {
+                    this->streamed += n;
+                    this->stream->receive_body(this->body);
+                } else if (this->spool && !this->spool->write(this->body)) {
+                    return this->reply_error(this->spool->is_malformed() ? 400 : 500);
+                }
+                this->remaining -= n;
+                if (this->remaining) {
+                    return 0;
+                }
+                this->state = State::ChunkEnd;
+                break;
+            }
+            case State::ChunkEnd: {
+                if (evbuffer_get_length(this->input) < 2) {
+                    return 0;
+                }
+                char crlf[2];
+                evbuffer_remove(this->input, crlf, 2);
+                if (crlf[0] != '\r' || crlf[1] != '\n') {
+                    return this->reply_error(400);
+                }
+                this->state = State::ChunkSize;
+                break;
+            }
+            case State::Trailer: {
+                int rc = this->parse_trailer();
+                if (rc <= 0 || this->state == State::Trailer) {
+                    return rc;
+                }
+                this->dispatch();
+                return 1;
+            }
+        }
+    }
+}
+
+int EpollSession::parse_head() {
+    // 忽略请求之间多余的空行
+    while (evbuffer_get_length(this->input) >= 2) {
+        const char *p = (const char *)evbuffer_pullup(this->input, 2);
+        if (p[0] != '\r' || p[1] != '\n') {
+            break;
+        }
+        evbuffer_drain(this->input, 2);
+    }
+    evbuffer_ptr end = evbuffer_search(this->input, "\r\n\r\n", 4, NULL);
+    if (end.pos < 0) {
+        if (evbuffer_get_length(this->input) > MaxHeaderSize) {
+            return this->reply_error(431);
+        }
+        return 0;
+    }
+    size_t head_size = end.pos + 4;
+    if (head_size > MaxHeaderSize) {
+        return this->reply_error(431);
+    }
+    const char *head = (const char *)evbuffer_pullup(this->input, head_size);
+    const char *head_end = head + end.pos + 2;
+    const char *line_end = (const char *)memchr(head, '\r', head_end - head);
+    if (!line_end || line_end[1] != '\n' ||
+        memchr(head, '\n', line_end - head)) {
+        // 单独的CR或LF
+        return this->reply_error(400);
+    }
+    const char *sp1 = (const char *)memchr(head, ' ', line_end - head);
+    const char *sp2 = sp1 ? (const char *)memchr(sp1 + 1, ' ', line_end - sp1 - 1)
+                          : nullptr;
+    if (!sp1 || !sp2 || sp1 == head || sp2 == sp1 + 1 ||
+        line_end - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0 ||
+        (sp2[8] != '0' && sp2[8] != '1')) {
+        return this->reply_error(400);
+    }
+    this->method = parse_method(head, sp1 - head);
+    this->uri.assign(sp1 + 1, sp2 - sp1 - 1);
+    this->minor_version = sp2[8] - '0';
+    this->headers.clear();
+    delete this->spool;
+    this->spool = nullptr;
+    // 决定请求体长度的请求头直接从原始的请求头中取得, 重复或有歧义时拒绝,
+    // 以免与前端代理对请求的边界理解不同
+    std::string content_length, transfer_encoding;
+    bool has_content_length = false, has_transfer_encoding = false;
+    const char *line = line_end + 2;
+    while (line < head_end) {
+        line_end = (const char *)memchr(line, '\r', head_end - line);
+        if (!line_end || line_end[1] != '\n' ||
+            memchr(line, '\n', line_end - line)) {
+            return this->reply_error(400);
+        }
+        const char *colon = (const char *)memchr(line, ':', line_end - line);
+        if (!colon || colon == line || *line == ' ' || *line == '\t' ||
+            colon[-1] == ' ' || colon[-1] == '\t') {
+            return this->reply_error(400);
+        }
+        const char *value = colon + 1;
+        const char *value_end = line_end;
+        while (value < value_end && (*value == ' ' || *value == '\t')) {
+            ++value;
+        }
+        while (value_end > value && (value_end[-1] == ' ' ||
+                                     value_end[-1] == '\t')) {
+            --value_end;
+        }
+        StringView name(line, colon - line);
+        StringView field(value, value_end - value);
+        if (equals_ignore_case(name, "Content-Length")) {
+            if (has_content_length && field != StringView(content_length)) {
+                return this->reply_error(400);
+            }
+            content_length.assign(field.data(), field.size());
+            has_content_length = true;
+        } else if (equals_ignore_case(name, "Transfer-Encoding")) {
+            if (has_transfer_encoding) {
+                return this->reply_error(400);
+            }
+            transfer_encoding.assign(field.data(), field.size());
+            has_transfer_encoding = true;
+        }
+        auto inserted = this->headers.insert(std::make_pair(name.str(), field.str()));
+        if (!inserted.second && !field.empty()) {
+            // 同名的请求头能合并时合并成一个, 否则保留第一个
+            StringView separator = header_separator(find_known_header(name));
+            std::string &joined = inserted.first->second;
+            if (joined.empty()) {
+                joined = field.str();
+            } else if (!separator.empty()) {
+                joined.append(separator.data(), separator.size());
+                joined.append(field.data(), field.size());
+            }
+        }
+        line = line_end + 2;
+    }
+    evbuffer_drain(this->input, head_size);
+    const char *connection = this->find_header("Connection");
+    if (this->minor_version) {
+        this->keep_alive = !connection || strcasecmp(connection, "close") != 0;
+    } else {
+        this->keep_alive = connection && strcasecmp(connection, "keep-alive") == 0;
+    }
+    this->head_request = this->method == HTTPMethod::HEAD;
+    if (!this->body) {
+        this->body = evbuffer_new();
+    }
+    size_t max_body_size = this->context->server->max_body_size;
+    if (has_transfer_encoding && has_content_length) {
+        // 同时有两者时前后的代理可能按不同的方式确定请求体的长度(请求走私)
+        return this->reply_error(400);
+    }
+    if (has_transfer_encoding &&
+        strcasecmp(transfer_encoding.c_str(), "identity") != 0) {
+        if (strcasecmp(transfer_encoding.c_str(), "chunked") != 0) {
+            return this->reply_error(501);
+        }
+        this->state = State::ChunkSize;
+    } else if (has_content_length) {
+        const char *digits = content_length.c_str();
+        char *endptr;
+        errno = 0;
+        unsigned long long length = strtoull(digits, &endptr, 10);
+        if (*digits < '0' || *digits > '9' || *endptr || errno) {
+            return this->reply_error(400);
+        }
+        if (length > max_body_size) {
+            return this->reply_error(413);
+        }
+        this->remaining = length;
+        if (length) {
+            this->state = State::Body;
+        }
+    }
+    if (this->state != State::Head) {
+        EpollServer *server = this->context->server;
+        if (server->spill_threshold != SIZE_MAX &&
+            (this->state == State::ChunkSize ||
+             this->remaining > server->spill_threshold)) {
+            const char *content_type = this->find_header("Content-Type");
+            this->spool = new BodySpool(server->spill_directory,
+                                        server->spill_threshold);
+            if (!this->spool->initialize(content_type ? content_type : "")) {
+                return this->reply_error(500);
+            }
+        }
+        const char *expect = this->find_header("Expect");
+        if (expect && this->minor_version &&
+            strcasecmp(expect, "100-continue") == 0) {
+            evbuffer_add_printf(this->output, "HTTP/1.1 100 Continue\r\n\r\n");
+            this->write();
+        }
+        if (server->streaming_checker) {
+            return this->start_stream();
+        }
+        return 1;
+    }
+    this->dispatch();
+    return 1;
+}
+
+int EpollSession::parse_chunk_size() {
+    evbuffer_ptr end = evbuffer_search(this->input, "\r\n", 2, NULL);
+    if (end.pos < 0) {
+        if (evbuffer_get_length(this->input) > MaxChunkLineSize) {
+            return this->reply_error(400);
+        }
+        return 0;
+    }
+    const char *line = (const char *)evbuffer_pullup(this->input, end.pos + 2);
+    // 不用strtoull, 它接受前导空白, 正负号和0x前缀, 与前端代理的理解可能不同
+    const char *p = line;
+    unsigned long long size = 0;
+    for (; isxdigit((unsigned char)*p); ++p) {
+        if (size >> 60) {
+            return this->reply_error(413);
+        }
+        int digit = *p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10;
+        size = size << 4 | digit;
+    }
+    if (p == line || (*p != ';' && *p != '\r' && *p != ' ' && *p != '\t')) {
+        return this->reply_error(400);
+    }
+    evbuffer_drain(this->input, end.pos + 2);
+    size_t max_body_size = this->context->server->max_body_size;
+    size_t received = this->stream ? this->streamed :
+                      this->spool ? this->spool->get_size() :
+                      evbuffer_get_length(this->body);
+    if (size > max_body_size - received) {
+        return this->reply_error(413);
+    }
+    if (size) {
+        this->remaining = size;
+        this->state = State::ChunkData;
+    } else {
+        this->state = State::Trailer;
+    }
+    return 1;
+}
+
+int EpollSession::parse_trailer() {
+    while (true) {
+        evbuffer_ptr end = evbuffer_search(this->input, "\r\n", 2, NULL);
+        if (end.pos < 0) {
+            if (evbuffer_get_length(this->input) > MaxHeaderSize) {
+                return this->reply_error(431);
+            }
+            return 0;
+        }
+        evbuffer_drain(this->input, end.pos + 2);
+        if (end.pos == 0) {
+            this->state = State::Head;
+            return 1;
+        }
+    }
+}
+
+int EpollSession::start_stream() {
+    std::shared_ptr<EpollConnection> conn = this->create_connection();
+    if (!conn->initialize()) {
+        conn->abandon();
+        return this->reply_error(400);
+    }
+    EpollServer *server = this->context->server;
+    if (!server->streaming_checker(*conn)) {
+        this->pending = conn;
+        return 1;
+    }
+    // 请求体直接交给处理器, 不需要保存
+    delete this->spool;
+    this->spool = nullptr;
+    this->busy = true;
+    // 流式接收期间保持计时, 对端停止发送时关闭连接
+    this->arm_timer();
+    this->stream = conn;
+    this->streamed = 0;
+    conn->begin_body();
+    server->request_handler(*conn);
+    return 1;
+}
+
+void EpollSession::dispatch() {
+    this->state = State::Head;
+    if (this->stream) {
+        // 请求体结束, 处理器已经调用过. 响应可能已经完成, 不改变busy
+        std::shared_ptr<EpollConnection> conn;
+        conn.swap(this->stream);
+        this->paused = false;
+        if (this->busy && this->timer) {
+            // 处理器还在生成响应, 不算空闲
+            this->context->loop->cancel_timer(this->timer);
+            this->timer = 0;
+        }
+        conn->end_body();
+        return;
+    }
+    this->busy = true;
+    if (this->timer) {
+        this->context->loop->cancel_timer(this->timer);
+        this->timer = 0;
+    }
+    std::shared_ptr<EpollConnection> conn;
+    bool ok;
+    if (this->pending) {
+        conn.swap(this->pending);
+        ok = conn->take_body();
+    } else {
+        conn = this->create_connection();
+        ok = conn->initialize() && conn->take_body();
+    }
+    if (!ok) {
+        conn->abandon();
+        this->busy = false;
+        this->reply_error(400);
+        return;
+    }
+    this->context->server->request_handler(*conn);
+}
+
+std::shared_ptr<EpollConnection> EpollSession::create_connection() {
+    EpollConnection *raw;
+    if (!this->context->free_connections.empty()) {
+        raw = this->context->free_connections.back();
+        this->context->free_connections.pop_back();
+        raw->set_session(this->shared_from_this());
+    } else {
+        raw = new EpollConnection(this->shared_from_this());
+        raw->set_compression(&this->context->server->compression);
+        raw->set_auto_etag(this->context->server->auto_etag);
+    }
+    return std::shared_ptr<EpollConnection>(
+        raw, std::bind(release_connection, this->context, std::placeholders::_1));
+}
+
+void EpollSession::pause_reading() {
+    if (this->stream) {
+        this->paused = true;
+        // 是处理器让对端停止发送的, 暂停期间不计时
+        if (this->timer) {
+            this->context->loop->cancel_timer(this->timer);
+            this->timer = 0;
+        }
+    }
+}
+
+void EpollSession::resume_reading() {
+    if (!this->paused || this->closed) {
+        return;
+    }
+    this->paused = false;
+    this->arm_timer();
+    if (!this->context->ring) {
+        // 边缘触发, 暂停期间到达的数据不会再有通知, 直接读取
+        this->read();
+        return;
+    }
+    this->process();
+    if (!this->closed && !this->read_closed && !this->receiving) {
+        this->arm_recv();
+    }
+}
+
+void EpollSession::finish_request() {
+    this->busy = false;
+    if (!this->keep_alive) {
+        this->close_after_write = true;
+    }
+    this->write();
+    if (this->closed || this->close_after_write) {
+        return;
+    }
+    this->arm_timer();
+    if (!this->processing &&
+        (evbuffer_get_length(this->input) || this->read_closed)) {
+        EpollSessionPtr self = this->shared_from_this();
+        this->context->loop->call_soon([self]() {
+            self->process();
+        });
+    }
+}
+
+int EpollSession::reply_error(int status) {
+    if (this->stream) {
+        // 处理器可能已经开始发送响应, 只能关闭连接
+        this->close();
+        return -1;
+    }
+    auto it = StatusReasons.find(status);
+    const char *reason = it != StatusReasons.end() ? it->second : "Error";
+    evbuffer_add_printf(this->output,
+                        "HTTP/1.%d %d %s\r\nDate: %s\r\nContent-Length: 0\r\n"
+                        "Connection: close\r\n\r\n",
+                        this->minor_version, status, reason,
+                        this->context->loop->get_http_date());
+    this->close_after_write = true;
+    this->write();
+    return -1;
+}
+
+void EpollSession::arm_timer() {
+    IOLoop *loop = this->context->loop;
+    if (this->timer) {
+        loop->cancel_timer(this->timer);
+        this->timer = 0;
+    }
+    uint64_t timeout = this->context->server->timeout;
+    if (!timeout) {
+        return;
+    }
+    this->timer = loop->call_later(timeout, [this]() {
+        this->timer = 0;
+        this->close();
+    });
+}
+
+void EpollSession::close() {
+    if (this->closed) {
+        return;
+    }
+    this->closed = true;
+    // 请求对象持有会话, 释放它们以免互相引用
+    this->stream.reset();
+    this->pending.reset();
+    EpollContext *context = this->context.get();
+    if (this->timer) {
+        context->loop->cancel_timer(this->timer);
+        this->timer = 0;
+    }
+    auto it = context->sessions.find(this);
+    EpollSessionPtr self = it != context->sessions.end() ? it->second : nullptr;
+    if (self) {
+        context->sessions.erase(it);
+    }
+    if (context->ring && this->operations) {
+        // 还有未完成的操作, shutdown使它们尽快完成, 全部完成后再关闭socket
+        shutdown(this->fd, SHUT_RDWR);
+        if (self) {
+            context->zombies[this] = self;
+        }
+    } else {
+        if (context->epoll_fd >= 0) {
+            epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, this->fd, NULL);
+        }
+        evutil_closesocket(this->fd);
+        if (self) {
+            // 调用者可能还在使用这个会话, 推迟到下一轮事件循环释放
+            context->loop->call_soon([self]() {});
+        }
+    }
+    context->check_drained();
+}
+
+const char * EpollSession::find_header(const char *key) const {
+    for (auto &p: this->headers) {
+        if (strcasecmp(p.first.c_str(), key) == 0) {
+            return p.second.c_str();
+        }
+    }
+    return nullptr;
+}
+
+void EpollSession::arm_recv() {
+    IOUring *ring = this->context->ring;
+    if (this->closed || !ring) {
+        return;
+    }
+    if (ring->prepare_recv(this->fd, (uint64_t)this | RingRecv)) {
+        this->receiving = true;
+        ++this->operations;
+        this->context->schedule_submit();
+    } else {
+        this->close();
+    }
+}
+
+void EpollSession::send() {
+    IOUring *ring = this->context->ring;
+    if (this->closed || !ring || evbuffer_get_length(this->sending)) {
+        // 上一次发送还没有完成
+        return;
+    }
+    if (!evbuffer_get_length(this->output)) {
+        if (this->close_after_write && !this->busy) {
+            this->close();
+        }
+        return;
+    }
+    evbuffer_add_buffer(this->sending, this->output);
+    int n = evbuffer_peek(this->sending, -1, NULL, this->iov, MaxIOVecs);
+    memset(&this->msg, 0, sizeof(this->msg));
+    this->msg.msg_iov = this->iov;
+    this->msg.msg_iovlen = n < MaxIOVecs ? n : MaxIOVecs;
+    if (ring->prepare_sendmsg(this->fd, &this->msg, (uint64_t)this | RingSend)) {
+        ++this->operations;
+        this->context->schedule_submit();
+    } else {
+        this->close();
+    }
+}
+
+void EpollSession::complete_recv(const IOCompletion &completion) {
+    EpollSessionPtr self = this->shared_from_this();
+    IOUring *ring = this->context->ring;
+    if (completion.buffer >= 0) {
+        if (completion.result > 0 && !this->closed) {
+            evbuffer_add(this->input, ring->get_buffer(completion.buffer),
+                         completion.result);
+        }
+        ring->recycle_buffer(completion.buffer);
+    }
+    if (!this->closed) {
+        if (completion.result == 0) {
+            this->read_closed = true;
+        } else if (completion.result < 0 && completion.result != -ENOBUFS) {
+            this->close();
+        }
+    }
+    if (!this->closed) {
+        this->process();
+    }
+    if (!completion.more) {
+        this->receiving = false;
+    }
+    if (!completion.more && !this->closed && !this->read_closed &&
+        !this->paused) {
+        // 多次接收结束了(例如缓冲区用完), 重新开始. 暂停时等恢复后再开始
+        this->arm_recv();
+    }
+    if (!completion.more) {
+        this->finish_operation();
+    }
+}
+
+void EpollSession::complete_send(const IOCompletion &completion) {
+    EpollSessionPtr self = this->shared_from_this();
+    if (completion.result >= 0) {
+        evbuffer_drain(this->sending, completion.result);
+    } else if (completion.result != -EAGAIN && completion.result != -EINTR) {
+        evbuffer_drain(this->sending, evbuffer_get_length(this->sending));
+        this->close();
+    }
+    if (!this->closed && evbuffer_get_length(this->sending)) {
+        // 只发送了一部分, 把剩下的放回输出缓冲区的前面
+        evbuffer_prepend_buffer(this->output, this->sending);
+    }
+    this->finish_operation();
+    if (!this->closed) {
+        this->send();
+    }
+}
+
+void EpollSession::finish_operation() {
+    if (--this->operations || !this->closed) {
+        return;
+    }
+    EpollContext *context = this->context.get();
+    auto it = context->zombies.find(this);
+    if (it != context->zombies.end()) {
+        evutil_closesocket(this->fd);
+        EpollSessionPtr self = it->second;
+        context->zombies.erase(it);
+        context->loop->call_soon([self]() {});
+    }
+}
+
+EpollConnection::EpollConnection(const EpollSessionPtr &session):
+    HTTPConnection(nullptr), session(session) {
+    TAILQ_INIT(&this->headers);
+}
+
+EpollConnection::~EpollConnection() {
+    if (!this->finished && this->output_buffer) {
+        this->finished = true;
+        this->send_reply();
+    }
+    evhttp_clear_headers(&this->headers);
+}
+
+void EpollConnection::reset() {
+    HTTPConnection::reset();
+    evhttp_clear_headers(&this->headers);
+    this->session.reset();
+}
+
+void EpollConnection::set_session(const EpollSessionPtr &session) {
+    this->session = session;
+    this->loop = IOLoop::current();
+    this->finished = false;
+}
+
+bool EpollConnection::initialize() {
+    EpollSession *session = this->session.get();
+    if (!this->output_buffer) {
+        this->output_buffer = evbuffer_new();
+        if (!this->output_buffer) {
+            return false;
+        }
+    }
+    this->output_headers = &this->headers;
+    // io_uring后端从内存中发送, 文件段需要映射到内存
+    this->file_flags = session->context->ring ? EVBUF_FS_DISABLE_SENDFILE : 0;
+    this->method = session->method;
+    this->input_headers.swap(session->headers);
+    this->parsed |= HeaderMap;
+    return this->parse_request(session->uri.c_str(), nullptr);
+}
+
+bool EpollConnection::take_body() {
+    EpollSession *session = this->session.get();
+    bool ok = this->set_body(session->body);
+    evbuffer_drain(session->body, evbuffer_get_length(session->body));
+    if (session->spool) {
+        BodySpool *spool = session->spool;
+        session->spool = nullptr;
+        ok = this->set_spool(spool) && ok;
+    }
+    return ok;
+}
+
+void EpollConnection::pause_body() {
+    EpollSessionPtr session = this->session;
+    this->run_in_loop([session]() {
+        session->pause_reading();
+    });
+}
+
+void EpollConnection::resume_body() {
+    EpollSessionPtr session = this->session;
+    this->run_in_loop([session]() {
+        session->resume_reading();
+    });
+}
+
+void EpollConnection::send_chunk(bool start, evbuffer *chunk) {
+    EpollSession *session = this->session.get();
+    if (session->closed) {
+        evbuffer_drain(chunk, evbuffer_get_length(chunk));
+        return;
+    }
+    this->compress_output(chunk, start, false);
+    size_t length = evbuffer_get_length(chunk);
+    if (start) {
+        if (!session->minor_version) {
+            // HTTP/1.0不支持分块传输编码, 以关闭连接表示响应结束
+            session->keep_alive = false;
+        }
+        this->add_cookie_headers();
+        this->write_head(true);
+    }
+    if (length && !session->head_request) {
+        if (session->minor_version) {
+            evbuffer_add_printf(session->output, "%zx\r\n", length);
+            evbuffer_add_buffer(session->output, chunk);
+            evbuffer_add(session->output, "\r\n", 2);
+        } else {
+            evbuffer_add_buffer(session->output, chunk);
+        }
+    }
+    evbuffer_drain(chunk, evbuffer_get_length(chunk));
+    session->write();
+}
+
+void EpollConnection::send_reply() {
+    EpollSession *session = this->session.get();
+    if (session->closed || !session->busy) {
+        return;
+    }
+    if (!this->chunked) {
+        this->add_etag_header();
+        this->compress_output(this->output_buffer, true, true);
+        this->add_cookie_headers();
+        this->write_head(false);
+        if (session->head_request || this->status_code == 204 ||
+            this->status_code == 304) {
+            evbuffer_drain(this->output_buffer,
+                           evbuffer_get_length(this->output_buffer));
+        } else {
+            evbuffer_add_buffer(session->output, this->output_buffer);
+        }
+    } else {
+        this->compress_output(this->output_buffer, false, true);
+        this->send_chunk(false, this->output_buffer);
+        if (session->minor_version && !session->head_request) {
+            evbuffer_add(session->output, "0\r\n\r\n", 5);
+        }
+    }
+    session->finish_request();
+}
+
+void EpollConnection::write_head(bool chunked) {
+    EpollSession *session = this->session.get();
+    EpollContext *context = session->context.get();
+    evbuffer *output = session->output;
+    if (context->closing) {
+        session->keep_alive = false;
+    }
+    evbuffer_add_printf(output, "HTTP/1.%d %d %s\r\n", session->minor_version,
+                        this->status_code, this->status_reason.c_str());
+    for (evkeyval *i = this->headers.tqh_first; i; i = i->next.tqe_next) {
+        evbuffer_add_printf(output, "%s: %s\r\n", i->key, i->value);
+    }
+    if (!evhttp_find_header(&this->headers, "Date")) {
+        evbuffer_add_printf(output, "Date: %s\r\n",
+                            context->loop->get_http_date());
+    }
+    bool has_body = this->status_code != 204 && this->status_code != 304;
+    if (has_body && !evhttp_find_header(&this->headers, "Content-Type")) {
+        evbuffer_add_printf(output,
+                            "Content-Type: text/html; charset=ISO-8859-1\r\n");
+    }
+    if (chunked) {
+        if (session->minor_version) {
+            evbuffer_add_printf(output, "Transfer-Encoding: chunked\r\n");
+        }
+    } else if (has_body &&
+               !evhttp_find_header(&this->headers, "Content-Length")) {
+        evbuffer_add_printf(output, "Content-Length: %zu\r\n",
+                            evbuffer_get_length(this->output_buffer));
+    }
+    if (!session->keep_alive) {
+        evbuffer_add_printf(output, "Connection: close\r\n");
+    } else if (!session->minor_version) {
+        evbuffer_add_printf(output, "Connection: keep-alive\r\n");
+    }
+    evbuffer_add(output, "\r\n", 2);
+}
+
+EpollServer::EpollServer(const RequestHandler &request_handler,
+                         IOBackend backend):
+    request_handler(request_handler), timeout(60000), max_body_size(SIZE_MAX),
+    spill_threshold(SIZE_MAX), spill_directory("/tmp"),
+    compression({SIZE_MAX, Z_DEFAULT_COMPRESSION}), auto_etag(false),
+    workers(nullptr), backend(backend),
+    draining(0) {}
+
+EpollServer::~EpollServer() {
+    this->close();
+}
+
+bool EpollServer::initialize() {
+    IOLoop & loop = IOLoop::get_instance();
+    IOLoop::EventAddHandler add_handler =
+        std::bind(&EpollServer::event_add_handler, this, std::placeholders::_1);
+    return loop.add_event(add_handler);
+}
+
+bool EpollServer::listen(uint16_t port, const std::string &ip) {
+    if (this->contexts.empty()) {
+        return false;
+    }
+    bool reuse_port = this->contexts.size() > 1;
+    for (const EpollContextPtr &context: this->contexts) {
+        if (context->listen_fd >= 0) {
+            return false;
+        }
+        evutil_socket_t fd = listen_socket(ip, port, reuse_port);
+        if (fd < 0) {
+            return false;
+        }
+        if (context->ring) {
+            context->listen_fd = fd;
+            context->arm_accept();
+            continue;
+        }
+        ::epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            evutil_closesocket(fd);
+            return false;
+        }
+        context->listen_fd = fd;
+    }
+    return true;
+}
+
+void EpollServer::close() {
+    for (const EpollContextPtr &context: this->contexts) {
+        context->close();
+    }
+}
+
+bool EpollServer::shutdown(uint64_t timeout) {
+    size_t expected = 0;
+    if (this->contexts.empty() ||
+        !this->draining.compare_exchange_strong(expected,
+                                                this->contexts.size())) {
+        return false;
+    }
+    for (const EpollContextPtr &context: this->contexts) {
+        EpollContextPtr c = context;
+        if (!c->loop->post([c, timeout]() {c->drain(timeout);})) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void EpollServer::set_timeout(uint64_t timeout) {
+    this->timeout = timeout;
+}
+
+void EpollServer::set_max_body_size(size_t size) {
+    this->max_body_size = size;
+}
+
+void EpollServer::set_spill_threshold(size_t size, const std::string &directory) {
+    this->spill_threshold = size;
+    this->spill_directory = directory;
+}
+
+void EpollServer::set_compression(size_t min_size, int level) {
+    this->compression.min_size = min_size;
+    this->compression.level = level;
+}
+
+void EpollServer::set_auto_etag(bool enabled) {
+    this->auto_etag = enabled;
+}
+
+void EpollServer::set_streaming_checker(const StreamingChecker &checker) {
+    this->streaming_checker = checker;
+}
+
+void EpollServer::set_worker_pool(WorkerPool *workers) {
+    this->workers = workers;
+}
+
+IOBackend EpollServer::get_backend() const {
+    if (this->contexts.empty()) {
+        return this->backend;
+    }
+    return this->contexts[0]->ring ? IOBackend::IOUring : IOBackend::Epoll;
+}
+
+bool EpollServer::event_add_handler(event_base *base) {
+    if (!base) {
+        return false;
+    }
+    IOLoop *loop = nullptr;
+    for (IOLoop *l: IOLoop::get_instance().get_loops()) {
+        if (l->get_base() == base) {
+            loop = l;
+        }
+    }
+    if (!loop) {
+        return false;
+    }
+    EpollContextPtr context(new EpollContext(this, loop));
+    if (!context->initialize()) {
+        return false;
+    }
+    this->contexts.push_back(context);
+    return true;
+}
+}
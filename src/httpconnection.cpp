@@ -2,20 +2,23 @@
 #include <time.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
 #include <malloc.h>
+#include <unistd.h>
 #include <sys/queue.h>
 #include <string>
-#include <algorithm>
-#include <sstream>
 #include <vector>
 #include <tuple>
 #include <map>
 #include <functional>
+#include <random>
 #include <event2/event.h>
 #include <event2/buffer.h>
 #include <event2/http.h>
 #include <event2/keyvalq_struct.h>
 #include "recycled/httpconnection.h"
+#include "recycled/multipart.h"
+#include "recycled/conditional.h"
 
 using namespace recycled;
 
@@ -38,191 +41,447 @@ bool evkeyvalq_to_map(evkeyvalq *src, T &dest) {
     return true;
 }
 
-bool parse_cookie(const std::string &str, SSMap &dest) {
-    SSMap cookies;
-    std::ostringstream key_buf, value_buf;
-    int state = 1;
-    for (size_t i = 0; i <= str.length(); ++i) {
-        char ch = str[i];
-        switch (state) {
-            case 1:
-                switch (ch) {
-                    case '=':
-                        state = 2;
-                        break;
-                    case '\0':
-                    case ';':
-                        return false;
-                    default:
-                        key_buf << ch;
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+static StringView decode_urlencoded(const char *data, size_t size,
+                                    Arena &arena) {
+    // 大部分参数不需要解码, 直接指向原来的数据
+    size_t i = 0;
+    while (i < size && data[i] != '+' && data[i] != '%') {
+        ++i;
+    }
+    if (i == size) {
+        return StringView(data, size);
+    }
+    char *result = (char *)arena.allocate(size, 1);
+    memcpy(result, data, i);
+    size_t length = i;
+    for (; i < size; ++i) {
+        char ch = data[i];
+        if (ch == '+') {
+            result[length++] = ' ';
+        } else if (ch == '%' && i + 2 < size &&
+                   hex_value(data[i + 1]) >= 0 && hex_value(data[i + 2]) >= 0) {
+            result[length++] = (char)(hex_value(data[i + 1]) * 16 +
+                                      hex_value(data[i + 2]));
+            i += 2;
+        } else {
+            result[length++] = ch;
+        }
+    }
+    return StringView(result, length);
+}
+
+bool parse_urlencoded(const char *data, size_t size, ViewMultiMap &dest) {
+    Arena &arena = *dest.get_allocator().get_arena();
+    const char *end = data + size;
+    while (data < end) {
+        const char *pair_end = (const char *)memchr(data, '&', end - data);
+        if (!pair_end) {
+            pair_end = end;
+        }
+        if (pair_end != data) {
+            const char *eq = (const char *)memchr(data, '=', pair_end - data);
+            const char *key_end = eq ? eq : pair_end;
+            const char *value = eq ? eq + 1 : pair_end;
+            if (key_end != data) {
+                StringView key = decode_urlencoded(data, key_end - data, arena);
+                dest.insert(std::make_pair(key,
+                    decode_urlencoded(value, pair_end - value, arena)));
+            }
+        }
+        data = pair_end + 1;
+    }
+    return true;
+}
+
+static bool is_cookie_space(char ch) {
+    return ch == ' ' || ch == '\t';
+}
+
+bool parse_cookie(const StringView &str, ViewMap &dest) {
+    // 一次扫描, 键和值都直接指向请求头. 没有'='的片段被跳过, 此时返回false
+    bool ok = true;
+    const char *data = str.data();
+    const char *end = data + str.size();
+    while (data < end) {
+        const char *pair_end = (const char *)memchr(data, ';', end - data);
+        if (!pair_end) {
+            pair_end = end;
+        }
+        while (data < pair_end && is_cookie_space(*data)) {
+            ++data;
+        }
+        if (data != pair_end) {
+            const char *eq = (const char *)memchr(data, '=', pair_end - data);
+            if (eq && eq != data) {
+                const char *key_end = eq;
+                while (is_cookie_space(key_end[-1])) {
+                    --key_end;
                 }
-                break;
-            case 2:
-                switch (ch) {
-                    case ';':
-                        state = 3;
-                        break;
-                    case '=':
-                        return false;
-                    case '\0': {
-                        const std::string &key = key_buf.str();
-                        const std::string &value = value_buf.str();
-                        cookies.insert(std::make_pair(key, value));
-                        state = 1;
-                    }
-                    default:
-                        value_buf << ch;
+                // 值中可以有'=', 如base64的填充
+                const char *value = eq + 1;
+                const char *value_end = pair_end;
+                while (value < value_end && is_cookie_space(*value)) {
+                    ++value;
                 }
-                break;
-            case 3:
-                switch (ch) {
-                    case ' ':
-                        break;
-                    case '=':
-                    case ';':
-                        return false;
-                    default: {
-                        const std::string &key = key_buf.str();
-                        const std::string &value = value_buf.str();
-                        cookies.insert(std::make_pair(key, value));
-                        key_buf.str("");
-                        value_buf.str("");
-                        key_buf << ch;
-                        state = 1;
-                    }
+                while (value_end > value && is_cookie_space(value_end[-1])) {
+                    --value_end;
                 }
+                dest.insert(std::make_pair(StringView(data, key_end - data),
+                                           StringView(value, value_end - value)));
+            } else {
+                ok = false;
+            }
         }
+        data = pair_end + 1;
     }
-    dest = cookies;
-    return true;
+    return ok;
 }
 
-std::string make_cookie_header(const std::string &key, const CookieInfo &info) {
+void append_cookie_header(std::string &header, const std::string &key,
+                          const CookieInfo &info, IOLoop *loop) {
     const std::string &value = std::get<0>(info);
     bool secure = std::get<1>(info);
     time_t expires = std::get<2>(info);
     const std::string &domain = std::get<3>(info);
     const std::string &path = std::get<4>(info);
     bool http_only = std::get<5>(info);
-    const int BufferSize = 128;
-    char expires_buf[BufferSize];
-    std::ostringstream header;
-    header << key << "=" << value;
+    header.append(key).append(1, '=').append(value);
     if (!domain.empty()) {
-        header << "; " << "Domain=" << domain;
+        header.append("; Domain=").append(domain);
     }
     if (!path.empty()) {
-        header << "; " << "Path=" << path;
+        header.append("; Path=").append(path);
     }
-    time_t now = time(NULL);
-    time_t expires_stamp = now + expires;
-    tm *expires_time = gmtime(&expires_stamp);
-    strftime(expires_buf, BufferSize, "%a, %d-%b-%Y %H:%M:%S GMT", expires_time);
-    header << "; Expires=" << expires_buf;
+    header.append("; Expires=").append(loop->get_cookie_date(expires));
     if (secure) {
-        header << "; Secure";
+        header.append("; Secure");
     }
     if (http_only) {
-        header << "; HttpOnly";
+        header.append("; HttpOnly");
     }
-    return header.str();
 }
 
 HTTPConnection::HTTPConnection(evhttp_request *evreq):
-    evreq(evreq), input_body(nullptr), input_body_size(0),
-    output_buffer(nullptr), output_headers(nullptr),
-    finished(false), chunked(false) {}
+    evreq(evreq), loop(IOLoop::current()), input_buffer(nullptr),
+    input_body(nullptr), input_body_size(0), spool(nullptr),
+    output_buffer(nullptr), file_flags(0), compression(nullptr),
+    compressor(nullptr), compressed_buffer(nullptr), compression_decided(false),
+    file_written(false), auto_etag(false),
+    output_headers(nullptr), parsed(0),
+    query_arguments(std::less<StringView>(),
+                    ArenaAllocator<ViewPair>(&this->arena)),
+    body_arguments(std::less<StringView>(),
+                   ArenaAllocator<ViewPair>(&this->arena)),
+    cookie_views(std::less<StringView>(), ArenaAllocator<ViewPair>(&this->arena)),
+    files(std::less<StringView>(), FileMap::allocator_type(&this->arena)),
+    status_code(200), status_reason("OK"),
+    finished(false), chunked(false), deferred(false), receiving_body(false) {
+    TAILQ_INIT(&this->raw_headers);
+    TAILQ_INIT(&this->response_headers);
+}
 
 HTTPConnection::~HTTPConnection() {
+    if (!this->finished && this->output_buffer) {
+        this->finished = true;
+        this->send_reply();
+    }
+    if (this->compressor) {
+        Compressor::release(this->compressor);
+    }
+    if (this->compressed_buffer) {
+        evbuffer_free(this->compressed_buffer);
+    }
     if (this->output_buffer) {
         evbuffer_free(this->output_buffer);
     }
-    if (this->output_headers) {
-        evhttp_clear_headers(this->output_headers);
-    }
-    if (this->input_body) {
-        delete this->input_body;
+    if (this->input_buffer) {
+        evbuffer_free(this->input_buffer);
     }
+    delete this->spool;
+    evhttp_clear_headers(&this->raw_headers);
+    evhttp_clear_headers(&this->response_headers);
 }
 
 bool HTTPConnection::initialize() {
     if (!this->evreq) {
         return false;
     }
-    this->output_buffer = evbuffer_new();
     if (!this->output_buffer) {
-        return false;
+        this->output_buffer = evbuffer_new();
+        if (!this->output_buffer) {
+            return false;
+        }
     }
     evbuffer *input_buffer = evhttp_request_get_input_buffer(this->evreq);
-    evkeyvalq *input_headers_ev = evhttp_request_get_input_headers(this->evreq);
-    if (!evkeyvalq_to_map(input_headers_ev, this->input_headers)) {
-        return false;
+    // 只移动链表, 第一次访问时再建立索引, 发送响应前交还给evhttp
+    TAILQ_CONCAT(&this->raw_headers, evhttp_request_get_input_headers(this->evreq),
+                 next);
+    this->output_headers = &this->response_headers;
+    auto it = Methods.find(evhttp_request_get_command(this->evreq));
+    if (it != Methods.end()) {
+        this->method = it->second;
+    } else {
+        this->method = HTTPMethod::Other;
     }
-    evhttp_clear_headers(input_headers_ev);
-    this->output_headers = evhttp_request_get_output_headers(this->evreq);
-    const char *uri = evhttp_request_get_uri(this->evreq);
-    evhttp_uri *decoded = evhttp_uri_parse(uri);
-    if (!decoded) {
+    return this->parse_request(evhttp_request_get_uri(this->evreq), input_buffer);
+}
+
+void HTTPConnection::reset() {
+    if (!this->finished && this->output_buffer) {
+        this->finished = true;
+        this->send_reply();
+    }
+    // 先清空容器, 它们的节点分配在arena中
+    this->input_headers.clear();
+    for (StringView &value: this->known_headers) {
+        value = StringView();
+    }
+    this->other_headers.clear();
+    this->query_arguments.clear();
+    this->body_arguments.clear();
+    this->path_arguments.clear();
+    this->cookie_views.clear();
+    this->input_cookies.clear();
+    this->files.clear();
+    this->output_cookies.clear();
+    this->arena.reset();
+    delete this->spool;
+    this->spool = nullptr;
+    evhttp_clear_headers(&this->raw_headers);
+    evhttp_clear_headers(&this->response_headers);
+    if (this->input_buffer) {
+        evbuffer_drain(this->input_buffer,
+                       evbuffer_get_length(this->input_buffer));
+    }
+    if (this->output_buffer) {
+        evbuffer_drain(this->output_buffer,
+                       evbuffer_get_length(this->output_buffer));
+    }
+    this->evreq = nullptr;
+    this->error_handler = nullptr;
+    this->uri.clear();
+    this->path.clear();
+    this->query = StringView();
+    this->input_body = nullptr;
+    this->input_body_size = 0;
+    this->output_headers = nullptr;
+    this->parsed = 0;
+    this->status_code = 200;
+    this->status_reason = "OK";
+    this->chunked = false;
+    this->deferred = false;
+    this->receiving_body = false;
+    this->body_data_handler = nullptr;
+    this->body_end_handler = nullptr;
+    if (this->compressor) {
+        Compressor::release(this->compressor);
+        this->compressor = nullptr;
+    }
+    this->compression_decided = false;
+    this->file_written = false;
+}
+
+void HTTPConnection::set_request(evhttp_request *evreq) {
+    this->evreq = evreq;
+    this->loop = IOLoop::current();
+    this->finished = false;
+}
+
+void HTTPConnection::set_compression(const CompressionOptions *options) {
+    this->compression = options;
+}
+
+void HTTPConnection::set_auto_etag(bool enabled) {
+    this->auto_etag = enabled;
+}
+
+bool HTTPConnection::write(const char *data, size_t size) {
+    if (!this->output_buffer || this->finished) {
         return false;
     }
-    const char *path = evhttp_uri_get_path(decoded);
-    if (!path) {
-        if (decoded) {
-            evhttp_uri_free(decoded);
-        }
+    if (evbuffer_add(this->output_buffer, data, size) != 0) {
         return false;
     }
-    const char *decoded_path = evhttp_uridecode(path, 1, NULL);
-    if (!decoded_path) {
-        if (decoded) {
-            evhttp_uri_free(decoded);
-        }
+    return true;
+}
+
+bool HTTPConnection::write(const std::string &str) {
+    return this->write(str.c_str(), str.length());
+}
+
+static void release_reference(const void *data, size_t size, void *extra) {
+    std::function<void ()> *release = (std::function<void ()> *)extra;
+    (*release)();
+    delete release;
+}
+
+bool HTTPConnection::write_reference(const char *data, size_t size,
+                                     const std::function<void ()> &release) {
+    if (!this->output_buffer || this->finished) {
         return false;
     }
-    this->path = decoded_path;
-    const char *query_str = evhttp_uri_get_query(decoded);
-    if (query_str) {
-        evkeyvalq arguments_ev;
-        if (evhttp_parse_query_str(query_str, &arguments_ev) == 0) {
-            evkeyvalq_to_map(&arguments_ev, this->query_arguments);
-            evhttp_clear_headers(&arguments_ev);
+    if (!size) {
+        if (release) {
+            release();
         }
+        return true;
     }
-    if (decoded) {
-        evhttp_uri_free(decoded);
+    if (!release) {
+        return evbuffer_add_reference(this->output_buffer, data, size,
+                                      NULL, NULL) == 0;
     }
-    size_t body_length = evbuffer_get_length(input_buffer);
-    this->input_body_size = body_length;
-    if (body_length) {
-        this->input_body = new char[body_length + 1];
-        memcpy(this->input_body, evbuffer_pullup(input_buffer, body_length),
-               body_length);
-        this->parse_input_body();
-    }
-    const std::string &cookie_header = this->get_header("Cookie");
-    parse_cookie(cookie_header, this->input_cookies);
-    this->set_status(200);
-    auto it = Methods.find(evhttp_request_get_command(this->evreq));
-    if (it != Methods.end()) {
-        this->method = it->second;
-    } else {
-        this->method = HTTPMethod::Other;
+    std::function<void ()> *callback = new std::function<void ()>(release);
+    if (evbuffer_add_reference(this->output_buffer, data, size,
+                               release_reference, callback) != 0) {
+        delete callback;
+        return false;
     }
     return true;
 }
 
-bool HTTPConnection::write(const char *data, size_t size) {
-    if (!this->output_buffer) {
+static void release_shared(const void *data, size_t size, void *extra) {
+    delete (SharedBuffer *)extra;
+}
+
+bool HTTPConnection::write_shared(const SharedBuffer &data) {
+    if (!this->output_buffer || this->finished || !data) {
         return false;
     }
-    if (evbuffer_add(this->output_buffer, data, size) != 0) {
+    if (data->empty()) {
+        return true;
+    }
+    SharedBuffer *holder = new SharedBuffer(data);
+    if (evbuffer_add_reference(this->output_buffer, data->data(), data->length(),
+                               release_shared, holder) != 0) {
+        delete holder;
         return false;
     }
     return true;
 }
 
-bool HTTPConnection::write(const std::string &str) {
-    return this->write(str.c_str(), str.length());
+static std::string make_boundary() {
+    static thread_local std::mt19937_64 generator(std::random_device{}());
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "%016llx",
+             (unsigned long long)generator());
+    return boundary;
+}
+
+static void close_segment(const evbuffer_file_segment *segment, int flags,
+                          void *arg) {
+    close((int)(intptr_t)arg);
+}
+
+bool HTTPConnection::write_file(int fd, off_t offset, off_t length) {
+    if (!this->output_buffer || this->finished) {
+        close(fd);
+        return false;
+    }
+    int flags = this->file_flags;
+    if (this->chunked && this->compression) {
+        // 已经开始发送的分块响应可能正在压缩, 文件段需要在内存中
+        flags |= EVBUF_FS_DISABLE_SENDFILE;
+    }
+    evbuffer_file_segment *segment =
+        evbuffer_file_segment_new(fd, offset, length, flags);
+    if (!segment) {
+        close(fd);
+        return false;
+    }
+    // 文件段在最后一个引用释放时关闭文件
+    evbuffer_file_segment_add_cleanup_cb(segment, close_segment,
+                                         (void *)(intptr_t)fd);
+    bool ok = evbuffer_add_file_segment(this->output_buffer, segment, 0, -1) == 0;
+    evbuffer_file_segment_free(segment);
+    this->file_written = true;
+    return ok;
+}
+
+bool HTTPConnection::write_ranges(uint64_t size, const RangeWriter &writer) {
+    if (!this->output_buffer || this->finished || this->chunked) {
+        return false;
+    }
+    std::vector<ByteRange> ranges;
+    int rc = 0;
+    StringView range = this->get_header_view(HTTPHeader::Range);
+    // HEAD的响应头与相同的GET一致
+    bool head = this->method == HTTPMethod::HEAD;
+    if (!range.empty() && (this->method == HTTPMethod::GET || head) &&
+        this->status_code == 200) {
+        StringView if_range = this->get_header_view(HTTPHeader::IfRange);
+        if (if_range.empty() ||
+            if_range_matches(if_range,
+                             evhttp_find_header(this->output_headers, "ETag"),
+                             evhttp_find_header(this->output_headers,
+                                                "Last-Modified"))) {
+            rc = parse_range(range, size, ranges);
+        }
+    }
+    this->add_header("Accept-Ranges", "bytes");
+    std::string total = std::to_string(size);
+    if (rc < 0) {
+        this->add_header("Content-Range", "bytes */" + total);
+        return this->set_status(416);
+    }
+    if (!rc) {
+        this->add_header("Content-Length", total);
+        return head || !size || writer(0, size);
+    }
+    this->set_status(206);
+    if (ranges.size() == 1) {
+        const ByteRange &r = ranges[0];
+        this->add_header("Content-Range", "bytes " + std::to_string(r.first) +
+                         '-' + std::to_string(r.last) + '/' + total);
+        this->add_header("Content-Length", std::to_string(r.last - r.first + 1));
+        return head || writer(r.first, r.last - r.first + 1);
+    }
+    // 多个范围以multipart/byteranges输出, 先生成各部分的头以计算总长度
+    const char *content_type = evhttp_find_header(this->output_headers,
+                                                  "Content-Type");
+    std::string boundary = make_boundary();
+    std::vector<std::string> part_headers;
+    uint64_t length = 0;
+    for (const ByteRange &r: ranges) {
+        std::string part = "\r\n--" + boundary + "\r\n";
+        if (content_type) {
+            part += "Content-Type: ";
+            part += content_type;
+            part += "\r\n";
+        }
+        part += "Content-Range: bytes " + std::to_string(r.first) + '-' +
+                std::to_string(r.last) + '/' + total + "\r\n\r\n";
+        length += part.size() + (r.last - r.first + 1);
+        part_headers.push_back(std::move(part));
+    }
+    std::string tail = "\r\n--" + boundary + "--\r\n";
+    length += tail.size();
+    this->remove_header("Content-Type");
+    this->add_header("Content-Type", "multipart/byteranges; boundary=" + boundary);
+    this->add_header("Content-Length", std::to_string(length));
+    if (head) {
+        return true;
+    }
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        const ByteRange &r = ranges[i];
+        if (!this->write(part_headers[i]) ||
+            !writer(r.first, r.last - r.first + 1)) {
+            return false;
+        }
+    }
+    return this->write(tail);
 }
 
 bool HTTPConnection::set_status(int status_code, const std::string &reason) {
@@ -248,6 +507,10 @@ HTTPMethod HTTPConnection::get_method() const {
 }
 
 const char * HTTPConnection::get_body() const {
+    if (!this->input_body && this->input_buffer) {
+        this->input_body =
+            (const char *)evbuffer_pullup(this->input_buffer, -1);
+    }
     return this->input_body;
 }
 
@@ -255,8 +518,21 @@ size_t HTTPConnection::get_body_size() const {
     return this->input_body_size;
 }
 
+std::string HTTPConnection::copy_body() const {
+    if (!this->input_buffer || !evbuffer_get_length(this->input_buffer)) {
+        // 请求体在临时文件中时已经映射到内存
+        return this->input_body ?
+               std::string(this->input_body, this->input_body_size) :
+               std::string();
+    }
+    std::string body(this->input_body_size, '\0');
+    evbuffer_copyout(this->input_buffer, &body[0], this->input_body_size);
+    return body;
+}
+
 const UploadFile * HTTPConnection::get_file(const std::string &name) const {
-    auto it = this->files.find(name);
+    this->parse_body();
+    auto it = this->files.find(StringView(name));
     if (it != this->files.end()) {
         return &it->second;
     } else {
@@ -273,93 +549,49 @@ std::string HTTPConnection::get_uri() const {
 }
 
 std::string HTTPConnection::get_query_argument(const std::string &key) const {
-    size_t count = this->query_arguments.count(key);
-    if (!count) {
-        return "";
-    }
-    auto it = this->query_arguments.find(key);
-    for (size_t i = 0; i < (count - 1); ++i, ++it);
-    return it->second;
+    return this->get_query_argument_view(key).str();
 }
 
 std::string HTTPConnection::get_body_argument(const std::string &key) const {
-    size_t count = this->body_arguments.count(key);
-    if (!count) {
-        return "";
-    }
-    auto it = this->body_arguments.find(key);
-    for (size_t i = 0; i < (count - 1); ++i, ++it);
-    return it->second;
+    return this->get_body_argument_view(key).str();
 }
 
 std::string HTTPConnection::get_argument(const std::string &key) const {
-    const std::string &query_argument = this->get_query_argument(key);
-    if (!query_argument.empty()) {
-        return query_argument;
-    }
-    const std::string &body_argument = this->get_body_argument(key);
-    if (!body_argument.empty()) {
-        return body_argument;
-    }
-    return "";
+    return this->get_argument_view(key).str();
 }
 
 std::string HTTPConnection::get_path_argument(const std::string &key) const {
-    auto it = this->path_arguments.find(key);
-    if (it != this->path_arguments.end()) {
-        return it->second;
-    } else {
-        return "";
-    }
+    return this->get_path_argument_view(key).str();
 }
 
 std::string HTTPConnection::get_header(const std::string &key) const {
-    auto it = this->input_headers.find(key);
-    if (it != this->input_headers.end()) {
-        return it->second;
-    } else {
-        return "";
-    }
+    return this->get_header_view(key).str();
 }
 
 std::string HTTPConnection::get_cookie(const std::string &key) const {
-    auto it = this->input_cookies.find(key);
-    if (it != this->input_cookies.end()) {
-        return it->second;
-    } else {
-        return "";
-    }
+    return this->get_cookie_view(key).str();
 }
 
 SVector HTTPConnection::get_query_arguments(const std::string &key) const {
     SVector arguments;
-    auto begin = this->query_arguments.lower_bound(key);
-    auto end = this->query_arguments.upper_bound(key);
-    for (auto it = begin; it != end; ++it) {
-        arguments.push_back(it->second);
+    for (StringView value: this->get_query_arguments_view(key)) {
+        arguments.push_back(value.str());
     }
     return arguments;
 }
 
 SVector HTTPConnection::get_body_arguments(const std::string &key) const {
     SVector arguments;
-    auto begin = this->body_arguments.lower_bound(key);
-    auto end = this->body_arguments.upper_bound(key);
-    for (auto it = begin; it != end; ++it) {
-        arguments.push_back(it->second);
+    for (StringView value: this->get_body_arguments_view(key)) {
+        arguments.push_back(value.str());
     }
     return arguments;
 }
 
 SVector HTTPConnection::get_arguments(const std::string &key) const {
-    const SVector &query_arguments = this->get_query_arguments(key);
-    const SVector &body_arguments = this->get_body_arguments(key);
     SVector arguments;
-    for (const std::string &s: query_arguments) {
-        arguments.push_back(s);
-    }
-    for (const std::string &s: body_arguments) {
-        arguments.push_back(s);
+    for (StringView value: this->get_arguments_view(key)) {
+        arguments.push_back(value.str());
     }
     return arguments;
 }
@@ -369,10 +601,22 @@ const SSMap & HTTPConnection::get_path_arguments() const {
 }
 
 const SSMap & HTTPConnection::get_headers() const {
+    if (!(this->parsed & HeaderMap)) {
+        this->parsed |= HeaderMap;
+        evkeyvalq_to_map(&this->raw_headers, this->input_headers);
+    }
     return this->input_headers;
 }
 
 const SSMap & HTTPConnection::get_cookies() const {
+    this->parse_cookies();
+    if (!(this->parsed & CookieMap)) {
+        this->parsed |= CookieMap;
+        for (const ViewPair &cookie: this->cookie_views) {
+            this->input_cookies.insert(std::make_pair(cookie.first.str(),
+                                                      cookie.second.str()));
+        }
+    }
     return this->input_cookies;
 }
 
@@ -380,6 +624,202 @@ SSMap & HTTPConnection::get_path_arguments() {
     return this->path_arguments;
 }
 
+template<typename T>
+static StringView find_value(const T &map, const std::string &key) {
+    auto it = map.find(key);
+    if (it == map.end()) {
+        return StringView();
+    }
+    return it->second;
+}
+
+static StringView find_last_value(const ViewMultiMap &map,
+                                  const std::string &key) {
+    auto it = map.upper_bound(key);
+    if (it == map.begin() || (--it)->first != StringView(key)) {
+        return StringView();
+    }
+    return it->second;
+}
+
+StringView HTTPConnection::get_path_view() const {
+    return this->path;
+}
+
+StringView HTTPConnection::get_uri_view() const {
+    return this->uri;
+}
+
+StringView HTTPConnection::get_query_argument_view(const std::string &key) const {
+    this->parse_query();
+    return find_last_value(this->query_arguments, key);
+}
+
+StringView HTTPConnection::get_body_argument_view(const std::string &key) const {
+    this->parse_body();
+    return find_last_value(this->body_arguments, key);
+}
+
+StringView HTTPConnection::get_argument_view(const std::string &key) const {
+    StringView value = this->get_query_argument_view(key);
+    if (!value.empty()) {
+        return value;
+    }
+    return this->get_body_argument_view(key);
+}
+
+StringView HTTPConnection::get_path_argument_view(const std::string &key) const {
+    return find_value(this->path_arguments, key);
+}
+
+// 按HTTPHeader的顺序排列
+static const StringView KnownHeaderNames[] = {
+    "Host", "Connection", "Content-Type", "Content-Length", "Transfer-Encoding",
+    "Cookie", "Accept", "Accept-Encoding", "Accept-Language", "User-Agent",
+    "Referer", "Origin", "Authorization", "If-None-Match", "If-Modified-Since",
+    "If-Match", "If-Unmodified-Since", "If-Range", "Range", "Expect"
+};
+
+static char lower_at(const StringView &name, size_t i) {
+    char c = name[i];
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+HTTPHeader recycled::find_known_header(const StringView &name) {
+    // 先按长度和一个能区分同长度名字的字符选出候选, 再比较一次
+    HTTPHeader header = HTTPHeader::Other;
+    switch (name.size()) {
+    case 4:
+        header = HTTPHeader::Host;
+        break;
+    case 5:
+        header = HTTPHeader::Range;
+        break;
+    case 6:
+        switch (lower_at(name, 0)) {
+        case 'c': header = HTTPHeader::Cookie; break;
+        case 'a': header = HTTPHeader::Accept; break;
+        case 'o': header = HTTPHeader::Origin; break;
+        case 'e': header = HTTPHeader::Expect; break;
+        }
+        break;
+    case 7:
+        header = HTTPHeader::Referer;
+        break;
+    case 8:
+        switch (lower_at(name, 3)) {
+        case 'm': header = HTTPHeader::IfMatch; break;
+        case 'r': header = HTTPHeader::IfRange; break;
+        }
+        break;
+    case 10:
+        switch (lower_at(name, 0)) {
+        case 'c': header = HTTPHeader::Connection; break;
+        case 'u': header = HTTPHeader::UserAgent; break;
+        }
+        break;
+    case 12:
+        header = HTTPHeader::ContentType;
+        break;
+    case 13:
+        switch (lower_at(name, 0)) {
+        case 'a': header = HTTPHeader::Authorization; break;
+        case 'i': header = HTTPHeader::IfNoneMatch; break;
+        }
+        break;
+    case 14:
+        header = HTTPHeader::ContentLength;
+        break;
+    case 15:
+        switch (lower_at(name, 7)) {
+        case 'e': header = HTTPHeader::AcceptEncoding; break;
+        case 'l': header = HTTPHeader::AcceptLanguage; break;
+        }
+        break;
+    case 17:
+        switch (lower_at(name, 0)) {
+        case 't': header = HTTPHeader::TransferEncoding; break;
+        case 'i': header = HTTPHeader::IfModifiedSince; break;
+        }
+        break;
+    case 19:
+        header = HTTPHeader::IfUnmodifiedSince;
+        break;
+    }
+    if (header == HTTPHeader::Other ||
+        !equals_ignore_case(KnownHeaderNames[(size_t)header], name)) {
+        return HTTPHeader::Other;
+    }
+    return header;
+}
+
+StringView recycled::header_separator(HTTPHeader header) {
+    switch (header) {
+    case HTTPHeader::Cookie:
+        // RFC 6265 5.4
+        return "; ";
+    case HTTPHeader::Connection:
+    case HTTPHeader::TransferEncoding:
+    case HTTPHeader::Accept:
+    case HTTPHeader::AcceptEncoding:
+    case HTTPHeader::AcceptLanguage:
+    case HTTPHeader::IfNoneMatch:
+    case HTTPHeader::IfMatch:
+    case HTTPHeader::Expect:
+        // RFC 7230 3.2.2
+        return ", ";
+    default:
+        return StringView();
+    }
+}
+
+StringView HTTPConnection::get_header_view(const std::string &key) const {
+    HTTPHeader header = find_known_header(key);
+    if (header != HTTPHeader::Other) {
+        return this->get_header_view(header);
+    }
+    this->parse_headers();
+    for (const auto &other: this->other_headers) {
+        if (equals_ignore_case(other.first, key)) {
+            return other.second;
+        }
+    }
+    return StringView();
+}
+
+StringView HTTPConnection::get_header_view(HTTPHeader header) const {
+    if (header == HTTPHeader::Other) {
+        return StringView();
+    }
+    this->parse_headers();
+    return this->known_headers[(size_t)header];
+}
+
+StringView HTTPConnection::get_cookie_view(const std::string &key) const {
+    this->parse_cookies();
+    return find_value(this->cookie_views, key);
+}
+
+ArgumentRange HTTPConnection::get_query_arguments_view(const std::string &key) const {
+    this->parse_query();
+    auto range = this->query_arguments.equal_range(StringView(key));
+    return ArgumentRange(range.first, range.second);
+}
+
+ArgumentRange HTTPConnection::get_body_arguments_view(const std::string &key) const {
+    this->parse_body();
+    auto range = this->body_arguments.equal_range(StringView(key));
+    return ArgumentRange(range.first, range.second);
+}
+
+ArgumentRange HTTPConnection::get_arguments_view(const std::string &key) const {
+    this->parse_query();
+    this->parse_body();
+    auto query = this->query_arguments.equal_range(StringView(key));
+    auto body = this->body_arguments.equal_range(StringView(key));
+    return ArgumentRange(query.first, query.second, body.first, body.second);
+}
+
 bool HTTPConnection::set_error_handler(const ErrorHandler &handler) {
     if (!handler) {
         return false;
@@ -460,17 +900,21 @@ bool HTTPConnection::flush() {
     if (this->finished || !this->output_buffer) {
         return false;
     }
-    if (!this->chunked) {
-        for (auto &p: this->output_cookies) {
-            this->add_header("Set-Cookie", make_cookie_header(p.first, p.second));
-        }
-        evhttp_send_reply_start(this->evreq, this->status_code,
-                                this->status_reason.c_str());
-        this->chunked = true;
+    bool start = !this->chunked;
+    this->chunked = true;
+    if (!this->loop || IOLoop::current() == this->loop) {
+        this->send_chunk(start, this->output_buffer);
+        return true;
     }
-    evhttp_send_reply_chunk(this->evreq, this->output_buffer);
-    size_t length = evbuffer_get_length(this->output_buffer);
-    evbuffer_drain(this->output_buffer, length);
+    evbuffer *chunk = evbuffer_new();
+    if (!chunk) {
+        return false;
+    }
+    evbuffer_add_buffer(chunk, this->output_buffer);
+    this->run_in_loop([this, start, chunk]() {
+        this->send_chunk(start, chunk);
+        evbuffer_free(chunk);
+    });
     return true;
 }
 
@@ -483,26 +927,11 @@ bool HTTPConnection::send_error(int status) {
 }
 
 void HTTPConnection::finish() {
-    if (this->finished) {
+    if (this->finished || !this->output_buffer) {
         return;
     }
-    if (!this->chunked) {
-        if (!this->output_buffer) {
-            return;
-        }
-        for (auto &p: this->output_cookies) {
-            this->add_header("Set-Cookie", make_cookie_header(p.first, p.second));
-        }
-        evhttp_send_reply(this->evreq, this->status_code,
-                        this->status_reason.c_str(), this->output_buffer);
-    } else {
-        size_t length = evbuffer_get_length(this->output_buffer);
-        if (length) {
-            evhttp_send_reply_chunk(this->evreq, this->output_buffer);
-        }
-        evhttp_send_reply_end(this->evreq);
-    }
-    finished = true;
+    this->finished = true;
+    this->run_in_loop(std::bind(&HTTPConnection::send_reply, this));
 }
 
 bool HTTPConnection::redirect(const std::string &key, int status) {
@@ -521,131 +950,544 @@ bool HTTPConnection::redirect(const std::string &key, int status) {
     return true;
 }
 
+bool HTTPConnection::check_not_modified(const std::string &etag,
+                                        time_t last_modified) {
+    if (this->finished || this->chunked) {
+        return false;
+    }
+    std::string tag;
+    if (!etag.empty()) {
+        tag = etag;
+        if (etag[0] != '"' && etag.compare(0, 2, "W/") != 0) {
+            tag = '"' + etag + '"';
+        }
+        this->add_header("ETag", tag);
+    }
+    if (last_modified) {
+        this->add_header("Last-Modified", format_http_date(last_modified));
+    }
+    if (!this->is_not_modified(tag, last_modified ? last_modified : -1)) {
+        return false;
+    }
+    return this->set_status(304);
+}
+
 bool HTTPConnection::is_finished() const {
     return this->finished;
 }
 
-void HTTPConnection::parse_input_body() {
-    if (!this->input_body) {
+ConnectionPtr HTTPConnection::defer() {
+    this->deferred = true;
+    return this->shared_from_this();
+}
+
+bool HTTPConnection::is_deferred() const {
+    return this->deferred;
+}
+
+bool HTTPConnection::set_body_handler(const BodyDataHandler &on_data,
+                                      const BodyEndHandler &on_end) {
+    if (!on_data || !on_end || this->body_data_handler) {
+        return false;
+    }
+    this->deferred = true;
+    if (this->receiving_body) {
+        this->body_data_handler = on_data;
+        this->body_end_handler = on_end;
+        if (this->input_buffer) {
+            this->input_body = nullptr;
+            this->input_body_size = 0;
+            this->receive_body(this->input_buffer);
+        }
+        return true;
+    }
+    // 请求体已经完整接收
+    const char *body = this->get_body();
+    if (body && this->input_body_size) {
+        on_data(body, this->input_body_size);
+    }
+    on_end();
+    return true;
+}
+
+void HTTPConnection::pause_body() {}
+
+void HTTPConnection::resume_body() {}
+
+void HTTPConnection::begin_body() {
+    this->receiving_body = true;
+}
+
+void HTTPConnection::receive_body(evbuffer *data) {
+    if (!this->body_data_handler) {
+        if (!this->input_buffer) {
+            this->input_buffer = evbuffer_new();
+        }
+        if (this->input_buffer) {
+            this->input_body = nullptr;
+            this->input_body_size += evbuffer_get_length(data);
+            evbuffer_add_buffer(this->input_buffer, data);
+        } else {
+            evbuffer_drain(data, evbuffer_get_length(data));
+        }
         return;
     }
-    const char *mpdf = "multipart/form-data";
-    const std::string &content_type = this->get_header("Content-Type");
-    if (content_type == "application/x-www-form-urlencoded") {
-        this->input_body[this->input_body_size] = '\0'; //regard body as string.
-        evkeyvalq arguments_ev;
-        if (evhttp_parse_query_str(this->input_body, &arguments_ev) == 0) {
-            evkeyvalq_to_map(&arguments_ev, this->body_arguments);
-            evhttp_clear_headers(&arguments_ev);
-        }
-    } else if (content_type.length() >= strlen(mpdf) &&
-               content_type.substr(0, strlen(mpdf)) == mpdf) {
-        size_t pos = content_type.find("boundary=");
-        if (pos == std::string::npos) {
+    // 按内存块逐段交出, 不需要把缓冲区拼成连续的内存
+    size_t length;
+    while ((length = evbuffer_get_contiguous_space(data))) {
+        const char *chunk = (const char *)evbuffer_pullup(data, length);
+        this->body_data_handler(chunk, length);
+        evbuffer_drain(data, length);
+    }
+}
+
+void HTTPConnection::end_body() {
+    this->receiving_body = false;
+    if (!this->body_end_handler) {
+        return;
+    }
+    // 回调可能持有连接的句柄, 结束后释放
+    BodyDataHandler on_data;
+    BodyEndHandler on_end;
+    on_data.swap(this->body_data_handler);
+    on_end.swap(this->body_end_handler);
+    on_end();
+}
+
+void HTTPConnection::abandon() {
+    // 处理器可能还在工作线程中运行, 这里只修改只在IOLoop线程中访问的evreq,
+    // 之后的输出只写入连接自己的缓冲区, send_reply不再发送
+    this->evreq = nullptr;
+}
+
+void HTTPConnection::run_in_loop(const std::function<void ()> &callback) {
+    if (!this->loop || IOLoop::current() == this->loop) {
+        callback();
+        return;
+    }
+    ConnectionPtr self = this->shared_from_this();
+    this->loop->post([self, callback]() {
+        callback();
+    });
+}
+
+void HTTPConnection::add_cookie_headers() {
+    for (auto &p: this->output_cookies) {
+        this->cookie_header.clear();
+        append_cookie_header(this->cookie_header, p.first, p.second, this->loop);
+        evhttp_add_header(this->output_headers, "Set-Cookie",
+                          this->cookie_header.c_str());
+    }
+}
+
+void HTTPConnection::add_date_header() {
+    // evhttp在没有Date时每个响应都格式化一次, 这里使用IOLoop缓存的日期
+    if (!evhttp_find_header(this->output_headers, "Date")) {
+        evhttp_add_header(this->output_headers, "Date",
+                          this->loop->get_http_date());
+    }
+}
+
+ContentEncoding HTTPConnection::select_encoding(evbuffer *body,
+                                                bool complete) {
+    const CompressionOptions *options = this->compression;
+    if (!options || options->min_size == SIZE_MAX || this->file_written ||
+        this->method == HTTPMethod::HEAD || this->status_code < 200 ||
+        this->status_code == 204 || this->status_code == 304) {
+        return ContentEncoding::Identity;
+    }
+    if (complete && evbuffer_get_length(body) < options->min_size) {
+        return ContentEncoding::Identity;
+    }
+    // 处理器自己编码或指定了长度的响应体原样发送
+    if (evhttp_find_header(this->output_headers, "Content-Encoding") ||
+        evhttp_find_header(this->output_headers, "Content-Length")) {
+        return ContentEncoding::Identity;
+    }
+    const char *content_type = evhttp_find_header(this->output_headers,
+                                                  "Content-Type");
+    if (content_type && !is_compressible(content_type)) {
+        return ContentEncoding::Identity;
+    }
+    evhttp_add_header(this->output_headers, "Vary", "Accept-Encoding");
+    return negotiate_encoding(this->get_header_view(HTTPHeader::AcceptEncoding));
+}
+
+bool HTTPConnection::is_not_modified(const StringView &etag,
+                                     time_t last_modified) const {
+    if (this->method != HTTPMethod::GET && this->method != HTTPMethod::HEAD) {
+        return false;
+    }
+    // 有If-None-Match时忽略If-Modified-Since
+    StringView if_none_match = this->get_header_view(HTTPHeader::IfNoneMatch);
+    if (!if_none_match.empty()) {
+        return !etag.empty() && etag_matches(if_none_match, etag);
+    }
+    StringView since = this->get_header_view(HTTPHeader::IfModifiedSince);
+    if (last_modified < 0 || since.empty()) {
+        return false;
+    }
+    time_t stamp = parse_http_date(since);
+    return stamp >= 0 && last_modified <= stamp;
+}
+
+void HTTPConnection::add_etag_header() {
+    if (!this->auto_etag || this->status_code != 200 || this->file_written ||
+        this->method != HTTPMethod::GET ||
+        evhttp_find_header(this->output_headers, "ETag")) {
+        return;
+    }
+    // 逐段计算哈希, 不把响应体复制到连续的内存中
+    size_t length = evbuffer_get_length(this->output_buffer);
+    size_t offset = 0;
+    uint64_t hash = hash_data(nullptr, 0);
+    while (offset < length) {
+        evbuffer_ptr position;
+        evbuffer_iovec vec[8];
+        if (evbuffer_ptr_set(this->output_buffer, &position, offset,
+                             EVBUFFER_PTR_SET) != 0) {
             return;
         }
-        size_t post_pos = pos + strlen("boundary=");
-        size_t boundary_length = content_type.length() - post_pos;
-        const std::string &boundary = content_type.substr(post_pos,
-                                                          boundary_length);
-        char *buf = this->input_body;
-        size_t size = this->input_body_size;
-        std::string boundary_tmp = "--" + boundary;
-        while (true) {
-            char *new_buf =
-                std::search(buf, buf + size, boundary_tmp.begin(),
-                            boundary_tmp.end());
-            if (new_buf == buf + size) {
-                break;
-            }
-            size_t chunk_size = new_buf - buf;
-            if (!chunk_size) {
-                buf += boundary_tmp.length();
-                size -= boundary_tmp.length();
-                continue;
+        int count = evbuffer_peek(this->output_buffer, -1, &position, vec, 8);
+        if (count > 8) {
+            count = 8;
+        }
+        size_t start = offset;
+        for (int i = 0; i < count; ++i) {
+            hash = hash_data((const char *)vec[i].iov_base, vec[i].iov_len, hash);
+            offset += vec[i].iov_len;
+        }
+        if (offset == start) {
+            return;
+        }
+    }
+    std::string etag = format_etag(hash);
+    if (this->compression && this->compression->min_size != SIZE_MAX) {
+        // 响应可能被压缩, 使用弱ETag使304与压缩后的200响应的ETag一致
+        etag = "W/" + etag;
+    }
+    evhttp_add_header(this->output_headers, "ETag", etag.c_str());
+    const char *modified = evhttp_find_header(this->output_headers,
+                                              "Last-Modified");
+    if (this->is_not_modified(etag, modified ? parse_http_date(modified) : -1)) {
+        // 304不再压缩, 但要和200一样带上Vary, 否则缓存会用没有Vary的304更新
+        // 带Vary的200
+        this->select_encoding(this->output_buffer, true);
+        this->status_code = 304;
+        this->status_reason = StatusReasons.at(304);
+        evbuffer_drain(this->output_buffer, length);
+    }
+}
+
+void HTTPConnection::compress_output(evbuffer *chunk, bool start, bool end) {
+    if (start && !this->compression_decided) {
+        this->compression_decided = true;
+        ContentEncoding encoding = this->select_encoding(chunk, end);
+        if (encoding == ContentEncoding::Identity) {
+            return;
+        }
+        if (!this->compressed_buffer) {
+            this->compressed_buffer = evbuffer_new();
+            if (!this->compressed_buffer) {
+                return;
             }
-            if (chunk_size < 6) {
-                buf += boundary_tmp.length();
-                size -= boundary_tmp.length();
+        }
+        this->compressor = Compressor::acquire(encoding,
+                                               this->compression->level);
+        if (!this->compressor) {
+            return;
+        }
+        evhttp_add_header(this->output_headers, "Content-Encoding",
+                          encoding == ContentEncoding::Gzip ? "gzip" : "deflate");
+        // 压缩后的响应体与原来的不是逐字节相同, 强ETag改为弱ETag
+        const char *etag = evhttp_find_header(this->output_headers, "ETag");
+        if (etag && strncmp(etag, "W/", 2) != 0) {
+            std::string weak = std::string("W/") + etag;
+            evhttp_remove_header(this->output_headers, "ETag");
+            evhttp_add_header(this->output_headers, "ETag", weak.c_str());
+        }
+    }
+    if (!this->compressor) {
+        return;
+    }
+    if (!this->compressor->compress(chunk, this->compressed_buffer, end)) {
+        evbuffer_drain(chunk, evbuffer_get_length(chunk));
+    }
+    evbuffer_add_buffer(chunk, this->compressed_buffer);
+    if (end) {
+        Compressor::release(this->compressor);
+        this->compressor = nullptr;
+    }
+}
+
+void HTTPConnection::send_chunk(bool start, evbuffer *chunk) {
+    if (!this->evreq) {
+        return;
+    }
+    this->compress_output(chunk, start, false);
+    if (start) {
+        this->add_cookie_headers();
+        this->add_date_header();
+        this->hand_over_headers();
+        evhttp_send_reply_start(this->evreq, this->status_code,
+                                this->status_reason.c_str());
+    }
+    evhttp_send_reply_chunk(this->evreq, chunk);
+    size_t length = evbuffer_get_length(chunk);
+    evbuffer_drain(chunk, length);
+}
+
+void HTTPConnection::hand_over_headers() {
+    TAILQ_CONCAT(evhttp_request_get_output_headers(this->evreq),
+                 &this->response_headers, next);
+    // 复制而不是移回节点: evhttp在请求完成后释放请求头, 而请求头的视图要在连接
+    // 释放前一直有效, 处理器在finish之后(可能在工作线程中)仍可以读取
+    evkeyvalq *input_headers = evhttp_request_get_input_headers(this->evreq);
+    for (evkeyval *i = this->raw_headers.tqh_first; i; i = i->next.tqe_next) {
+        evhttp_add_header(input_headers, i->key, i->value);
+    }
+}
+
+void HTTPConnection::send_reply() {
+    if (!this->evreq) {
+        return;
+    }
+    if (!this->chunked) {
+        this->add_etag_header();
+        this->compress_output(this->output_buffer, true, true);
+        this->add_cookie_headers();
+        this->add_date_header();
+        this->hand_over_headers();
+        evhttp_send_reply(this->evreq, this->status_code,
+                          this->status_reason.c_str(), this->output_buffer);
+    } else {
+        this->compress_output(this->output_buffer, false, true);
+        size_t length = evbuffer_get_length(this->output_buffer);
+        if (length) {
+            evhttp_send_reply_chunk(this->evreq, this->output_buffer);
+        }
+        evhttp_send_reply_end(this->evreq);
+    }
+}
+
+bool HTTPConnection::parse_request(const char *uri, evbuffer *body) {
+    if (!uri) {
+        return false;
+    }
+    this->uri = uri;
+    evhttp_uri *decoded = evhttp_uri_parse(uri);
+    if (!decoded) {
+        return false;
+    }
+    const char *path = evhttp_uri_get_path(decoded);
+    if (!path) {
+        evhttp_uri_free(decoded);
+        return false;
+    }
+    char *decoded_path = evhttp_uridecode(path, 1, NULL);
+    if (!decoded_path) {
+        evhttp_uri_free(decoded);
+        return false;
+    }
+    this->path = decoded_path;
+    free(decoded_path);
+    evhttp_uri_free(decoded);
+    size_t query_pos = this->uri.find('?');
+    if (query_pos != std::string::npos) {
+        size_t fragment_pos = this->uri.find('#', query_pos);
+        size_t query_length = fragment_pos == std::string::npos ?
+                              std::string::npos : fragment_pos - query_pos - 1;
+        this->query = StringView(this->uri).substr(query_pos + 1, query_length);
+    }
+    if (!this->set_body(body)) {
+        return false;
+    }
+    this->set_status(200);
+    return true;
+}
+
+bool HTTPConnection::set_body(evbuffer *body) {
+    size_t body_length = body ? evbuffer_get_length(body) : 0;
+    if (!body_length) {
+        return true;
+    }
+    // 只移动缓冲区的内存块, 不复制数据. 请求体通常只占一个内存块,
+    // 此时pullup也不需要复制
+    if (!this->input_buffer) {
+        this->input_buffer = evbuffer_new();
+    }
+    if (!this->input_buffer ||
+        evbuffer_add_buffer(this->input_buffer, body) != 0) {
+        return false;
+    }
+    this->input_body_size = body_length;
+    return true;
+}
+
+bool HTTPConnection::set_spool(BodySpool *spool) {
+    this->spool = spool;
+    if (!spool->is_complete()) {
+        // 缺少结束分隔符, 请求体被截断
+        return false;
+    }
+    if (spool->is_multipart()) {
+        this->parsed |= ParsedBody;
+        for (BodySpool::Part &part: spool->get_parts()) {
+            if (!part.complete) {
                 continue;
             }
-            const char *chunk = buf;
-            std::string delimiter = "\r\n\r\n";
-            const char *chunk_body =
-                std::search(chunk, chunk + chunk_size, delimiter.begin(),
-                            delimiter.end());
-            if (chunk_body == chunk + chunk_size) {
+            if (part.filename.empty()) {
+                StringView value(part.value);
+                if (part.file) {
+                    const char *data = part.file->map();
+                    if (!data && part.file->get_size()) {
+                        return false;
+                    }
+                    value = StringView(data, part.file->get_size());
+                }
+                this->body_arguments.insert(std::make_pair(StringView(part.name),
+                                                           value));
                 continue;
             }
-            std::string name, filename, chunk_content_type;
-            size_t chunk_head_size = chunk_body - chunk - 2;
-            std::istringstream chunk_head;
-            chunk_head.str(std::string(chunk + 2, chunk_head_size));
-            while (!chunk_head.eof()) {
-                std::string line;
-                std::getline(chunk_head, line);
-                size_t pos1 = line.find(": ");
-                if (pos1 == std::string::npos) {
-                    continue;
-                }
-                const std::string &key = line.substr(0, pos1);
-                const std::string &value = line.substr(pos1 + 2,
-                                                line.length() - pos1 - 2);
-                if (key == "Content-Type") {
-                    chunk_content_type = value;
-                } else if (key == "Content-Disposition") {
-                    size_t pos_find = 0, pos_last = 0;
-                    std::vector<std::string> parts;
-                    while ((pos_find = value.find("; ", pos_last))
-                           != std::string::npos) {
-                        size_t part_length = pos_find - pos_last;
-                        const std::string &part = value.substr(pos_last,
-                                                               part_length);
-                        parts.push_back(part);
-                        pos_last = pos_find + 2;
-                    }
-                    int part_length = value.length() - pos_last;
-                    if (value.back() == '\r') {
-                        --part_length;
-                    }
-                    if (part_length >= 0) {
-                        const std::string &part = value.substr(pos_last,
-                                                               part_length);
-                        parts.push_back(part);
-                    }
-                    for (const std::string &part: parts) {
-                        size_t pos_e = part.find("=");
-                        if (pos_e == std::string::npos) {
-                            continue;
-                        }
-                        const std::string part_key = part.substr(0, pos_e);
-                        const std::string part_value =
-                            part.substr(pos_e + 1, part.length() - pos_e - 1);
-                        if (part_value.length() < 2) {
-                            continue;
-                        }
-                        if (part_key == "name") {
-                            name =
-                                part_value.substr(1, part_value.length() - 2);
-                        } else if (part_key == "filename") {
-                            filename =
-                                part_value.substr(1, part_value.length() - 2);
-                        }
-                    }
+            UploadFile file = {part.filename, part.content_type,
+                               part.value.data(), part.value.length(),
+                               std::string()};
+            if (part.file) {
+                file.data = part.file->map();
+                file.size = part.file->get_size();
+                file.path = part.file->get_path();
+                if (!file.data && file.size) {
+                    return false;
                 }
             }
-            chunk_body += 4;
-            size_t chunk_body_size = chunk_size - (chunk_body - chunk) - 2;
-            if (filename.empty()) {
-                std::string value(chunk_body, chunk_body_size);
-                this->body_arguments.insert(std::make_pair(name, value));
-            } else {
-                UploadFile file = {filename, content_type,
-                                   chunk_body, chunk_body_size};
-                this->files.insert(std::make_pair(name, file));
+            this->files.insert(std::make_pair(StringView(part.name), file));
+        }
+        return true;
+    }
+    TempFile *file = spool->get_file();
+    if (!file) {
+        return this->set_body(spool->get_buffer());
+    }
+    this->input_body = file->map();
+    this->input_body_size = file->get_size();
+    return this->input_body || !this->input_body_size;
+}
+
+void HTTPConnection::parse_headers() const {
+    if (this->parsed & ParsedHeaders) {
+        return;
+    }
+    this->parsed |= ParsedHeaders;
+    if (this->parsed & HeaderMap) {
+        for (const auto &header: this->input_headers) {
+            this->add_header_view(header.first, header.second);
+        }
+        return;
+    }
+    for (evkeyval *i = this->raw_headers.tqh_first; i; i = i->next.tqe_next) {
+        if (i->key && i->value) {
+            this->add_header_view(i->key, i->value);
+        }
+    }
+}
+
+void HTTPConnection::add_header_view(const StringView &key,
+                                     const StringView &value) const {
+    HTTPHeader header = find_known_header(key);
+    if (header == HTTPHeader::Other) {
+        this->other_headers.push_back(std::make_pair(key, value));
+        return;
+    }
+    StringView &slot = this->known_headers[(size_t)header];
+    if (!slot.data()) {
+        slot = value;
+        return;
+    }
+    // 不能合并的请求头只保留第一个
+    StringView separator = header_separator(header);
+    if (separator.empty() || value.empty()) {
+        return;
+    }
+    if (slot.empty()) {
+        slot = value;
+        return;
+    }
+    size_t size = slot.size() + separator.size() + value.size();
+    char *joined = (char *)this->arena.allocate(size, 1);
+    memcpy(joined, slot.data(), slot.size());
+    memcpy(joined + slot.size(), separator.data(), separator.size());
+    memcpy(joined + slot.size() + separator.size(), value.data(), value.size());
+    slot = StringView(joined, size);
+}
+
+void HTTPConnection::parse_query() const {
+    if (this->parsed & ParsedQuery) {
+        return;
+    }
+    this->parsed |= ParsedQuery;
+    parse_urlencoded(this->query.data(), this->query.length(),
+                     this->query_arguments);
+}
+
+void HTTPConnection::parse_cookies() const {
+    if (this->parsed & ParsedCookies) {
+        return;
+    }
+    this->parsed |= ParsedCookies;
+    parse_cookie(this->get_header_view(HTTPHeader::Cookie), this->cookie_views);
+}
+
+void HTTPConnection::parse_body() const {
+    if (this->parsed & ParsedBody) {
+        return;
+    }
+    this->parsed |= ParsedBody;
+    if (!this->get_body()) {
+        return;
+    }
+    const char *mpdf = "multipart/form-data";
+    StringView content_type = this->get_header_view(HTTPHeader::ContentType);
+    if (content_type == "application/x-www-form-urlencoded") {
+        parse_urlencoded(this->input_body, this->input_body_size,
+                         this->body_arguments);
+    } else if (content_type.substr(0, strlen(mpdf)) == mpdf) {
+        MultipartParser parser(MultipartParser::get_boundary(content_type));
+        if (!parser.initialize()) {
+            return;
+        }
+        // 整个请求体一次传入, 每个部分的内容都是请求体中连续的一段
+        StringView name;
+        UploadFile file;
+        const char *data = nullptr;
+        size_t size = 0;
+        parser.set_part_handler([&](const MultipartPart &part) {
+            name = this->arena.copy(part.name.data(), part.name.size());
+            file.filename = part.filename.str();
+            file.content_type = part.content_type.str();
+            data = nullptr;
+            size = 0;
+        });
+        parser.set_data_handler([&](const char *chunk, size_t chunk_size) {
+            if (!data) {
+                data = chunk;
+            }
+            size += chunk_size;
+        });
+        parser.set_end_handler([&]() {
+            if (file.filename.empty()) {
+                this->body_arguments.insert(std::make_pair(name,
+                                                           StringView(data, size)));
+                return;
             }
-            buf = new_buf + boundary_tmp.length();
-            size -= chunk_size + boundary_tmp.length();
+            file.data = data;
+            file.size = size;
+            this->files.insert(std::make_pair(name, file));
+        });
+        if (!parser.feed(this->input_body, this->input_body_size) ||
+            !parser.is_finished()) {
+            // 格式错误或缺少结束分隔符, 不交出不完整的表单
+            this->body_arguments.clear();
+            this->files.clear();
         }
     }
 }
\ No newline at end of file
@@ -1,16 +1,34 @@
 #include <stdint.h>
 #include <string>
+#include <vector>
+#include <set>
+#include <memory>
 #include <functional>
 #include <event2/event.h>
 #include <event2/http.h>
+#include <event2/util.h>
 #include "recycled/httpserver.h"
 #include "recycled/httpconnection.h"
 #include "recycled/ioloop.h"
+#include "recycled/socket.h"
 
 using namespace recycled;
 
+static const size_t MaxFreeConnections = 256;
+
+/**
+ * 关闭超时后等待工作线程的检查间隔(毫秒)
+ */
+static const uint64_t WorkerPollInterval = 10;
+
 HTTPServer::HTTPServer(const RequestHandler &request_handler):
-    request_handler(request_handler), event_http(nullptr) {}
+    request_handler(request_handler),
+    compression({SIZE_MAX, Z_DEFAULT_COMPRESSION}), auto_etag(false),
+    workers(nullptr), draining(0) {}
+
+HTTPServer::~HTTPServer() {
+    this->close();
+}
 
 bool HTTPServer::initialize() {
     IOLoop & loop = IOLoop::get_instance();
@@ -19,36 +37,246 @@ bool HTTPServer::initialize() {
     if (!loop.add_event(add_handler)) {
         return false;
     }
-    evhttp_set_gencb(this->event_http, evhttp_handler, (void *)this);
+    for (const ContextPtr &context: this->contexts) {
+        evhttp_set_gencb(context->event_http, evhttp_handler,
+                         (void *)context.get());
+    }
     return true;
 }
 
 bool HTTPServer::listen(uint16_t port, const std::string &ip) {
-    if (!this->event_http) {
+    if (this->contexts.empty()) {
         return false;
     }
-    evhttp_bound_socket *handle;
-    handle = evhttp_bind_socket_with_handle(this->event_http, ip.c_str(), port);
-    if (!handle) {
+    if (this->contexts.size() == 1) {
+        Context *context = this->contexts[0].get();
+        evhttp_bound_socket *handle;
+        handle = evhttp_bind_socket_with_handle(context->event_http,
+                                                ip.c_str(), port);
+        if (!handle) {
+            return false;
+        }
+        context->sockets.push_back(handle);
+        return true;
+    }
+    for (const ContextPtr &context: this->contexts) {
+        evutil_socket_t fd = listen_socket(ip, port, true);
+        if (fd < 0) {
+            return false;
+        }
+        evhttp_bound_socket *handle;
+        handle = evhttp_accept_socket_with_handle(context->event_http, fd);
+        if (!handle) {
+            evutil_closesocket(fd);
+            return false;
+        }
+        context->sockets.push_back(handle);
+    }
+    return true;
+}
+
+void HTTPServer::close() {
+    for (const ContextPtr &context: this->contexts) {
+        close_context(context.get());
+    }
+}
+
+bool HTTPServer::shutdown(uint64_t timeout) {
+    size_t expected = 0;
+    if (this->contexts.empty() ||
+        !this->draining.compare_exchange_strong(expected,
+                                                this->contexts.size())) {
         return false;
     }
+    for (const ContextPtr &context: this->contexts) {
+        Context *c = context.get();
+        if (!c->loop->post([this, c, timeout]() {this->drain(c, timeout);})) {
+            return false;
+        }
+    }
     return true;
 }
 
+void HTTPServer::set_streaming_checker(const StreamingChecker &checker) {}
+
+void HTTPServer::set_worker_pool(WorkerPool *workers) {
+    this->workers = workers;
+}
+
+void HTTPServer::set_compression(size_t min_size, int level) {
+    this->compression.min_size = min_size;
+    this->compression.level = level;
+}
+
+void HTTPServer::set_auto_etag(bool enabled) {
+    this->auto_etag = enabled;
+}
+
 bool HTTPServer::event_add_handler(event_base *base) {
     if (!base) {
         return false;
     }
-    event_http = evhttp_new(base);
-    if (!this->event_http) {
+    IOLoop *loop = nullptr;
+    for (IOLoop *l: IOLoop::get_instance().get_loops()) {
+        if (l->get_base() == base) {
+            loop = l;
+        }
+    }
+    if (!loop) {
+        return false;
+    }
+    evhttp *event_http = evhttp_new(base);
+    if (!event_http) {
         return false;
     }
+    ContextPtr context(new Context());
+    context->server = this;
+    context->loop = loop;
+    context->event_http = event_http;
+    context->pending = 0;
+    context->closing = false;
+    context->deadline = 0;
+    this->contexts.push_back(context);
     return true;
 }
 
+void HTTPServer::drain(Context *context, uint64_t timeout) {
+    if (!context->event_http || context->closing) {
+        this->finish_drain(context);
+        return;
+    }
+    context->closing = true;
+    for (evhttp_bound_socket *handle: context->sockets) {
+        evhttp_del_accept_socket(context->event_http, handle);
+    }
+    context->sockets.clear();
+    context->deadline = context->loop->call_later(timeout, [this, context]() {
+        context->deadline = 0;
+        this->expire(context);
+    });
+    this->check_drained(context);
+}
+
+void HTTPServer::expire(Context *context) {
+    // 超时后不再发送未完成的响应. 阻塞处理器可能还在工作线程中使用连接,
+    // 丢弃还没开始的任务, 等正在运行的任务结束后再释放evhttp
+    for (HTTPConnection *conn: context->connections) {
+        conn->abandon();
+    }
+    if (this->workers) {
+        this->workers->cancel();
+    }
+    if (this->workers && !this->workers->is_idle()) {
+        context->deadline = context->loop->call_later(WorkerPollInterval,
+                                                      [this, context]() {
+            context->deadline = 0;
+            this->expire(context);
+        });
+        return;
+    }
+    // 工作线程结束前投递的回调(发送响应, 释放连接)先执行
+    context->loop->post([this, context]() {
+        if (context->event_http) {
+            this->finish_drain(context);
+        }
+    });
+}
+
+void HTTPServer::check_drained(Context *context) {
+    if (!context->closing || !context->event_http ||
+        !context->connections.empty() || context->pending) {
+        return;
+    }
+    // 可能正处于evhttp的回调中, 不能在这里释放evhttp
+    context->loop->call_soon([this, context]() {
+        if (context->event_http && context->connections.empty() &&
+            !context->pending) {
+            this->finish_drain(context);
+        }
+    });
+}
+
+void HTTPServer::finish_drain(Context *context) {
+    if (context->event_http) {
+        if (context->deadline) {
+            context->loop->cancel_timer(context->deadline);
+            context->deadline = 0;
+        }
+        close_context(context);
+    }
+    if (--this->draining == 0) {
+        IOLoop::get_instance().stop();
+    }
+}
+
+void HTTPServer::close_context(Context *context) {
+    if (!context->event_http) {
+        return;
+    }
+    for (HTTPConnection *conn: context->connections) {
+        conn->abandon();
+    }
+    for (HTTPConnection *conn: context->free_connections) {
+        delete conn;
+    }
+    context->free_connections.clear();
+    context->sockets.clear();
+    evhttp_free(context->event_http);
+    context->event_http = nullptr;
+}
+
+void HTTPServer::release_connection(const ContextPtr &context,
+                                    HTTPConnection *conn) {
+    IOLoop *loop = context->loop;
+    auto release = [context, conn]() {
+        context->connections.erase(conn);
+        if (context->event_http &&
+            context->free_connections.size() < MaxFreeConnections) {
+            conn->reset();
+            context->free_connections.push_back(conn);
+        } else {
+            delete conn;
+        }
+        if (context->event_http) {
+            context->server->check_drained(context.get());
+        }
+    };
+    if (IOLoop::current() == loop) {
+        release();
+    } else {
+        loop->post(release);
+    }
+}
+
 void HTTPServer::evhttp_handler(evhttp_request *req, void *arg) {
-    HTTPServer *server = (HTTPServer *)arg;
-    HTTPConnection conn(req);
-    conn.initialize();
-    server->request_handler(conn);
-}
\ No newline at end of file
+    Context *context = (Context *)arg;
+    HTTPServer *server = context->server;
+    ++context->pending;
+    evhttp_request_set_on_complete_cb(req, request_complete, arg);
+    if (context->closing) {
+        evhttp_add_header(evhttp_request_get_output_headers(req),
+                          "Connection", "close");
+    }
+    HTTPConnection *raw;
+    if (!context->free_connections.empty()) {
+        raw = context->free_connections.back();
+        context->free_connections.pop_back();
+        raw->set_request(req);
+    } else {
+        raw = new HTTPConnection(req);
+        raw->set_compression(&server->compression);
+        raw->set_auto_etag(server->auto_etag);
+    }
+    context->connections.insert(raw);
+    std::shared_ptr<HTTPConnection> conn(
+        raw, std::bind(release_connection, context->shared_from_this(),
+                       std::placeholders::_1));
+    conn->initialize();
+    server->request_handler(*conn);
+}
+
+void HTTPServer::request_complete(evhttp_request *req, void *arg) {
+    Context *context = (Context *)arg;
+    --context->pending;
+    context->server->check_drained(context);
+}
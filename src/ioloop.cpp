@@ -1,14 +1,65 @@
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <vector>
+#include <thread>
+#include <mutex>
 #include <functional>
 #include <event2/event.h>
 #include "recycled/ioloop.h"
+#include "recycled/timerwheel.h"
 
 using namespace recycled;
 
-IOLoop::IOLoop(): base(NULL) {
+static thread_local IOLoop *current_loop = nullptr;
+
+IOLoop::IOLoop(): base(NULL), event_added(false),
+    wakeup_fd(-1), wakeup_event(NULL), soon_event(NULL),
+    timers(monotonic_time()), timer_event(NULL), timer_armed(0),
+    http_date_time(-1), cookie_date_time(-1) {
+    this->http_date[0] = '\0';
+    this->cookie_date[0] = '\0';
     this->base = event_base_new();
+    if (!this->base) {
+        return;
+    }
+    this->soon_event = event_new(this->base, -1, 0, soon_handler, this);
+    this->timer_event = evtimer_new(this->base, timer_handler, this);
+    this->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wakeup_fd >= 0) {
+        this->wakeup_event = event_new(this->base, this->wakeup_fd,
+                                       EV_READ | EV_PERSIST,
+                                       wakeup_handler, this);
+    }
+    if (!this->soon_event || !this->timer_event || !this->wakeup_event ||
+        event_add(this->wakeup_event, NULL) != 0) {
+        event_base_free(this->base);
+        this->base = NULL;
+    }
 }
 
 IOLoop::~IOLoop() {
+    for (IOLoop *child: this->children) {
+        delete child;
+    }
+    for (auto *signal: this->signals) {
+        event_free(signal->first);
+        delete signal;
+    }
+    if (this->wakeup_event) {
+        event_free(this->wakeup_event);
+    }
+    if (this->soon_event) {
+        event_free(this->soon_event);
+    }
+    if (this->timer_event) {
+        event_free(this->timer_event);
+    }
+    if (this->wakeup_fd >= 0) {
+        close(this->wakeup_fd);
+    }
     if (this->base) {
         event_base_free(this->base);
     }
@@ -19,17 +70,263 @@ IOLoop & IOLoop::get_instance() {
     return loop;
 }
 
+IOLoop * IOLoop::current() {
+    return current_loop;
+}
+
+bool IOLoop::set_threads(size_t count) {
+    if (this->event_added || !this->base) {
+        return false;
+    }
+    if (!count) {
+        count = std::thread::hardware_concurrency();
+        if (!count) {
+            count = 1;
+        }
+    }
+    while (this->children.size() + 1 > count) {
+        delete this->children.back();
+        this->children.pop_back();
+    }
+    while (this->children.size() + 1 < count) {
+        IOLoop *child = new IOLoop();
+        if (!child->base) {
+            delete child;
+            return false;
+        }
+        this->children.push_back(child);
+    }
+    return true;
+}
+
+size_t IOLoop::get_threads() const {
+    return this->children.size() + 1;
+}
+
+event_base * IOLoop::get_base() const {
+    return this->base;
+}
+
 bool IOLoop::add_event(EventAddHandler handler) {
     if (!this->base) {
         return false;
     }
-    return handler(this->base);
+    this->event_added = true;
+    if (!handler(this->base)) {
+        return false;
+    }
+    for (IOLoop *child: this->children) {
+        if (!child->add_event(handler)) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool IOLoop::start() {
     if (!this->base) {
         return false;
     }
+    std::vector<std::thread> threads;
+    for (IOLoop *child: this->children) {
+        threads.push_back(std::thread(&IOLoop::run, child));
+    }
+    this->run();
+    for (std::thread &t: threads) {
+        t.join();
+    }
+    return true;
+}
+
+bool IOLoop::stop() {
+    if (!this->base) {
+        return false;
+    }
+    for (IOLoop *child: this->children) {
+        child->stop();
+    }
+    if (current_loop == this) {
+        return event_base_loopexit(this->base, NULL) == 0;
+    }
+    return this->post([this]() {
+        event_base_loopexit(this->base, NULL);
+    });
+}
+
+std::vector<IOLoop *> IOLoop::get_loops() {
+    std::vector<IOLoop *> loops;
+    loops.push_back(this);
+    for (IOLoop *child: this->children) {
+        loops.push_back(child);
+    }
+    return loops;
+}
+
+bool IOLoop::add_signal(int signum, const Callback &callback) {
+    if (!this->base || !callback) {
+        return false;
+    }
+    auto *signal = new std::pair<event *, Callback>(nullptr, callback);
+    signal->first = evsignal_new(this->base, signum, signal_handler, signal);
+    if (!signal->first || event_add(signal->first, NULL) != 0) {
+        if (signal->first) {
+            event_free(signal->first);
+        }
+        delete signal;
+        return false;
+    }
+    this->signals.push_back(signal);
+    return true;
+}
+
+bool IOLoop::run() {
+    current_loop = this;
     event_base_dispatch(this->base);
+    current_loop = nullptr;
     return true;
-}
\ No newline at end of file
+}
+
+bool IOLoop::post(const Callback &callback) {
+    if (!this->base || !callback) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->posted_mutex);
+        this->posted.push_back(callback);
+    }
+    uint64_t one = 1;
+    if (::write(this->wakeup_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        return false;
+    }
+    return true;
+}
+
+bool IOLoop::call_soon(const Callback &callback) {
+    if (!this->base || !callback) {
+        return false;
+    }
+    if (current_loop != this) {
+        return this->post(callback);
+    }
+    this->soon.push_back(callback);
+    event_active(this->soon_event, EV_TIMEOUT, 0);
+    return true;
+}
+
+TimerID IOLoop::call_later(uint64_t delay, const Callback &callback) {
+    if (!this->base || !callback) {
+        return 0;
+    }
+    TimerID id = this->timers.add(monotonic_time() + delay, 0, callback);
+    this->schedule_timer();
+    return id;
+}
+
+TimerID IOLoop::call_every(uint64_t interval, const Callback &callback) {
+    if (!this->base || !callback) {
+        return 0;
+    }
+    if (!interval) {
+        interval = 1;
+    }
+    TimerID id = this->timers.add(monotonic_time() + interval, interval,
+                                  callback);
+    this->schedule_timer();
+    return id;
+}
+
+bool IOLoop::cancel_timer(TimerID id) {
+    return this->timers.cancel(id);
+}
+
+uint64_t IOLoop::monotonic_time() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+time_t IOLoop::get_time() {
+    timeval tv;
+    if (!this->base || event_base_gettimeofday_cached(this->base, &tv) != 0) {
+        return time(NULL);
+    }
+    return tv.tv_sec;
+}
+
+const char * IOLoop::get_http_date() {
+    time_t now = this->get_time();
+    if (now != this->http_date_time) {
+        tm t;
+        gmtime_r(&now, &t);
+        strftime(this->http_date, sizeof(this->http_date),
+                 "%a, %d %b %Y %H:%M:%S GMT", &t);
+        this->http_date_time = now;
+    }
+    return this->http_date;
+}
+
+const char * IOLoop::get_cookie_date(time_t offset) {
+    time_t stamp = this->get_time() + offset;
+    if (stamp != this->cookie_date_time) {
+        tm t;
+        gmtime_r(&stamp, &t);
+        strftime(this->cookie_date, sizeof(this->cookie_date),
+                 "%a, %d-%b-%Y %H:%M:%S GMT", &t);
+        this->cookie_date_time = stamp;
+    }
+    return this->cookie_date;
+}
+
+void IOLoop::schedule_timer() {
+    uint64_t next = this->timers.next_tick();
+    if (!next) {
+        return;
+    }
+    if (this->timer_armed && this->timer_armed <= next) {
+        return;
+    }
+    uint64_t now = monotonic_time();
+    uint64_t delay = next > now ? next - now : 0;
+    timeval tv;
+    tv.tv_sec = delay / 1000;
+    tv.tv_usec = (delay % 1000) * 1000;
+    evtimer_add(this->timer_event, &tv);
+    this->timer_armed = next;
+}
+
+void IOLoop::wakeup_handler(evutil_socket_t fd, short what, void *arg) {
+    IOLoop *loop = (IOLoop *)arg;
+    uint64_t count;
+    if (::read(fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+    std::vector<Callback> callbacks;
+    {
+        std::lock_guard<std::mutex> lock(loop->posted_mutex);
+        callbacks.swap(loop->posted);
+    }
+    for (Callback &callback: callbacks) {
+        callback();
+    }
+}
+
+void IOLoop::soon_handler(evutil_socket_t fd, short what, void *arg) {
+    IOLoop *loop = (IOLoop *)arg;
+    std::vector<Callback> callbacks;
+    callbacks.swap(loop->soon);
+    for (Callback &callback: callbacks) {
+        callback();
+    }
+}
+
+void IOLoop::timer_handler(evutil_socket_t fd, short what, void *arg) {
+    IOLoop *loop = (IOLoop *)arg;
+    loop->timer_armed = 0;
+    loop->timers.advance(monotonic_time());
+    loop->schedule_timer();
+}
+
+void IOLoop::signal_handler(evutil_socket_t fd, short what, void *arg) {
+    auto *signal = (std::pair<event *, Callback> *)arg;
+    signal->second();
+}
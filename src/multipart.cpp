@@ -0,0 +1,286 @@
+#include <string.h>
+#include <string>
+#include <functional>
+#include "recycled/multipart.h"
+
+using namespace recycled;
+
+static const size_t MaxHeadersSize = 16 * 1024;
+
+/**
+ * 解析"; key=value; key="value""形式的参数, 对每个参数调用callback
+ */
+static void parse_parameters(
+    const StringView &value,
+    const std::function<void (const StringView &, const StringView &)> &callback) {
+    size_t size = value.size();
+    size_t i = value.find(';');
+    while (i < size) {
+        ++i;
+        size_t key_start = i;
+        while (i < size && value[i] != '=' && value[i] != ';') {
+            ++i;
+        }
+        StringView key = trim(value.substr(key_start, i - key_start));
+        StringView param;
+        if (i < size && value[i] == '=') {
+            ++i;
+            while (i < size && (value[i] == ' ' || value[i] == '\t')) {
+                ++i;
+            }
+            if (i < size && value[i] == '"') {
+                size_t start = ++i;
+                while (i < size && value[i] != '"') {
+                    if (value[i] == '\\' && i + 1 < size) {
+                        ++i;
+                    }
+                    ++i;
+                }
+                param = value.substr(start, i - start);
+            } else {
+                size_t start = i;
+                while (i < size && value[i] != ';') {
+                    ++i;
+                }
+                param = trim(value.substr(start, i - start));
+            }
+        }
+        callback(key, param);
+        i = value.find(';', i);
+    }
+}
+
+MultipartParser::MultipartParser(const StringView &boundary):
+    state(State::Preamble), delimiter("\r\n--"), pending("\r\n") {
+    // 第一个分隔符前面没有换行, 预先放入一个换行以统一处理
+    this->delimiter.append(boundary.data(), boundary.size());
+}
+
+bool MultipartParser::initialize() {
+    return this->delimiter.length() > 4;
+}
+
+bool MultipartParser::set_part_handler(const PartHandler &handler) {
+    if (!handler) {
+        return false;
+    }
+    this->part_handler = handler;
+    return true;
+}
+
+bool MultipartParser::set_data_handler(const DataHandler &handler) {
+    if (!handler) {
+        return false;
+    }
+    this->data_handler = handler;
+    return true;
+}
+
+bool MultipartParser::set_end_handler(const EndHandler &handler) {
+    if (!handler) {
+        return false;
+    }
+    this->end_handler = handler;
+    return true;
+}
+
+bool MultipartParser::feed(const char *data, size_t size) {
+    while (size) {
+        size_t used = 1;
+        char ch = *data;
+        switch (this->state) {
+            case State::Preamble:
+            case State::Body:
+                used = this->feed_body(data, size);
+                break;
+            case State::AfterBoundary:
+                // 分隔符后面可以有空白, 然后是"--"或换行
+                if (ch == '-') {
+                    this->state = State::AfterDash;
+                } else if (ch == '\r') {
+                    this->state = State::AfterCR;
+                } else if (ch != ' ' && ch != '\t') {
+                    this->state = State::Error;
+                }
+                break;
+            case State::AfterDash:
+                this->state = ch == '-' ? State::End : State::Error;
+                break;
+            case State::AfterCR:
+                if (ch == '\n') {
+                    this->state = State::Headers;
+                    // 与头部结尾的"\r\n\r\n"统一, 没有头部的部分也能找到结尾
+                    this->headers.assign("\r\n");
+                } else {
+                    this->state = State::Error;
+                }
+                break;
+            case State::Headers:
+                used = this->feed_headers(data, size);
+                break;
+            case State::End:
+                // 忽略结束分隔符之后的内容
+                return true;
+            case State::Error:
+                return false;
+        }
+        data += used;
+        size -= used;
+    }
+    return this->state != State::Error;
+}
+
+bool MultipartParser::is_finished() const {
+    return this->state == State::End;
+}
+
+StringView MultipartParser::get_boundary(const StringView &content_type) {
+    StringView boundary;
+    parse_parameters(content_type,
+                     [&boundary](const StringView &key, const StringView &value) {
+        if (equals_ignore_case(key, "boundary")) {
+            boundary = value;
+        }
+    });
+    return boundary;
+}
+
+size_t MultipartParser::find_delimiter(const char *data, size_t size,
+                                       bool &partial) const {
+    // 用memchr找分隔符的第一个字符, 再比较剩下的部分
+    const char *end = data + size;
+    const char *p = data;
+    size_t length = this->delimiter.length();
+    while (p < end && (p = (const char *)memchr(p, '\r', end - p))) {
+        size_t rest = end - p;
+        if (rest >= length) {
+            if (!memcmp(p, this->delimiter.data(), length)) {
+                partial = false;
+                return p - data;
+            }
+        } else if (!memcmp(p, this->delimiter.data(), rest)) {
+            partial = true;
+            return p - data;
+        }
+        ++p;
+    }
+    partial = false;
+    return std::string::npos;
+}
+
+size_t MultipartParser::feed_body(const char *data, size_t size) {
+    bool partial;
+    if (!this->pending.empty()) {
+        // 分隔符可能从上一块数据的末尾开始
+        size_t length = this->pending.length();
+        size_t take = size < this->delimiter.length() ?
+                      size : this->delimiter.length();
+        std::string joined = this->pending;
+        joined.append(data, take);
+        size_t pos = this->find_delimiter(joined.data(), joined.length(), partial);
+        if (pos < length) {
+            this->emit(this->pending.data(), pos);
+            if (partial) {
+                this->pending = joined.substr(pos);
+                return size;
+            }
+            this->pending.clear();
+            this->end_body();
+            return pos + this->delimiter.length() - length;
+        }
+        this->emit(this->pending.data(), length);
+        this->pending.clear();
+    }
+    size_t pos = this->find_delimiter(data, size, partial);
+    if (pos == std::string::npos) {
+        this->emit(data, size);
+        return size;
+    }
+    this->emit(data, pos);
+    if (partial) {
+        this->pending.assign(data + pos, size - pos);
+        return size;
+    }
+    this->end_body();
+    return pos + this->delimiter.length();
+}
+
+size_t MultipartParser::feed_headers(const char *data, size_t size) {
+    // 先检查跨越两块数据的"\r\n\r\n"
+    size_t length = this->headers.length();
+    size_t tail = length < 3 ? length : 3;
+    std::string joined = this->headers.substr(length - tail);
+    joined.append(data, size < 3 ? size : 3);
+    size_t pos = joined.find("\r\n\r\n");
+    size_t used;
+    if (pos != std::string::npos) {
+        this->headers.resize(length - tail + pos);
+        used = pos + 4 - tail;
+    } else {
+        const char *end = (const char *)memmem(data, size, "\r\n\r\n", 4);
+        size_t head = end ? end - data : size;
+        if (length + head > MaxHeadersSize) {
+            this->state = State::Error;
+            return size;
+        }
+        this->headers.append(data, head);
+        if (!end) {
+            return size;
+        }
+        used = head + 4;
+    }
+    this->parse_headers();
+    this->state = State::Body;
+    return used;
+}
+
+void MultipartParser::parse_headers() {
+    MultipartPart part;
+    StringView headers(this->headers);
+    size_t pos = 0;
+    while (pos < headers.size()) {
+        size_t eol = headers.find('\n', pos);
+        if (eol == StringView::npos) {
+            eol = headers.size();
+        }
+        StringView line = headers.substr(pos, eol - pos);
+        pos = eol + 1;
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line = line.substr(0, line.size() - 1);
+        }
+        size_t colon = line.find(':');
+        if (colon == StringView::npos) {
+            continue;
+        }
+        StringView key = trim(line.substr(0, colon));
+        StringView value = trim(line.substr(colon + 1));
+        if (equals_ignore_case(key, "Content-Type")) {
+            part.content_type = value;
+        } else if (equals_ignore_case(key, "Content-Disposition")) {
+            parse_parameters(value,
+                             [&part](const StringView &k, const StringView &v) {
+                if (equals_ignore_case(k, "name")) {
+                    part.name = v;
+                } else if (equals_ignore_case(k, "filename")) {
+                    part.filename = v;
+                }
+            });
+        }
+    }
+    if (this->part_handler) {
+        this->part_handler(part);
+    }
+}
+
+void MultipartParser::emit(const char *data, size_t size) {
+    if (size && this->state == State::Body && this->data_handler) {
+        this->data_handler(data, size);
+    }
+}
+
+void MultipartParser::end_body() {
+    if (this->state == State::Body && this->end_handler) {
+        this->end_handler();
+    }
+    this->state = State::AfterBoundary;
+}
@@ -37,7 +37,7 @@ const ErrorHandler & Router::get_error_handler() {
 
 bool Router::add(const std::vector<HandlerStruct> &handlers) {
     for (auto &i: handlers) {
-        if (!this->add(i.pattern, i.handler, i.methods)) {
+        if (!this->add(i.pattern, i.handler, i.methods, i.flags)) {
             return false;
         }
     }
@@ -45,7 +45,7 @@ bool Router::add(const std::vector<HandlerStruct> &handlers) {
 }
 
 bool Router::add(const std::string &pattern, const RequestHandler &handler,
-                 const std::set<HTTPMethod> &methods) {
+                 const std::set<HTTPMethod> &methods, int flags) {
     const char *pattern_string = "(\\w+)";
     const char *pattern_int = "(\\d+)";
     const char *pattern_float = "(\\d*.\\d+|\\d+.\\d*)";
@@ -263,14 +263,24 @@ bool Router::add(const std::string &pattern, const RequestHandler &handler,
     if (!re) {
         return false;
     }
-    this->handlers.push_back(std::forward_as_tuple(re, handler, methods, arg_names));
+    this->handlers.push_back(std::forward_as_tuple(re, handler, methods,
+                                                   arg_names, flags));
     return true;
 }
 
 RequestHandler Router::route(const std::string &path,
                              HTTPMethod method,
                              std::map<std::string, std::string> &arguments) const {
+    int flags;
+    return this->route(path, method, arguments, flags);
+}
+
+RequestHandler Router::route(const std::string &path,
+                             HTTPMethod method,
+                             std::map<std::string, std::string> &arguments,
+                             int &flags) const {
     const size_t OVecCount = 128;
+    flags = 0;
     for (auto &i: this->handlers) {
         pcre *re = std::get<0>(i);
         if (!re) {
@@ -301,6 +311,7 @@ RequestHandler Router::route(const std::string &path,
                 const std::string &arg_name = arg_names[i-1];
                 arguments.insert(std::make_pair(arg_name, arg_value));
             }
+            flags = std::get<4>(i);
             return handler;
         }
     }
@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string>
+#include <event2/util.h>
+#include "recycled/socket.h"
+
+namespace recycled {
+evutil_socket_t listen_socket(const std::string &ip, uint16_t port,
+                              bool reuse_port) {
+    evutil_addrinfo hints, *result = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = EVUTIL_AI_PASSIVE | EVUTIL_AI_NUMERICHOST;
+    const std::string &port_str = std::to_string(port);
+    if (evutil_getaddrinfo(ip.c_str(), port_str.c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+    evutil_socket_t fd = socket(result->ai_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        evutil_freeaddrinfo(result);
+        return -1;
+    }
+    if (evutil_make_socket_nonblocking(fd) < 0 ||
+        evutil_make_socket_closeonexec(fd) < 0 ||
+        evutil_make_listen_socket_reuseable(fd) < 0 ||
+        (reuse_port && evutil_make_listen_socket_reuseable_port(fd) < 0) ||
+        bind(fd, result->ai_addr, result->ai_addrlen) < 0 ||
+        ::listen(fd, SOMAXCONN) < 0) {
+        evutil_closesocket(fd);
+        evutil_freeaddrinfo(result);
+        return -1;
+    }
+    evutil_freeaddrinfo(result);
+    return fd;
+}
+}
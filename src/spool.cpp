@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <event2/buffer.h>
+#include "recycled/spool.h"
+
+using namespace recycled;
+
+TempFile::TempFile(): fd(-1), size(0), data(nullptr) {}
+
+TempFile::~TempFile() {
+    if (this->data) {
+        munmap(this->data, this->size);
+    }
+    if (this->fd < 0) {
+        return;
+    }
+    // 处理器可能已经把文件rename走, 只删除仍是这个文件的路径
+    struct stat opened, named;
+    if (fstat(this->fd, &opened) == 0 &&
+        stat(this->path.c_str(), &named) == 0 &&
+        opened.st_dev == named.st_dev && opened.st_ino == named.st_ino) {
+        unlink(this->path.c_str());
+    }
+    ::close(this->fd);
+}
+
+bool TempFile::initialize(const std::string &directory) {
+    std::string path = directory + "/recycled-XXXXXX";
+    this->fd = mkostemp(&path[0], O_CLOEXEC);
+    if (this->fd < 0) {
+        return false;
+    }
+    this->path = path;
+    return true;
+}
+
+bool TempFile::write(const char *data, size_t size) {
+    if (this->fd < 0 || this->data) {
+        return false;
+    }
+    while (size) {
+        ssize_t n = ::write(this->fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+        this->size += n;
+    }
+    return true;
+}
+
+bool TempFile::write(evbuffer *buffer) {
+    if (this->fd < 0 || this->data) {
+        return false;
+    }
+    while (evbuffer_get_length(buffer)) {
+        int n = evbuffer_write(buffer, this->fd);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        this->size += n;
+    }
+    return true;
+}
+
+const char * TempFile::map() {
+    if (this->data || this->fd < 0 || !this->size) {
+        return (const char *)this->data;
+    }
+    void *data = mmap(NULL, this->size, PROT_READ, MAP_SHARED, this->fd, 0);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    this->data = data;
+    return (const char *)data;
+}
+
+const std::string & TempFile::get_path() const {
+    return this->path;
+}
+
+size_t TempFile::get_size() const {
+    return this->size;
+}
+
+BodySpool::BodySpool(const std::string &directory, size_t threshold):
+    directory(directory), threshold(threshold), size(0), failed(false),
+    malformed(false), buffer(nullptr), file(nullptr), parser(nullptr) {}
+
+BodySpool::~BodySpool() {
+    for (Part &part: this->parts) {
+        delete part.file;
+    }
+    delete this->parser;
+    delete this->file;
+    if (this->buffer) {
+        evbuffer_free(this->buffer);
+    }
+}
+
+bool BodySpool::initialize(const StringView &content_type) {
+    this->buffer = evbuffer_new();
+    if (!this->buffer) {
+        return false;
+    }
+    if (!equals_ignore_case(content_type.substr(0, 19), "multipart/form-data")) {
+        return true;
+    }
+    this->parser = new MultipartParser(MultipartParser::get_boundary(content_type));
+    if (!this->parser->initialize()) {
+        // 没有分隔符, 作为普通的请求体保存
+        delete this->parser;
+        this->parser = nullptr;
+        return true;
+    }
+    this->parser->set_part_handler([this](const MultipartPart &part) {
+        Part p = {part.name.str(), part.filename.str(), part.content_type.str(),
+                  std::string(), nullptr, false};
+        this->parts.push_back(p);
+    });
+    this->parser->set_data_handler([this](const char *data, size_t size) {
+        if (this->failed) {
+            return;
+        }
+        Part &part = this->parts.back();
+        // 普通的字段也可能很大, 同样超过阈值后写入临时文件
+        if (!part.file && part.value.length() + size > this->threshold) {
+            part.file = this->create_file();
+            if (!part.file || !part.file->write(part.value.data(),
+                                                part.value.length())) {
+                this->failed = true;
+                return;
+            }
+            std::string().swap(part.value);
+        }
+        if (!part.file) {
+            part.value.append(data, size);
+        } else if (!part.file->write(data, size)) {
+            this->failed = true;
+        }
+    });
+    this->parser->set_end_handler([this]() {
+        this->parts.back().complete = true;
+    });
+    return true;
+}
+
+bool BodySpool::write(evbuffer *data) {
+    this->size += evbuffer_get_length(data);
+    if (this->parser) {
+        // 按内存块逐段交给解析器, 不需要把缓冲区拼成连续的内存
+        size_t length;
+        while ((length = evbuffer_get_contiguous_space(data))) {
+            const char *chunk = (const char *)evbuffer_pullup(data, length);
+            if (!this->parser->feed(chunk, length)) {
+                this->malformed = true;
+                evbuffer_drain(data, evbuffer_get_length(data));
+                return false;
+            }
+            evbuffer_drain(data, length);
+        }
+        return !this->failed;
+    }
+    if (this->file) {
+        return this->file->write(data);
+    }
+    evbuffer_add_buffer(this->buffer, data);
+    if (evbuffer_get_length(this->buffer) <= this->threshold) {
+        return true;
+    }
+    this->file = this->create_file();
+    return this->file && this->file->write(this->buffer);
+}
+
+size_t BodySpool::get_size() const {
+    return this->size;
+}
+
+bool BodySpool::is_malformed() const {
+    return this->malformed;
+}
+
+bool BodySpool::is_complete() const {
+    return !this->parser || this->parser->is_finished();
+}
+
+bool BodySpool::is_multipart() const {
+    return this->parser;
+}
+
+evbuffer * BodySpool::get_buffer() {
+    return this->buffer;
+}
+
+TempFile * BodySpool::get_file() {
+    return this->file;
+}
+
+std::vector<BodySpool::Part> & BodySpool::get_parts() {
+    return this->parts;
+}
+
+TempFile * BodySpool::create_file() {
+    TempFile *file = new TempFile();
+    if (!file->initialize(this->directory)) {
+        delete file;
+        return nullptr;
+    }
+    return file;
+}
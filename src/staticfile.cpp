@@ -0,0 +1,576 @@
+#include <time.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <string>
+#include <list>
+#include <mutex>
+#include <functional>
+#include <event2/event.h>
+#include "recycled/staticfile.h"
+#include "recycled/compressor.h"
+#include "recycled/conditional.h"
+#include "recycled/ioloop.h"
+
+using namespace recycled;
+
+static const size_t MaxCachedFiles = 1024;
+
+static const struct {
+    const char *extension;
+    const char *content_type;
+} ContentTypes[] = {
+    {"html",  "text/html; charset=utf-8"},
+    {"htm",   "text/html; charset=utf-8"},
+    {"css",   "text/css; charset=utf-8"},
+    {"js",    "application/javascript; charset=utf-8"},
+    {"mjs",   "application/javascript; charset=utf-8"},
+    {"json",  "application/json"},
+    {"map",   "application/json"},
+    {"txt",   "text/plain; charset=utf-8"},
+    {"xml",   "application/xml"},
+    {"svg",   "image/svg+xml"},
+    {"png",   "image/png"},
+    {"jpg",   "image/jpeg"},
+    {"jpeg",  "image/jpeg"},
+    {"gif",   "image/gif"},
+    {"webp",  "image/webp"},
+    {"ico",   "image/x-icon"},
+    {"woff",  "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf",   "font/ttf"},
+    {"wasm",  "application/wasm"},
+    {"pdf",   "application/pdf"},
+    {"zip",   "application/zip"},
+    {"gz",    "application/gzip"},
+    {"mp3",   "audio/mpeg"},
+    {"mp4",   "video/mp4"},
+    {"webm",  "video/webm"}
+};
+
+/**
+ * 相对路径中不能有".."和'\0', 以免访问根目录之外的文件
+ */
+static bool is_safe_path(const StringView &path) {
+    if (path.empty() || path.find('\0') != StringView::npos) {
+        return false;
+    }
+    size_t begin = 0;
+    while (begin <= path.size()) {
+        size_t end = path.find('/', begin);
+        if (end == StringView::npos) {
+            end = path.size();
+        }
+        if (path.substr(begin, end - begin) == "..") {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+static time_t current_time() {
+    IOLoop *loop = IOLoop::current();
+    return loop ? loop->get_time() : time(NULL);
+}
+
+/**
+ * 读取整个文件
+ *
+ * @return 成功返回1, 文件不存在或不是普通文件返回0, 超过limit返回-1
+ */
+static int read_file(const std::string &path, std::string &data,
+                     struct stat &st, size_t limit) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size > limit) {
+        close(fd);
+        return -1;
+    }
+    data.resize(st.st_size);
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = read(fd, &data[done], data.size() - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    // 读取期间文件可能被截短
+    data.resize(done);
+    return 1;
+}
+
+static bool ends_with(const std::string &str, const char *suffix) {
+    size_t length = strlen(suffix);
+    return str.length() >= length &&
+           str.compare(str.length() - length, length, suffix) == 0;
+}
+
+StaticFileHandler::StaticFileHandler(const std::string &root,
+                                     const std::string &argument):
+    root(root), argument(argument), cache_time(1) {}
+
+StaticFileHandler::~StaticFileHandler() {
+    for (auto &p: this->files) {
+        close(p.second.file.fd);
+    }
+}
+
+void StaticFileHandler::set_cache_time(time_t seconds) {
+    this->cache_time = seconds;
+}
+
+void StaticFileHandler::handle(Connection &conn) {
+    StringView relative = conn.get_path_argument_view(this->argument);
+    if (!is_safe_path(relative)) {
+        conn.send_error(404);
+        return;
+    }
+    std::string path = this->root;
+    path += '/';
+    path.append(relative.data(), relative.size());
+    File file;
+    int fd = this->acquire(path, file);
+    if (fd < 0) {
+        conn.send_error(404);
+        return;
+    }
+    conn.add_header("Content-Type", file.content_type);
+    conn.add_header("Last-Modified", file.last_modified);
+    if (conn.is_not_modified(StringView(), file.mtime)) {
+        close(fd);
+        conn.set_status(304);
+        return;
+    }
+    // write_file取得文件描述符的所有权. 第一个范围直接使用fd, 它在响应发送之前
+    // 保持打开, 之后的范围(multipart/byteranges)使用它的副本
+    bool taken = false;
+    conn.write_ranges(file.size, [&conn, fd, &taken](uint64_t offset,
+                                                    uint64_t length) {
+        int part = taken ? fcntl(fd, F_DUPFD_CLOEXEC, 0) : fd;
+        taken = true;
+        return part >= 0 && conn.write_file(part, offset, length);
+    });
+    if (!taken) {
+        // HEAD, 416或空文件
+        close(fd);
+    }
+}
+
+StaticFileHandler::operator RequestHandler() {
+    return std::bind(&StaticFileHandler::handle, this, std::placeholders::_1);
+}
+
+const char * StaticFileHandler::get_content_type(const StringView &path) {
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if (dot != StringView::npos && (slash == StringView::npos || dot > slash)) {
+        StringView extension = path.substr(dot + 1);
+        for (auto &t: ContentTypes) {
+            if (equals_ignore_case(extension, t.extension)) {
+                return t.content_type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool StaticFileHandler::open_file(const std::string &path, File &file) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    file.fd = fd;
+    file.size = st.st_size;
+    file.mtime = st.st_mtime;
+    file.device = st.st_dev;
+    file.inode = st.st_ino;
+    file.content_type = get_content_type(path);
+    file.last_modified = format_http_date(file.mtime);
+    return true;
+}
+
+int StaticFileHandler::acquire(const std::string &path, File &file) {
+    time_t now = current_time();
+    bool cached = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto it = this->files.find(path);
+        if (it != this->files.end()) {
+            this->recent.splice(this->recent.begin(), this->recent,
+                                it->second.position);
+            file = it->second.file;
+            if (now - file.checked < this->cache_time) {
+                // 发送完成后连接关闭传入的文件描述符, 缓存保留自己的
+                return fcntl(file.fd, F_DUPFD_CLOEXEC, 0);
+            }
+            cached = true;
+        }
+    }
+    // stat和open可能很慢, 不持有锁, 以免阻塞其他线程
+    if (cached) {
+        // 缓存过期, 文件没有改变时继续使用打开的文件
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && st.st_dev == file.device &&
+            st.st_ino == file.inode && st.st_size == file.size &&
+            st.st_mtime == file.mtime) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto it = this->files.find(path);
+            // 期间可能被其他线程替换或淘汰
+            if (it != this->files.end() && it->second.file.fd == file.fd) {
+                it->second.file.checked = now;
+                return fcntl(file.fd, F_DUPFD_CLOEXEC, 0);
+            }
+        }
+    }
+    File opened;
+    bool ok = this->open_file(path, opened);
+    opened.checked = now;
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->files.find(path);
+    if (it != this->files.end()) {
+        this->erase(it);
+    }
+    if (!ok) {
+        return -1;
+    }
+    while (this->files.size() >= MaxCachedFiles) {
+        this->erase(this->files.find(this->recent.back()));
+    }
+    this->recent.push_front(path);
+    CachedFile entry = {opened, this->recent.begin()};
+    this->files.insert(std::make_pair(path, entry));
+    file = opened;
+    return fcntl(opened.fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void StaticFileHandler::erase(
+    std::unordered_map<std::string, CachedFile>::iterator it) {
+    close(it->second.file.fd);
+    this->recent.erase(it->second.position);
+    this->files.erase(it);
+}
+
+AssetCache::AssetCache(const std::string &root, size_t max_size,
+                       const std::string &argument):
+    root(root), max_size(max_size), argument(argument), fallback(root, argument),
+    size(0), generation(0), inotify_fd(-1), watch_event(nullptr) {}
+
+AssetCache::~AssetCache() {
+    if (this->watch_event) {
+        event_free(this->watch_event);
+    }
+    if (this->inotify_fd >= 0) {
+        close(this->inotify_fd);
+    }
+}
+
+bool AssetCache::initialize(bool preload) {
+    if (this->inotify_fd >= 0) {
+        return false;
+    }
+    this->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->inotify_fd < 0) {
+        return false;
+    }
+    this->watch("");
+    if (this->watches.empty()) {
+        return false;
+    }
+    event_base *base = IOLoop::get_instance().get_base();
+    this->watch_event = event_new(base, this->inotify_fd, EV_READ | EV_PERSIST,
+                                  watch_handler, this);
+    if (!this->watch_event || event_add(this->watch_event, NULL) != 0) {
+        return false;
+    }
+    if (preload) {
+        this->preload("");
+    }
+    return true;
+}
+
+void AssetCache::handle(Connection &conn) {
+    StringView relative = conn.get_path_argument_view(this->argument);
+    if (!is_safe_path(relative)) {
+        conn.send_error(404);
+        return;
+    }
+    std::string path = relative.str();
+    AssetPtr asset = this->find(path);
+    if (!asset) {
+        int rc = this->load(path, asset);
+        if (rc < 0) {
+            // 太大的文件不缓存, 直接从磁盘发送
+            this->fallback.handle(conn);
+            return;
+        }
+        if (!rc) {
+            conn.send_error(404);
+            return;
+        }
+    }
+    const std::string *body = &asset->data;
+    const std::string *etag = &asset->etag;
+    if (!asset->gzip.empty() || !asset->deflate.empty()) {
+        StringView accept = conn.get_header_view(HTTPHeader::AcceptEncoding);
+        if (!asset->gzip.empty() && accepts_encoding(accept, "gzip")) {
+            body = &asset->gzip;
+            etag = &asset->gzip_etag;
+            conn.add_header("Content-Encoding", "gzip");
+        } else if (!asset->deflate.empty() && accepts_encoding(accept, "deflate")) {
+            body = &asset->deflate;
+            etag = &asset->deflate_etag;
+            conn.add_header("Content-Encoding", "deflate");
+        }
+        conn.add_header("Vary", "Accept-Encoding");
+    }
+    conn.add_header("Content-Type", asset->content_type);
+    conn.add_header("ETag", *etag);
+    conn.add_header("Last-Modified", asset->last_modified);
+    if (conn.is_not_modified(*etag, asset->mtime)) {
+        conn.set_status(304);
+        return;
+    }
+    conn.write_ranges(body->size(), [&conn, &asset, body](uint64_t offset,
+                                                         uint64_t length) {
+        if (!offset && length == body->size()) {
+            // 共享Asset的引用计数, 不复制也不分配
+            return conn.write_shared(SharedBuffer(asset, body));
+        }
+        AssetPtr holder = asset;
+        return conn.write_reference(body->data() + offset, length,
+                                    [holder]() {});
+    });
+}
+
+AssetCache::operator RequestHandler() {
+    return std::bind(&AssetCache::handle, this, std::placeholders::_1);
+}
+
+void AssetCache::invalidate(const std::string &path) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    ++this->generation;
+    if (path.empty()) {
+        this->assets.clear();
+        this->recent.clear();
+        this->size = 0;
+        return;
+    }
+    auto it = this->assets.find(path);
+    if (it != this->assets.end()) {
+        this->erase(it);
+    }
+    if (ends_with(path, ".gz") || ends_with(path, ".zz")) {
+        // 压缩版本改变时原文件的缓存也失效
+        it = this->assets.find(path.substr(0, path.length() - 3));
+        if (it != this->assets.end()) {
+            this->erase(it);
+        }
+    }
+}
+
+size_t AssetCache::get_size() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->size;
+}
+
+AssetCache::AssetPtr AssetCache::find(const std::string &path) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->assets.find(path);
+    if (it == this->assets.end()) {
+        return nullptr;
+    }
+    this->recent.splice(this->recent.begin(), this->recent, it->second.position);
+    return it->second.asset;
+}
+
+int AssetCache::load(const std::string &path, AssetPtr &asset) {
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        generation = this->generation;
+    }
+    std::string full = this->root + '/' + path;
+    std::shared_ptr<Asset> loaded = std::make_shared<Asset>();
+    struct stat st, variant;
+    int rc = read_file(full, loaded->data, st, this->max_size);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (read_file(full + ".gz", loaded->gzip, variant, this->max_size) <= 0) {
+        loaded->gzip.clear();
+    }
+    if (read_file(full + ".zz", loaded->deflate, variant, this->max_size) <= 0) {
+        loaded->deflate.clear();
+    }
+    loaded->size = loaded->data.size() + loaded->gzip.size() +
+                   loaded->deflate.size();
+    if (loaded->size > this->max_size) {
+        return -1;
+    }
+    uint64_t hash = hash_data(loaded->data.data(), loaded->data.size());
+    loaded->etag = format_etag(hash);
+    loaded->gzip_etag = format_etag(hash, "-gzip");
+    loaded->deflate_etag = format_etag(hash, "-deflate");
+    loaded->mtime = st.st_mtime;
+    loaded->last_modified = format_http_date(loaded->mtime);
+    loaded->content_type = StaticFileHandler::get_content_type(path);
+    asset = loaded;
+    this->insert(path, asset, generation);
+    return 1;
+}
+
+void AssetCache::insert(const std::string &path, const AssetPtr &asset,
+                        uint64_t generation) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (generation != this->generation) {
+        // 加载期间文件可能改变了, 这次的内容只用于当前请求
+        return;
+    }
+    auto it = this->assets.find(path);
+    if (it != this->assets.end()) {
+        this->erase(it);
+    }
+    while (!this->recent.empty() && this->size + asset->size > this->max_size) {
+        this->erase(this->assets.find(this->recent.back()));
+    }
+    this->recent.push_front(path);
+    Entry entry = {asset, this->recent.begin()};
+    this->assets.insert(std::make_pair(path, entry));
+    this->size += asset->size;
+}
+
+void AssetCache::erase(std::unordered_map<std::string, Entry>::iterator it) {
+    this->size -= it->second.asset->size;
+    this->recent.erase(it->second.position);
+    this->assets.erase(it);
+}
+
+void AssetCache::preload(const std::string &directory) {
+    std::string full = directory.empty() ? this->root :
+                       this->root + '/' + directory;
+    DIR *dir = opendir(full.c_str());
+    if (!dir) {
+        return;
+    }
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string path = directory.empty() ? name : directory + '/' + name;
+        struct stat st;
+        if (lstat((this->root + '/' + path).c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            this->preload(path);
+            continue;
+        }
+        if ((ends_with(name, ".gz") || ends_with(name, ".zz")) &&
+            access((full + '/' + name.substr(0, name.length() - 3)).c_str(),
+                   F_OK) == 0) {
+            // 压缩版本随原文件加载
+            continue;
+        }
+        if (this->get_size() >= this->max_size) {
+            break;
+        }
+        AssetPtr asset;
+        this->load(path, asset);
+    }
+    closedir(dir);
+}
+
+void AssetCache::watch(const std::string &directory) {
+    std::string full = directory.empty() ? this->root :
+                       this->root + '/' + directory;
+    int wd = inotify_add_watch(this->inotify_fd, full.c_str(),
+                               IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB |
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if (wd < 0) {
+        return;
+    }
+    this->watches[wd] = directory;
+    DIR *dir = opendir(full.c_str());
+    if (!dir) {
+        return;
+    }
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        struct stat st;
+        if (lstat((full + '/' + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            this->watch(directory.empty() ? name : directory + '/' + name);
+        }
+    }
+    closedir(dir);
+}
+
+void AssetCache::watch_handler(evutil_socket_t fd, short what, void *arg) {
+    AssetCache *cache = (AssetCache *)arg;
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        for (char *p = buffer; p < buffer + n;) {
+            inotify_event *event = (inotify_event *)p;
+            p += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                cache->invalidate();
+                continue;
+            }
+            auto it = cache->watches.find(event->wd);
+            if (it == cache->watches.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                cache->watches.erase(it);
+                continue;
+            }
+            if (!event->len) {
+                continue;
+            }
+            std::string path = it->second.empty() ? event->name :
+                                it->second + '/' + event->name;
+            if (event->mask & IN_ISDIR) {
+                // 目录被移走或删除时不知道其中缓存了哪些文件, 全部失效
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    cache->watch(path);
+                }
+                cache->invalidate();
+                continue;
+            }
+            cache->invalidate(path);
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <utility>
+#include <functional>
+#include "recycled/timerwheel.h"
+
+using namespace recycled;
+
+TimerWheel::TimerWheel(uint64_t now):
+    free_head(Invalid), capacity(0), current(now), count(0) {
+    for (uint32_t i = 0; i <= SlotCount; ++i) {
+        this->slots[i] = Invalid;
+    }
+    for (uint32_t i = 0; i < RootSize / 64; ++i) {
+        this->root_bitmap[i] = 0;
+    }
+}
+
+TimerID TimerWheel::add(uint64_t expires, uint64_t interval,
+                        const Callback &callback) {
+    uint32_t index = this->allocate();
+    Node &n = this->node(index);
+    n.expires = expires;
+    n.interval = interval;
+    n.callback = callback;
+    n.state = State::Pending;
+    this->link(index);
+    ++this->count;
+    return ((uint64_t)n.generation << 32) | index;
+}
+
+bool TimerWheel::cancel(TimerID id) {
+    uint32_t index = id & UINT32_MAX;
+    uint32_t generation = id >> 32;
+    if (index >= this->capacity) {
+        return false;
+    }
+    Node &n = this->node(index);
+    if (n.generation != generation) {
+        return false;
+    }
+    switch (n.state) {
+        case State::Pending:
+            this->unlink(index);
+            this->release(index);
+            return true;
+        case State::Firing:
+            n.state = State::Cancelled;
+            return true;
+        default:
+            return false;
+    }
+}
+
+void TimerWheel::advance(uint64_t now) {
+    while (this->current <= now) {
+        if (!this->count) {
+            this->current = now + 1;
+            break;
+        }
+        uint64_t tick = this->current;
+        uint32_t index = tick & RootMask;
+        if (!index) {
+            this->cascade();
+        }
+        ++this->current;
+        this->fire(index, tick);
+        uint64_t next = this->next_root_tick();
+        this->current = next < now + 1 ? next : now + 1;
+    }
+}
+
+uint64_t TimerWheel::next_tick() const {
+    if (!this->count) {
+        return 0;
+    }
+    return this->next_root_tick();
+}
+
+uint64_t TimerWheel::get_tick() const {
+    return this->current;
+}
+
+size_t TimerWheel::size() const {
+    return this->count;
+}
+
+TimerWheel::Node & TimerWheel::node(uint32_t index) const {
+    return this->chunks[index >> ChunkBits][index & (ChunkSize - 1)];
+}
+
+uint32_t TimerWheel::allocate() {
+    if (this->free_head == Invalid) {
+        std::unique_ptr<Node[]> chunk(new Node[ChunkSize]);
+        for (uint32_t i = 0; i < ChunkSize; ++i) {
+            chunk[i].state = State::Free;
+            chunk[i].generation = 1;
+            chunk[i].next = i + 1 < ChunkSize ? this->capacity + i + 1 : Invalid;
+        }
+        this->free_head = this->capacity;
+        this->capacity += ChunkSize;
+        this->chunks.push_back(std::move(chunk));
+    }
+    uint32_t index = this->free_head;
+    this->free_head = this->node(index).next;
+    return index;
+}
+
+void TimerWheel::release(uint32_t index) {
+    Node &n = this->node(index);
+    n.callback = nullptr;
+    n.state = State::Free;
+    if (!++n.generation) {
+        n.generation = 1;
+    }
+    n.next = this->free_head;
+    this->free_head = index;
+    --this->count;
+}
+
+void TimerWheel::link(uint32_t index) {
+    Node &n = this->node(index);
+    if (n.expires < this->current) {
+        n.expires = this->current;
+    }
+    uint64_t delta = n.expires - this->current;
+    const uint64_t Max = (1ULL << (RootBits + (Levels - 1) * LevelBits)) - 1;
+    if (delta > Max) {
+        n.expires = this->current + Max;
+        delta = Max;
+    }
+    uint32_t slot;
+    if (delta < RootSize) {
+        slot = n.expires & RootMask;
+        this->root_bitmap[slot >> 6] |= 1ULL << (slot & 63);
+    } else {
+        int level = 1;
+        while (delta >= (1ULL << (RootBits + level * LevelBits))) {
+            ++level;
+        }
+        int shift = RootBits + (level - 1) * LevelBits;
+        slot = RootSize + (level - 1) * LevelSize +
+               ((n.expires >> shift) & LevelMask);
+    }
+    n.slot = slot;
+    n.prev = Invalid;
+    n.next = this->slots[slot];
+    if (n.next != Invalid) {
+        this->node(n.next).prev = index;
+    }
+    this->slots[slot] = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node &n = this->node(index);
+    if (n.prev != Invalid) {
+        this->node(n.prev).next = n.next;
+    } else {
+        this->slots[n.slot] = n.next;
+    }
+    if (n.next != Invalid) {
+        this->node(n.next).prev = n.prev;
+    }
+    if (n.slot < RootSize && this->slots[n.slot] == Invalid) {
+        this->root_bitmap[n.slot >> 6] &= ~(1ULL << (n.slot & 63));
+    }
+}
+
+void TimerWheel::cascade() {
+    for (int level = 1; level < Levels; ++level) {
+        int shift = RootBits + (level - 1) * LevelBits;
+        uint32_t index = (this->current >> shift) & LevelMask;
+        uint32_t slot = RootSize + (level - 1) * LevelSize + index;
+        while (this->slots[slot] != Invalid) {
+            uint32_t i = this->slots[slot];
+            this->unlink(i);
+            this->link(i);
+        }
+        if (index) {
+            break;
+        }
+    }
+}
+
+void TimerWheel::fire(uint32_t slot, uint64_t tick) {
+    // 先把整个槽移到Running链表, 回调中新增的定时器不会在本轮触发
+    uint32_t head = this->slots[slot];
+    this->slots[slot] = Invalid;
+    this->root_bitmap[slot >> 6] &= ~(1ULL << (slot & 63));
+    for (uint32_t i = head; i != Invalid; i = this->node(i).next) {
+        this->node(i).slot = Running;
+    }
+    this->slots[Running] = head;
+    while (this->slots[Running] != Invalid) {
+        uint32_t index = this->slots[Running];
+        this->unlink(index);
+        Node &n = this->node(index);
+        if (!n.interval) {
+            Callback callback = std::move(n.callback);
+            this->release(index);
+            callback();
+            continue;
+        }
+        n.state = State::Firing;
+        n.callback();
+        if (n.state == State::Cancelled) {
+            this->release(index);
+        } else {
+            n.state = State::Pending;
+            n.expires = tick + n.interval;
+            this->link(index);
+        }
+    }
+}
+
+uint64_t TimerWheel::next_root_tick() const {
+    uint32_t index = this->current & RootMask;
+    if (!index) {
+        return this->current;
+    }
+    for (uint32_t word = index >> 6; word < RootSize / 64; ++word) {
+        uint64_t bits = this->root_bitmap[word];
+        if (word == (index >> 6)) {
+            bits &= ~0ULL << (index & 63);
+        }
+        if (bits) {
+            uint32_t found = (word << 6) + __builtin_ctzll(bits);
+            return this->current - index + found;
+        }
+    }
+    return (this->current | RootMask) + 1;
+}
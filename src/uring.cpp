@@ -0,0 +1,424 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <functional>
+#include "recycled/uring.h"
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+using namespace recycled;
+
+// 多次接收(IORING_RECV_MULTISHOT)需要较新的内核头文件
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define RECYCLED_HAVE_IO_URING 1
+#endif
+
+/**
+ * 归还缓冲区的请求以缓冲区ID加1作为用户数据, 失败时据此重新归还.
+ * 用户数据是指针, 不会落在这个范围内
+ */
+static const uint64_t BufferUserDataLimit = 65536;
+
+IOUring::IOUring():
+    fd(-1), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sq_size(0), cq_size(0),
+    sqes((io_uring_sqe *)MAP_FAILED), sqes_size(0),
+    sq_head(nullptr), sq_tail(nullptr), sq_mask(nullptr),
+    cq_head(nullptr), cq_tail(nullptr), cq_mask(nullptr), cqes(nullptr),
+    sq_entries(0), sqe_tail(0), sqe_submitted(0),
+    buffers(nullptr), buf_count(0), buf_size(0),
+    buf_group(0) {}
+
+IOUring::~IOUring() {
+    this->release();
+}
+
+int IOUring::get_fd() const {
+    return this->fd;
+}
+
+unsigned IOUring::get_pending() const {
+    return this->sqe_tail - this->sqe_submitted;
+}
+
+#ifdef RECYCLED_HAVE_IO_URING
+bool IOUring::initialize(unsigned entries) {
+    if (this->fd >= 0) {
+        return false;
+    }
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    this->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (this->fd < 0) {
+        return false;
+    }
+    this->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cq_size = params.cq_off.cqes +
+                    params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (this->cq_size > this->sq_size) {
+            this->sq_size = this->cq_size;
+        }
+        this->cq_size = this->sq_size;
+    }
+    this->sq_ptr = mmap(NULL, this->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+    if (this->sq_ptr == MAP_FAILED) {
+        this->release();
+        return false;
+    }
+    if (single_mmap) {
+        this->cq_ptr = this->sq_ptr;
+    } else {
+        this->cq_ptr = mmap(NULL, this->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, this->fd,
+                            IORING_OFF_CQ_RING);
+        if (this->cq_ptr == MAP_FAILED) {
+            this->release();
+            return false;
+        }
+    }
+    this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    this->sqes = (io_uring_sqe *)mmap(NULL, this->sqes_size,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, this->fd,
+                                      IORING_OFF_SQES);
+    if (this->sqes == MAP_FAILED) {
+        this->release();
+        return false;
+    }
+    char *sq = (char *)this->sq_ptr;
+    char *cq = (char *)this->cq_ptr;
+    this->sq_head = (unsigned *)(sq + params.sq_off.head);
+    this->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    this->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    this->cq_head = (unsigned *)(cq + params.cq_off.head);
+    this->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    this->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    this->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    this->sq_entries = params.sq_entries;
+    // 提交项和队列中的位置一一对应, 之后只需要移动队尾
+    unsigned *array = (unsigned *)(sq + params.sq_off.array);
+    for (unsigned i = 0; i < this->sq_entries; ++i) {
+        array[i] = i;
+    }
+    this->sqe_tail = this->sqe_submitted = *this->sq_tail;
+    // 多次接收和IORING_OP_SEND_ZC都是6.0加入的, 以后者判断内核是否支持前者
+    const unsigned ProbeOps = 256;
+    size_t probe_size = sizeof(io_uring_probe) +
+                        ProbeOps * sizeof(io_uring_probe_op);
+    io_uring_probe *probe = (io_uring_probe *)calloc(1, probe_size);
+    bool supported = probe &&
+        syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE,
+                probe, ProbeOps) >= 0 &&
+        probe->last_op >= IORING_OP_SEND_ZC &&
+        (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) {
+        this->release();
+        return false;
+    }
+    return true;
+}
+
+bool IOUring::setup_buffers(unsigned count, unsigned size, uint16_t group) {
+    if (this->fd < 0 || this->buffers || !count || count > 65536 || !size) {
+        return false;
+    }
+    this->buffers = (char *)malloc((size_t)count * size);
+    if (!this->buffers) {
+        return false;
+    }
+    this->buf_count = count;
+    this->buf_size = size;
+    this->buf_group = group;
+    // 一次提供所有缓冲区, 等待完成以确认内核支持
+    io_uring_sqe *sqe = this->get_sqe();
+    if (!sqe) {
+        free(this->buffers);
+        this->buffers = nullptr;
+        return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)this->buffers;
+    sqe->len = size;
+    sqe->off = 0;
+    sqe->buf_group = group;
+    sqe->user_data = 0;
+    int ret;
+    do {
+        __atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+        ret = syscall(__NR_io_uring_enter, this->fd,
+                      this->sqe_tail - this->sqe_submitted, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret > 0) {
+        this->sqe_submitted += ret;
+    }
+    unsigned head = *this->cq_head;
+    int result = -1;
+    if (ret > 0 && head != __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE)) {
+        result = this->cqes[head & *this->cq_mask].res;
+        __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+    }
+    if (result < 0) {
+        free(this->buffers);
+        this->buffers = nullptr;
+        return false;
+    }
+    return true;
+}
+
+io_uring_sqe * IOUring::get_sqe() {
+    if (this->fd < 0) {
+        return nullptr;
+    }
+    unsigned head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+    if (this->sqe_tail - head >= this->sq_entries) {
+        if (this->submit() < 0) {
+            return nullptr;
+        }
+        head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+        if (this->sqe_tail - head >= this->sq_entries) {
+            return nullptr;
+        }
+    }
+    io_uring_sqe *sqe = &this->sqes[this->sqe_tail & *this->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++this->sqe_tail;
+    return sqe;
+}
+
+int IOUring::submit() {
+    this->flush_recycling();
+    unsigned pending = this->sqe_tail - this->sqe_submitted;
+    if (!pending) {
+        return 0;
+    }
+    __atomic_store_n(this->sq_tail, this->sqe_tail, __ATOMIC_RELEASE);
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, this->fd, pending, 0, 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        return -1;
+    }
+    this->sqe_submitted += ret;
+    return ret;
+}
+
+bool IOUring::prepare_accept(int fd, uint64_t user_data) {
+    io_uring_sqe *sqe = this->get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IOUring::prepare_recv(int fd, uint64_t user_data) {
+    if (!this->buffers) {
+        return false;
+    }
+    io_uring_sqe *sqe = this->get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = this->buf_group;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IOUring::prepare_sendmsg(int fd, const msghdr *msg, uint64_t user_data) {
+    io_uring_sqe *sqe = this->get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+    return true;
+}
+
+bool IOUring::prepare_cancel(uint64_t target, uint64_t user_data) {
+    io_uring_sqe *sqe = this->get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return true;
+}
+
+size_t IOUring::reap(const CompletionHandler &handler) {
+    if (this->fd < 0) {
+        return 0;
+    }
+    size_t count = 0;
+    while (true) {
+        unsigned head = *this->cq_head;
+        unsigned tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        for (; head != tail; ++head, ++count) {
+            // 先取出并推进队头, 回调中可能提交新的请求
+            const io_uring_cqe &cqe = this->cqes[head & *this->cq_mask];
+            if (cqe.user_data <= BufferUserDataLimit) {
+                // 内部使用的归还缓冲区请求, 成功时不产生完成事件
+                uint64_t user_data = cqe.user_data;
+                int result = cqe.res;
+                __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+                if (user_data && result < 0) {
+                    this->recycle_buffer(user_data - 1);
+                }
+                continue;
+            }
+            IOCompletion completion;
+            completion.user_data = cqe.user_data;
+            completion.result = cqe.res;
+            completion.more = cqe.flags & IORING_CQE_F_MORE;
+            completion.buffer = (cqe.flags & IORING_CQE_F_BUFFER) ?
+                                (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+            __atomic_store_n(this->cq_head, head + 1, __ATOMIC_RELEASE);
+            handler(completion);
+        }
+    }
+    return count;
+}
+
+char * IOUring::get_buffer(uint16_t id) const {
+    return this->buffers + (size_t)id * this->buf_size;
+}
+
+void IOUring::recycle_buffer(uint16_t id) {
+    // 和下一批请求一起提交, 按顺序执行, 所以在之后的接收之前生效
+    if (!this->provide_buffer(id)) {
+        this->recycling.push_back(id);
+    }
+}
+
+void IOUring::flush_recycling() {
+    // 只使用空闲的提交项, get_sqe在队列满时会调用submit
+    while (!this->recycling.empty()) {
+        unsigned head = __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE);
+        if (this->sqe_tail - head >= this->sq_entries ||
+            !this->provide_buffer(this->recycling.back())) {
+            break;
+        }
+        this->recycling.pop_back();
+    }
+}
+
+bool IOUring::provide_buffer(uint16_t id) {
+    io_uring_sqe *sqe = this->get_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t)this->get_buffer(id);
+    sqe->len = this->buf_size;
+    sqe->off = id;
+    sqe->buf_group = this->buf_group;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = (uint64_t)id + 1;
+    return true;
+}
+
+void IOUring::release() {
+    this->recycling.clear();
+    if (this->buffers) {
+        free(this->buffers);
+        this->buffers = nullptr;
+    }
+    if (this->sqes != MAP_FAILED) {
+        munmap(this->sqes, this->sqes_size);
+        this->sqes = (io_uring_sqe *)MAP_FAILED;
+    }
+    if (this->cq_ptr != MAP_FAILED && this->cq_ptr != this->sq_ptr) {
+        munmap(this->cq_ptr, this->cq_size);
+    }
+    this->cq_ptr = MAP_FAILED;
+    if (this->sq_ptr != MAP_FAILED) {
+        munmap(this->sq_ptr, this->sq_size);
+        this->sq_ptr = MAP_FAILED;
+    }
+    if (this->fd >= 0) {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+#else
+bool IOUring::initialize(unsigned entries) {
+    return false;
+}
+
+bool IOUring::setup_buffers(unsigned count, unsigned size, uint16_t group) {
+    return false;
+}
+
+bool IOUring::prepare_accept(int fd, uint64_t user_data) {
+    return false;
+}
+
+bool IOUring::prepare_recv(int fd, uint64_t user_data) {
+    return false;
+}
+
+bool IOUring::prepare_sendmsg(int fd, const msghdr *msg, uint64_t user_data) {
+    return false;
+}
+
+bool IOUring::prepare_cancel(uint64_t target, uint64_t user_data) {
+    return false;
+}
+
+io_uring_sqe * IOUring::get_sqe() {
+    return nullptr;
+}
+
+int IOUring::submit() {
+    return -1;
+}
+
+size_t IOUring::reap(const CompletionHandler &handler) {
+    return 0;
+}
+
+char * IOUring::get_buffer(uint16_t id) const {
+    return nullptr;
+}
+
+void IOUring::recycle_buffer(uint16_t id) {}
+
+void IOUring::flush_recycling() {}
+
+bool IOUring::provide_buffer(uint16_t id) {
+    return false;
+}
+
+void IOUring::release() {}
+#endif
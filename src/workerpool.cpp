@@ -0,0 +1,87 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "recycled/workerpool.h"
+
+using namespace recycled;
+
+WorkerPool::WorkerPool(size_t threads, size_t max_queue):
+    max_queue(max_queue), active(0), stopped(false) {
+    if (!threads) {
+        threads = std::thread::hardware_concurrency();
+        if (!threads) {
+            threads = 1;
+        }
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        this->threads.push_back(std::thread(&WorkerPool::run, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopped = true;
+    }
+    this->cond.notify_all();
+    for (std::thread &t: this->threads) {
+        t.join();
+    }
+}
+
+bool WorkerPool::submit(const Job &job) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->stopped || this->jobs.size() >= this->max_queue) {
+            return false;
+        }
+        this->jobs.push_back(job);
+    }
+    this->cond.notify_one();
+    return true;
+}
+
+size_t WorkerPool::get_queue_size() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->jobs.size();
+}
+
+size_t WorkerPool::cancel() {
+    std::deque<Job> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        cancelled.swap(this->jobs);
+    }
+    // 任务持有的对象在锁外释放, 它们的析构可能再提交任务
+    return cancelled.size();
+}
+
+bool WorkerPool::is_idle() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->jobs.empty() && !this->active;
+}
+
+void WorkerPool::run() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            while (!this->stopped && this->jobs.empty()) {
+                this->cond.wait(lock);
+            }
+            if (this->jobs.empty()) {
+                return;
+            }
+            job = this->jobs.front();
+            this->jobs.pop_front();
+            ++this->active;
+        }
+        job();
+        job = nullptr;
+        std::lock_guard<std::mutex> lock(this->mutex);
+        --this->active;
+    }
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <utime.h>
+#include <string>
+#include <thread>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// conditional GET: automatic ETags, and 304 responses carrying the same Vary as 200,
+// and static files and cached assets answered by their modification time
+
+static const std::string Text(200, 't');
+static const char *LastModified = "Sun, 06 Nov 1994 08:49:37 GMT";
+static const time_t ModifiedTime = 784111777;
+static const char *Earlier = "Sun, 06 Nov 1994 08:49:36 GMT";
+static const char *Later = "Mon, 07 Nov 1994 08:49:37 GMT";
+
+/**
+ * A directory holding file.txt, last modified at ModifiedTime.
+ */
+static std::string make_root() {
+    char root[] = "/tmp/conditional.XXXXXX";
+    if (!mkdtemp(root)) {
+        return "";
+    }
+    std::string path = std::string(root) + "/file.txt";
+    FILE *file = fopen(path.c_str(), "w");
+    if (file) {
+        fputs("static file", file);
+        fclose(file);
+    }
+    utimbuf times = {ModifiedTime, ModifiedTime};
+    CHECK_EQUAL(utime(path.c_str(), &times), 0);
+    return root;
+}
+
+static void remove_root(const std::string &root) {
+    unlink((root + "/file.txt").c_str());
+    rmdir(root.c_str());
+}
+
+static Response get(uint16_t port, const std::string &target, const std::string &headers) {
+    return parse_response(exchange(port, "GET " + target + " HTTP/1.1\r\nHost: a\r\n"
+                                   "Connection: close\r\n" + headers + "\r\n"));
+}
+
+static void test_auto_etag(uint16_t port) {
+    Response response = get(port, "/text", "");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.header("Vary"), "Accept-Encoding");
+    CHECK_EQUAL(response.body, Text);
+    std::string etag = response.header("ETag");
+    CHECK(etag.compare(0, 2, "W/") == 0);
+    // the 304 must vary like the 200 it revalidates
+    response = get(port, "/text", "If-None-Match: " + etag + "\r\nAccept-Encoding: gzip\r\n");
+    CHECK_EQUAL(response.status, 304);
+    CHECK_EQUAL(response.header("ETag"), etag);
+    CHECK_EQUAL(response.header("Vary"), "Accept-Encoding");
+    CHECK(!response.has_header("Content-Encoding"));
+    CHECK_EQUAL(response.body, "");
+    // too short to compress: neither carries Vary
+    response = get(port, "/short", "");
+    CHECK_EQUAL(response.status, 200);
+    CHECK(!response.has_header("Vary"));
+    response = get(port, "/short", "If-None-Match: " + response.header("ETag") + "\r\n");
+    CHECK_EQUAL(response.status, 304);
+    CHECK(!response.has_header("Vary"));
+}
+
+static void test_static_file(uint16_t port, const std::string &target) {
+    Response response = get(port, target, "");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.header("Last-Modified"), LastModified);
+    CHECK_EQUAL(response.body, "static file");
+    // not modified since the same or a later date, even with Range
+    const char *dates[] = {LastModified, Later};
+    for (const char *date : dates) {
+        response = get(port, target, "If-Modified-Since: " + std::string(date) + "\r\n");
+        CHECK_EQUAL(response.status, 304);
+        CHECK_EQUAL(response.header("Last-Modified"), LastModified);
+        CHECK_EQUAL(response.body, "");
+    }
+    response = get(port, target, "If-Modified-Since: " + std::string(LastModified) +
+                   "\r\nRange: bytes=0-5\r\n");
+    CHECK_EQUAL(response.status, 304);
+    CHECK_EQUAL(response.body, "");
+    response = parse_response(exchange(port, "HEAD " + target + " HTTP/1.1\r\nHost: a\r\n"
+        "If-Modified-Since: " + LastModified + "\r\nConnection: close\r\n\r\n"));
+    CHECK_EQUAL(response.status, 304);
+    // modified since, or a date that cannot be parsed
+    response = get(port, target, "If-Modified-Since: " + std::string(Earlier) + "\r\n");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, "static file");
+    response = get(port, target, "If-Modified-Since: yesterday\r\n");
+    CHECK_EQUAL(response.status, 200);
+    // If-None-Match wins over If-Modified-Since
+    response = get(port, target, "If-None-Match: \"x\"\r\nIf-Modified-Since: " +
+                   std::string(LastModified) + "\r\n");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, "static file");
+}
+
+template<typename T>
+void run(uint16_t port, const std::string &root) {
+    StaticFileHandler files(root);
+    AssetCache assets(root, 1024 * 1024);
+    Application<T> app({
+        {"/files/<.+:path>", files, {HTTPMethod::GET, HTTPMethod::HEAD}},
+        {"/assets/<.+:path>", assets, {HTTPMethod::GET, HTTPMethod::HEAD}},
+        {"/text", [](Connection &conn) {
+            conn.add_header("Content-Type", "text/plain");
+            conn.write(Text);
+        }, {HTTPMethod::GET}},
+        {"/short", [](Connection &conn) {
+            conn.add_header("Content-Type", "text/plain");
+            conn.write("short");
+        }, {HTTPMethod::GET}},
+    });
+    app.get_server().set_compression(64);
+    app.get_server().set_auto_etag();
+    app.listen(port);
+    CHECK(assets.initialize());
+    IOLoop &loop = IOLoop::get_instance();
+    std::thread client([&]() {
+        test_auto_etag(port);
+        test_static_file(port, "/files/file.txt");
+        test_static_file(port, "/assets/file.txt");
+        Response response = get(port, "/assets/file.txt", "");
+        response = get(port, "/assets/file.txt", "If-None-Match: " +
+                       response.header("ETag") + "\r\n");
+        CHECK_EQUAL(response.status, 304);
+        loop.post([&]() {
+            app.shutdown(1000);
+        });
+    });
+    loop.start();
+    client.join();
+}
+
+int main() {
+    std::string root = make_root();
+    CHECK(!root.empty());
+    run<HTTPServer>(18151, root);
+    run<EpollServer>(18152, root);
+    remove_root(root);
+    return test_result("conditional");
+}
@@ -0,0 +1,164 @@
+#include <string>
+#include <thread>
+#include <stdexcept>
+#include <recycled.h>
+#include <recycled/coroutine.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// coroutines resume on the loop thread after delay, run_in_worker and fetch
+
+static const uint16_t Port = 18131;
+static const uint16_t SilentPort = 18132;
+static const uint16_t ClosedPort = 18133;
+
+WorkerPool pool(2);
+
+Task<std::string> slow_greeting() {
+    co_await delay(100);
+    co_return "hello, coroutine handler.";
+}
+
+Task<void> index_handler(Connection &conn) {
+    const std::string &greeting = co_await slow_greeting();
+    conn.write(greeting);
+}
+
+Task<void> worker_handler(Connection &conn) {
+    int sum = co_await run_in_worker(pool, []() {
+        int sum = 0;
+        for (int i = 1; i <= 100; ++i) {
+            sum += i;
+        }
+        return sum;
+    });
+    conn.write(std::to_string(sum));
+}
+
+Task<void> proxy_handler(Connection &conn) {
+    std::string port = conn.get_argument("port");
+    FetchResponse response = co_await fetch("http://127.0.0.1:" + port + "/",
+                                            HTTPMethod::GET, "", 300);
+    conn.set_status(response.status ? response.status :
+                    (response.timed_out ? 504 : 502));
+    conn.write(response.body);
+}
+
+/**
+ * A socket that accepts connections in the kernel backlog and never answers.
+ */
+static int silent_listener(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static std::string local(uint16_t port, const std::string &target) {
+    return "http://127.0.0.1:" + std::to_string(port) + target;
+}
+
+Task<void> checks(bool &done) {
+    std::thread::id loop_thread = std::this_thread::get_id();
+    uint64_t begin = IOLoop::monotonic_time();
+    co_await delay(50);
+    CHECK(IOLoop::monotonic_time() - begin >= 50);
+    CHECK(std::this_thread::get_id() == loop_thread);
+    // a value and an exception come back from the worker thread
+    std::thread::id worker_thread;
+    int value = co_await run_in_worker(pool, [&worker_thread]() {
+        worker_thread = std::this_thread::get_id();
+        return 42;
+    });
+    CHECK_EQUAL(value, 42);
+    CHECK(worker_thread != loop_thread);
+    CHECK(std::this_thread::get_id() == loop_thread);
+    bool caught = false;
+    try {
+        co_await run_in_worker(pool, []() -> int {
+            throw std::runtime_error("failed in worker");
+        });
+    } catch (const std::runtime_error &e) {
+        caught = std::string(e.what()) == "failed in worker";
+    }
+    CHECK(caught);
+    CHECK(std::this_thread::get_id() == loop_thread);
+    // a refused connection resumes with status 0
+    FetchResponse response = co_await fetch(local(ClosedPort, "/"));
+    CHECK_EQUAL(response.status, 0);
+    CHECK(!response.timed_out);
+    CHECK(std::this_thread::get_id() == loop_thread);
+    // an upstream that never answers resumes after the timeout
+    begin = IOLoop::monotonic_time();
+    response = co_await fetch(local(SilentPort, "/"), HTTPMethod::GET, "", 200);
+    uint64_t elapsed = IOLoop::monotonic_time() - begin;
+    CHECK_EQUAL(response.status, 0);
+    CHECK(response.timed_out);
+    CHECK(elapsed >= 190 && elapsed < 2000);
+    CHECK(std::this_thread::get_id() == loop_thread);
+    caught = false;
+    try {
+        co_await fetch("https://127.0.0.1/");
+    } catch (const CoroutineException &e) {
+        caught = true;
+    }
+    CHECK(caught);
+    // the coroutine handlers of our own server
+    response = co_await fetch(local(Port, "/"));
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, "hello, coroutine handler.");
+    response = co_await fetch(local(Port, "/worker"));
+    CHECK_EQUAL(response.body, "5050");
+    response = co_await fetch(local(Port, "/proxy?port=" + std::to_string(Port)));
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, "hello, coroutine handler.");
+    response = co_await fetch(local(Port, "/proxy?port=" + std::to_string(SilentPort)));
+    CHECK_EQUAL(response.status, 504);
+    response = co_await fetch(local(Port, "/proxy?port=" + std::to_string(ClosedPort)));
+    CHECK_EQUAL(response.status, 502);
+    done = true;
+}
+
+Task<void> run_checks(Application<HTTPServer> &app, bool &done) {
+    try {
+        co_await checks(done);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "unexpected exception: %s\n", e.what());
+        ++test_failures;
+    }
+    app.shutdown(1000);
+}
+
+int main() {
+    int silent = silent_listener(SilentPort);
+    CHECK(silent >= 0);
+    Application<HTTPServer> app({
+        {"/", coroutine_handler(index_handler), {HTTPMethod::GET}},
+        {"/worker", coroutine_handler(worker_handler), {HTTPMethod::GET}},
+        {"/proxy", coroutine_handler(proxy_handler), {HTTPMethod::GET}},
+    });
+    app.listen(Port);
+    IOLoop &loop = IOLoop::get_instance();
+    bool done = false;
+    loop.call_soon([&]() {
+        spawn(run_checks(app, done));
+    });
+    // fail instead of hanging when a coroutine is never resumed
+    loop.call_later(10000, [&]() {
+        loop.stop();
+    });
+    loop.start();
+    CHECK(done);
+    close(silent);
+    return test_result("coroutine");
+}
@@ -0,0 +1,132 @@
+#include <ctype.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// request headers as seen by handlers, and by evhttp when it sends the response
+
+/**
+ * Whether the server closed the connection after answering, rather than
+ * leaving it open until exchange gave up.
+ */
+static bool closed_after(uint16_t port, const std::string &request, std::string &response) {
+    auto begin = std::chrono::steady_clock::now();
+    response = exchange(port, request, 1500);
+    return std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(1000);
+}
+
+static void test_connection(uint16_t port) {
+    std::string response;
+    // every request header must still reach evhttp when it decides about keep-alive
+    CHECK(closed_after(port, "GET /h HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n",
+                       response));
+    CHECK(response.find("200 OK") != std::string::npos);
+    CHECK(!closed_after(port, "GET /h HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", response));
+    CHECK(response.find("200 OK") != std::string::npos);
+    CHECK(closed_after(port, "GET /h HTTP/1.0\r\n\r\n", response));
+    CHECK(!closed_after(port, "GET /h HTTP/1.1\r\nHost: a\r\n\r\n", response));
+    // evhttp reads Proxy-Connection for requests with an absolute URI
+    CHECK(!closed_after(port, "GET http://a/h HTTP/1.1\r\nHost: a\r\n"
+                        "Proxy-Connection: keep-alive\r\n\r\n", response));
+    CHECK(response.find("200 OK") != std::string::npos);
+    CHECK(closed_after(port, "GET http://a/h HTTP/1.1\r\nHost: a\r\n\r\n", response));
+    // the same headers are still readable by the handler after the reply
+    CHECK(closed_after(port, "GET /late HTTP/1.1\r\nHost: a\r\nX-Late: yes\r\n"
+                       "Connection: close\r\n\r\n", response));
+    CHECK(response.find("200 OK") != std::string::npos);
+}
+
+static std::string echo(uint16_t port, const std::string &headers) {
+    return parse_response(exchange(port, "GET /echo HTTP/1.1\r\nHost: a\r\n"
+                                   "Connection: close\r\n" + headers + "\r\n")).body;
+}
+
+static void test_repeated(uint16_t port) {
+    // names in any case reach the same header
+    CHECK_EQUAL(echo(port, "accept: text/html\r\nCOOKIE: a=1\r\nx-other: o\r\n"),
+                "accept=text/html\ncookie=a=1\na=1\nb=\nother=o\nhost=a\n");
+    // list-valued headers are joined, Cookie with "; "
+    CHECK_EQUAL(echo(port, "Accept: text/html\r\nCookie: a=1\r\nAccept: */*\r\n"
+                     "Cookie: b=2\r\n"),
+                "accept=text/html, */*\ncookie=a=1; b=2\na=1\nb=2\nother=\nhost=a\n");
+    CHECK_EQUAL(echo(port, "Accept:\r\nAccept: a\r\nAccept:\r\nAccept: b\r\n"),
+                "accept=a, b\ncookie=\na=\nb=\nother=\nhost=a\n");
+    // any other repeated header keeps its first value
+    CHECK_EQUAL(echo(port, "Host: b\r\nX-Other: 1\r\nX-Other: 2\r\n"),
+                "accept=\ncookie=\na=\nb=\nother=1\nhost=a\n");
+}
+
+static void test_known_names() {
+    const char *names[] = {
+        "Host", "Connection", "Content-Type", "Content-Length", "Transfer-Encoding",
+        "Cookie", "Accept", "Accept-Encoding", "Accept-Language", "User-Agent",
+        "Referer", "Origin", "Authorization", "If-None-Match", "If-Modified-Since",
+        "If-Match", "If-Unmodified-Since", "If-Range", "Range", "Expect"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        std::string lower = names[i];
+        for (char &c : lower) {
+            c = tolower(c);
+        }
+        CHECK(find_known_header(names[i]) == HTTPHeader(i));
+        CHECK(find_known_header(lower) == HTTPHeader(i));
+    }
+    // same length and distinguishing character, but another name
+    const char *others[] = {"", "Hose", "Ranges", "Cookies", "If-Latch", "Connexion",
+                            "Accept-Encodinx", "X-Forwarded-For", "If-None-Matc"};
+    for (const char *name : others) {
+        CHECK(find_known_header(name) == HTTPHeader::Other);
+    }
+}
+
+template<typename T>
+void run(uint16_t port, bool evhttp) {
+    std::string late;
+    Application<T> app({
+        {"/h", [](Connection &conn) {
+            // evhttp keeps a proxied connection only when both sides ask for it
+            conn.add_header("Proxy-Connection", "keep-alive");
+            conn.write("ok");
+        }, {HTTPMethod::GET}},
+        {"/late", [&late](Connection &conn) {
+            conn.write("ok");
+            conn.finish();
+            sleep_ms(100);
+            late = conn.get_header("X-Late");
+        }, {HTTPMethod::GET}, Blocking},
+        {"/echo", [](Connection &conn) {
+            conn.write("accept=" + conn.get_header("Accept") + "\n");
+            conn.write("cookie=" + conn.get_header("cookie") + "\n");
+            conn.write("a=" + conn.get_cookie("a") + "\n");
+            conn.write("b=" + conn.get_cookie("b") + "\n");
+            conn.write("other=" + conn.get_header("X-OTHER") + "\n");
+            conn.write("host=" + conn.get_header("Host") + "\n");
+        }, {HTTPMethod::GET}},
+    });
+    app.listen(port);
+    IOLoop &loop = IOLoop::get_instance();
+    std::thread client([&]() {
+        if (evhttp) {
+            test_connection(port);
+        }
+        test_repeated(port);
+        loop.post([&]() {
+            app.shutdown(1000);
+        });
+    });
+    loop.start();
+    client.join();
+    if (evhttp) {
+        CHECK_EQUAL(late, "yes");
+    }
+}
+
+int main() {
+    test_known_names();
+    run<HTTPServer>(18141, true);
+    run<EpollServer>(18142, false);
+    return test_result("headers");
+}
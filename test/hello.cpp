@@ -40,6 +40,7 @@ int main() {
         {"/custom", custom_handler_binded, {HTTPMethod::GET}},
     });
     app.listen(8080);
+    app.shutdown_on_signal(SIGTERM, 10000);
     IOLoop::get_instance().start();
     return 0;
 }
\ No newline at end of file
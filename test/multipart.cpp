@@ -0,0 +1,146 @@
+#include <string>
+#include <vector>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// MultipartParser fed the same body in every possible split
+
+struct Part {
+    std::string name;
+    std::string filename;
+    std::string content_type;
+    std::string data;
+    bool ended;
+};
+
+struct Result {
+    std::vector<Part> parts;
+    bool ok;
+    bool finished;
+};
+
+static bool operator==(const Part &a, const Part &b) {
+    return a.name == b.name && a.filename == b.filename &&
+           a.content_type == b.content_type && a.data == b.data && a.ended == b.ended;
+}
+
+static bool operator==(const Result &a, const Result &b) {
+    return a.parts == b.parts && a.ok == b.ok && a.finished == b.finished;
+}
+
+/**
+ * Feeds body to a fresh parser in pieces cut at the given offsets.
+ */
+static Result parse(const std::string &body, const std::vector<size_t> &cuts) {
+    MultipartParser parser("xyz");
+    Result result = {std::vector<Part>(), true, false};
+    CHECK(parser.initialize());
+    parser.set_part_handler([&](const MultipartPart &part) {
+        Part p = {part.name.str(), part.filename.str(), part.content_type.str(),
+                  std::string(), false};
+        result.parts.push_back(p);
+    });
+    parser.set_data_handler([&](const char *data, size_t size) {
+        CHECK(!result.parts.empty() && !result.parts.back().ended);
+        if (!result.parts.empty()) {
+            result.parts.back().data.append(data, size);
+        }
+    });
+    parser.set_end_handler([&]() {
+        CHECK(!result.parts.empty());
+        if (!result.parts.empty()) {
+            result.parts.back().ended = true;
+        }
+    });
+    size_t start = 0;
+    for (size_t i = 0; i <= cuts.size(); ++i) {
+        size_t end = i < cuts.size() ? cuts[i] : body.size();
+        result.ok = parser.feed(body.data() + start, end - start) && result.ok;
+        start = end;
+    }
+    result.finished = parser.is_finished();
+    return result;
+}
+
+/**
+ * Every split into two pieces, and byte by byte, gives the same result as one piece.
+ */
+static void check_splits(const std::string &body, const Result &expected) {
+    CHECK(parse(body, {}) == expected);
+    for (size_t i = 0; i <= body.size(); ++i) {
+        if (!(parse(body, {i}) == expected)) {
+            fprintf(stderr, "split at %zu differs\n", i);
+            ++test_failures;
+        }
+    }
+    std::vector<size_t> bytes;
+    for (size_t i = 1; i < body.size(); ++i) {
+        bytes.push_back(i);
+    }
+    CHECK(parse(body, bytes) == expected);
+}
+
+static const std::string Body =
+    "preamble\r\n--xyz\r\n"
+    "Content-Disposition: form-data; name=\"a\"\r\n\r\n"
+    "value a\r\n"
+    "--xyz  \r\n"
+    "\r\n"
+    "no headers\r\n"
+    "--xyz\r\n"
+    "Content-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n"
+    "Content-Type: text/plain\r\n\r\n"
+    "line\r\n--xy not a boundary\r\n-xyz\rdata--xyz\r\r\n--\r\n"
+    "--xyz--\r\n"
+    "epilogue --xyz\r\n";
+
+static void test_complete() {
+    Result expected = {{
+        {"a", "", "", "value a", true},
+        {"", "", "", "no headers", true},
+        {"f", "f.txt", "text/plain",
+         "line\r\n--xy not a boundary\r\n-xyz\rdata--xyz\r\r\n--", true},
+    }, true, true};
+    check_splits(Body, expected);
+    // an empty part and an empty body
+    check_splits("--xyz\r\n\r\n\r\n--xyz--", {{{"", "", "", "", true}}, true, true});
+    check_splits("--xyz--", {{}, true, true});
+}
+
+static void test_truncated() {
+    // without the closing delimiter the parser never finishes
+    std::string body = Body.substr(0, Body.find("--xyz--"));
+    Result expected = {{
+        {"a", "", "", "value a", true},
+        {"", "", "", "no headers", true},
+        {"f", "f.txt", "text/plain",
+         "line\r\n--xy not a boundary\r\n-xyz\rdata--xyz\r\r\n--", false},
+    }, true, false};
+    check_splits(body, expected);
+    for (size_t size = 0; size < Body.find("--xyz--\r\n") + 7; ++size) {
+        Result result = parse(Body.substr(0, size), {});
+        CHECK(result.ok);
+        CHECK(!result.finished);
+    }
+}
+
+static void test_malformed() {
+    // a delimiter followed by anything but "--", CRLF or padding
+    check_splits("--xyz\r\n\r\n1\r\n--xyzX\r\n\r\n2\r\n--xyz--",
+                 {{{"", "", "", "1", true}}, false, false});
+    check_splits("--xyz\r\r\n", {{}, false, false});
+    // headers that never end
+    std::string headers = "--xyz\r\nX: " + std::string(20000, 'h');
+    Result result = parse(headers, {});
+    CHECK(!result.ok);
+    CHECK(result.parts.empty());
+}
+
+int main() {
+    test_complete();
+    test_truncated();
+    test_malformed();
+    return test_result("multipart");
+}
@@ -0,0 +1,213 @@
+#include <thread>
+#include <functional>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// raw requests against EpollServer's HTTP/1.1 parser
+
+static void test_framing(uint16_t port) {
+    // Content-Length together with Transfer-Encoding is the classic smuggling vector
+    std::string response = exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 5\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\nGET /smuggled HTTP/1.1\r\n\r\n");
+    CHECK(response.compare(0, 12, "HTTP/1.1 400") == 0);
+    CHECK(response.find("smuggled") == std::string::npos);
+    CHECK_EQUAL(count(response, "HTTP/1.1"), 1u);
+    response = exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+        "content-length: 3\r\n\r\n3\r\nabc\r\n0\r\n\r\n");
+    CHECK(response.compare(0, 12, "HTTP/1.1 400") == 0);
+}
+
+static bool is_status(const std::string &response, int status) {
+    return response.compare(0, 13, "HTTP/1.1 " + std::to_string(status) + " ") == 0;
+}
+
+static void test_line_endings(uint16_t port) {
+    // a bare CR or LF could end a header line for one parser but not for another
+    CHECK(is_status(exchange(port,
+        "GET / HTTP/1.1\r\nHost: a\rX-Hidden: 1\r\nConnection: close\r\n\r\n"), 400));
+    CHECK(is_status(exchange(port,
+        "GET / HTTP/1.1\r\nHost: a\nX-Hidden: 1\r\nConnection: close\r\n\r\n"), 400));
+    CHECK(is_status(exchange(port,
+        "GET /\r HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n"), 400));
+    // empty lines before a request are ignored
+    std::string response = exchange(port,
+        "\r\n\r\nGET / HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n");
+    CHECK(is_status(response, 200));
+    CHECK(response.find("body:") != std::string::npos);
+}
+
+static void test_content_length(uint16_t port) {
+    // the same length twice is harmless, two different ones are not
+    std::string response = exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 3\r\nContent-Length: 3\r\n"
+        "Connection: close\r\n\r\nabc");
+    CHECK(is_status(response, 200));
+    CHECK(response.find("body:abc") != std::string::npos);
+    response = exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 3\r\nContent-Length: 4\r\n"
+        "Connection: close\r\n\r\nabcd");
+    CHECK(is_status(response, 400));
+    CHECK_EQUAL(count(response, "HTTP/1.1"), 1u);
+    CHECK(is_status(exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: +3\r\n"
+        "Connection: close\r\n\r\nabc"), 400));
+    CHECK(is_status(exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 3, 3\r\n"
+        "Connection: close\r\n\r\nabc"), 400));
+}
+
+static void test_chunked(uint16_t port) {
+    // extensions are ignored, trailers are read and dropped
+    std::string response = exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+        "Connection: close\r\n\r\n"
+        "5;name=value\r\nhello\r\n6 ; x=\"y\"\r\n world\r\nA\r\n0123456789\r\n"
+        "0;last\r\nX-Trailer: 1\r\nX-Other: 2\r\n\r\n");
+    CHECK(is_status(response, 200));
+    CHECK(response.find("body:hello world0123456789") != std::string::npos);
+    // the same body split at awkward places
+    response = exchange(port, {
+        "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+        "Connection: close\r\n\r\n5;na", "me\r\nhel", "lo\r", "\n0\r\nX-Tr",
+        "ailer: 1\r\n", "\r\n"}, 20);
+    CHECK(is_status(response, 200));
+    CHECK(response.find("body:hello") != std::string::npos);
+    // sizes strtoull would accept but other parsers read differently
+    const char *sizes[] = {"0x5", "+5", " 5", "-1", "g"};
+    for (const char *size : sizes) {
+        CHECK(is_status(exchange(port,
+            "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+            "Connection: close\r\n\r\n" + std::string(size) +
+            "\r\nhello\r\n0\r\n\r\n"), 400));
+    }
+    // the data must be followed by CRLF
+    CHECK(is_status(exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+        "Connection: close\r\n\r\n5\r\nhelloXX0\r\n\r\n"), 400));
+    CHECK(is_status(exchange(port,
+        "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: gzip, chunked\r\n"
+        "Connection: close\r\n\r\n0\r\n\r\n"), 501));
+}
+
+static void test_pipelining(uint16_t port) {
+    // three requests in one packet are answered in order
+    std::string response = exchange(port,
+        "GET / HTTP/1.1\r\nHost: a\r\n\r\n"
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 3\r\n\r\none"
+        "POST / HTTP/1.1\r\nHost: a\r\nTransfer-Encoding: chunked\r\n"
+        "Connection: close\r\n\r\n3\r\ntwo\r\n0\r\n\r\n");
+    CHECK_EQUAL(count(response, "HTTP/1.1 200"), 3u);
+    size_t first = response.find("body:\r\n");
+    size_t second = response.find("body:one");
+    size_t third = response.find("body:two");
+    CHECK(first == std::string::npos || first < second);
+    CHECK(second != std::string::npos && third != std::string::npos && second < third);
+    // a request boundary in the middle of a packet
+    response = exchange(port, std::vector<std::string>{
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 3\r\n\r\non",
+        "eGET /smuggled HTTP/1.1\r\nHost: a\r\nConnection: close\r\n\r\n"}, 20);
+    CHECK_EQUAL(count(response, "HTTP/1.1 200"), 2u);
+    CHECK(response.find("body:one") < response.find("smuggled"));
+    // an error stops the pipeline, later requests are not processed
+    response = exchange(port,
+        "GET / HTTP/1.1\r\nHost: a\r\n\r\n"
+        "GET / HTTP/1.1\r\nHost: a\rb\r\n\r\n"
+        "GET /smuggled HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK_EQUAL(count(response, "HTTP/1.1 200"), 1u);
+    CHECK_EQUAL(count(response, "HTTP/1.1 400"), 1u);
+    CHECK(response.find("smuggled") == std::string::npos);
+}
+
+static void test_slow_body(uint16_t port) {
+    // every piece arrives within the idle timeout, the whole body takes longer
+    std::vector<std::string> pieces = {
+        "POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 6\r\nConnection: close\r\n\r\n"};
+    for (char c = 'a'; c < 'g'; ++c) {
+        pieces.push_back(std::string(1, c));
+    }
+    std::string response = exchange(port, pieces, 400);
+    CHECK(is_status(response, 200));
+    CHECK(response.find("body:abcdef") != std::string::npos);
+}
+
+static std::string form_request(const std::string &body) {
+    return "POST /form HTTP/1.1\r\nHost: a\r\n"
+           "Content-Type: multipart/form-data; boundary=xyz\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "Connection: close\r\n\r\n" + body;
+}
+
+static void test_multipart(uint16_t port) {
+    // the large field and the file go to temporary files
+    std::string large(100, 'v');
+    std::string response = exchange(port, form_request(
+        "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n" + large +
+        "\r\n--xyz\r\nContent-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n"
+        "\r\n" + large + large + "\r\n--xyz--\r\n"));
+    CHECK(is_status(response, 200));
+    CHECK(response.find("a=" + large + " f=200") != std::string::npos);
+    // a truncated body is not handed to the handler as a shorter form
+    response = exchange(port, form_request(
+        "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n" + large +
+        "\r\n--xyz\r\nContent-Disposition: form-data; name=\"f\"; filename=\"f.txt\"\r\n"
+        "\r\n" + large));
+    CHECK(is_status(response, 400));
+    response = exchange(port, form_request(
+        "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n" + large +
+        "\r\n--xyzX"));
+    CHECK(is_status(response, 400));
+    // a small body is parsed lazily in memory, the handler sees an empty form
+    response = exchange(port, form_request(
+        "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n--xyzX"));
+    CHECK(response.find("a= f=0") != std::string::npos);
+    response = exchange(port, form_request(
+        "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n--xyz\r\n"));
+    CHECK(response.find("a= f=0") != std::string::npos);
+    response = exchange(port, form_request(
+        "--xyz\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n1\r\n--xyz--"));
+    CHECK(response.find("a=1 f=0") != std::string::npos);
+}
+
+static void run(IOBackend backend, uint16_t port) {
+    Application<EpollServer> app({
+        {"/", [](Connection &conn) {
+            conn.write("body:" + conn.copy_body());
+        }, {HTTPMethod::GET, HTTPMethod::POST}},
+        {"/form", [](Connection &conn) {
+            const UploadFile *file = conn.get_file("f");
+            conn.write("a=" + conn.get_body_argument("a") + " f=" +
+                       std::to_string(file ? file->size : 0));
+        }, {HTTPMethod::POST}},
+        {"/smuggled", [](Connection &conn) {
+            conn.write("smuggled");
+        }, {HTTPMethod::GET}},
+    }, backend);
+    app.get_server().set_timeout(1000);
+    app.get_server().set_spill_threshold(64);
+    app.listen(port);
+    IOLoop &loop = IOLoop::get_instance();
+    std::thread client([&]() {
+        test_line_endings(port);
+        test_content_length(port);
+        test_chunked(port);
+        test_framing(port);
+        test_pipelining(port);
+        test_slow_body(port);
+        test_multipart(port);
+        loop.post([&]() {
+            app.shutdown(1000);
+        });
+    });
+    loop.start();
+    client.join();
+}
+
+int main() {
+    run(IOBackend::Epoll, 18111);
+    run(IOBackend::IOUring, 18112);
+    return test_result("parser");
+}
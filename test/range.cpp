@@ -0,0 +1,227 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// Range requests: parse_range, if_range_matches and Connection::write_ranges
+
+static const std::string Body = "abcdefghijklmnopqrstuvwxyz";
+static const char *ETag = "\"b1\"";
+static const char *LastModified = "Sun, 06 Nov 1994 08:49:37 GMT";
+
+static bool ranges_equal(const std::vector<ByteRange> &ranges,
+                         const std::vector<std::pair<uint64_t, uint64_t>> &expected) {
+    if (ranges.size() != expected.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (ranges[i].first != expected[i].first || ranges[i].last != expected[i].second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_parse_range() {
+    std::vector<ByteRange> ranges;
+    CHECK_EQUAL(parse_range("bytes=0-4", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{0, 4}}));
+    CHECK_EQUAL(parse_range("bytes=20-", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{20, 25}}));
+    CHECK_EQUAL(parse_range("bytes=20-100", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{20, 25}}));
+    // suffix ranges, longer than the body means all of it
+    CHECK_EQUAL(parse_range("bytes=-3", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{23, 25}}));
+    CHECK_EQUAL(parse_range("bytes=-100", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{0, 25}}));
+    // "-0" and a first byte past the end cannot be satisfied
+    CHECK_EQUAL(parse_range("bytes=-0", 26, ranges), -1);
+    CHECK_EQUAL(parse_range("bytes=26-", 26, ranges), -1);
+    CHECK_EQUAL(parse_range("bytes=26-30, 40-50", 26, ranges), -1);
+    CHECK_EQUAL(parse_range("bytes=0-", 0, ranges), -1);
+    CHECK_EQUAL(parse_range("bytes=-5", 0, ranges), -1);
+    // unsatisfiable ranges next to a good one are dropped
+    CHECK_EQUAL(parse_range("bytes=-0, 30-, 1-1", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{1, 1}}));
+    // sorted, overlapping and adjacent ranges merged
+    CHECK_EQUAL(parse_range("bytes=20-, 5-9, 0-0, 3-4, 0-1, 8-12", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{0, 1}, {3, 12}, {20, 25}}));
+    CHECK_EQUAL(parse_range("bytes=0-10, -20", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{0, 25}}));
+    CHECK_EQUAL(parse_range(" BYTES=1-2 ,, 4-5 ", 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{1, 2}, {4, 5}}));
+    // anything malformed means the header is ignored
+    const char *ignored[] = {
+        "", "bytes=", "bytes=,", "items=0-1", "bytes 0-1", "bytes=5-2", "bytes=a-b",
+        "bytes=1", "bytes=0-1, x", "bytes=--1", "bytes=0-99999999999999999999"};
+    for (const char *header : ignored) {
+        if (parse_range(header, 26, ranges) != 0) {
+            fprintf(stderr, "Range \"%s\" was not ignored\n", header);
+            ++test_failures;
+        }
+    }
+    // at most 16 ranges, counted before merging
+    std::string header = "bytes=0-0";
+    for (int i = 1; i < 16; ++i) {
+        header += ", " + std::to_string(i) + "-" + std::to_string(i);
+    }
+    CHECK_EQUAL(parse_range(header, 26, ranges), 1);
+    CHECK(ranges_equal(ranges, {{0, 15}}));
+    CHECK_EQUAL(parse_range(header + ", 0-0", 26, ranges), 0);
+}
+
+static void test_if_range() {
+    CHECK(if_range_matches(ETag, ETag, LastModified));
+    CHECK(if_range_matches(" \"b1\" ", ETag, ""));
+    CHECK(!if_range_matches("\"b2\"", ETag, LastModified));
+    // weak validators never match, on either side
+    CHECK(!if_range_matches("W/\"b1\"", ETag, LastModified));
+    CHECK(!if_range_matches("W/\"b1\"", "W/\"b1\"", LastModified));
+    CHECK(!if_range_matches("\"b1\"", "W/\"b1\"", LastModified));
+    CHECK(!if_range_matches(ETag, "", LastModified));
+    // dates must be equal to Last-Modified
+    CHECK(if_range_matches(LastModified, ETag, LastModified));
+    CHECK(!if_range_matches("Sun, 06 Nov 1994 08:49:38 GMT", ETag, LastModified));
+    CHECK(!if_range_matches("Sun, 06 Nov 1994 08:49:36 GMT", ETag, LastModified));
+    CHECK(!if_range_matches(LastModified, ETag, ""));
+    CHECK(!if_range_matches("yesterday", ETag, LastModified));
+    CHECK(!if_range_matches("", ETag, LastModified));
+}
+
+static Response get(uint16_t port, const std::string &headers,
+                    const char *method = "GET") {
+    return parse_response(exchange(port, std::string(method) +
+        " /r HTTP/1.1\r\nHost: a\r\nConnection: close\r\n" + headers + "\r\n"));
+}
+
+/**
+ * The multipart/byteranges body write_ranges should produce.
+ */
+static std::string byteranges(const std::string &boundary,
+                              const std::vector<std::pair<uint64_t, uint64_t>> &ranges) {
+    std::string body;
+    for (const auto &r : ranges) {
+        body += "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\n"
+                "Content-Range: bytes " + std::to_string(r.first) + "-" +
+                std::to_string(r.second) + "/26\r\n\r\n" +
+                Body.substr(r.first, r.second - r.first + 1);
+    }
+    return body + "\r\n--" + boundary + "--\r\n";
+}
+
+static void test_write_ranges(uint16_t port) {
+    Response response = get(port, "");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.header("Accept-Ranges"), "bytes");
+    CHECK_EQUAL(response.body, Body);
+    response = get(port, "Range: bytes=0-4\r\n");
+    CHECK_EQUAL(response.status, 206);
+    CHECK_EQUAL(response.header("Content-Range"), "bytes 0-4/26");
+    CHECK_EQUAL(response.header("Content-Length"), "5");
+    CHECK_EQUAL(response.body, "abcde");
+    response = get(port, "Range: bytes=-3\r\n");
+    CHECK_EQUAL(response.status, 206);
+    CHECK_EQUAL(response.header("Content-Range"), "bytes 23-25/26");
+    CHECK_EQUAL(response.body, "xyz");
+    // 416 carries the full length so the client can retry
+    const char *unsatisfiable[] = {"bytes=26-", "bytes=-0", "bytes=30-40, -0"};
+    for (const char *range : unsatisfiable) {
+        response = get(port, "Range: " + std::string(range) + "\r\n");
+        CHECK_EQUAL(response.status, 416);
+        CHECK_EQUAL(response.header("Content-Range"), "bytes */26");
+        CHECK_EQUAL(response.body, "");
+    }
+    // several ranges: the body must match the advertised length byte for byte
+    response = get(port, "Range: bytes=20-, 0-1, 1-2, 10-11\r\n");
+    CHECK_EQUAL(response.status, 206);
+    std::string content_type = response.header("Content-Type");
+    const std::string prefix = "multipart/byteranges; boundary=";
+    CHECK(content_type.compare(0, prefix.size(), prefix) == 0);
+    std::string boundary = content_type.substr(prefix.size());
+    CHECK(!boundary.empty());
+    CHECK(!response.has_header("Content-Range"));
+    CHECK_EQUAL(response.header("Content-Length"), std::to_string(response.body.size()));
+    CHECK_EQUAL(response.body, byteranges(boundary, {{0, 2}, {10, 11}, {20, 25}}));
+    // merged into one range, answered without multipart
+    response = get(port, "Range: bytes=0-3, 2-5\r\n");
+    CHECK_EQUAL(response.status, 206);
+    CHECK_EQUAL(response.header("Content-Type"), "text/plain");
+    CHECK_EQUAL(response.body, "abcdef");
+    // too many ranges: the whole body
+    std::string many = "Range: bytes=0-0";
+    for (int i = 2; i < 36; i += 2) {
+        many += ", " + std::to_string(i) + "-" + std::to_string(i);
+    }
+    response = get(port, many + "\r\n");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, Body);
+    // If-Range: strong ETag or the exact date
+    response = get(port, "Range: bytes=0-1\r\nIf-Range: \"b1\"\r\n");
+    CHECK_EQUAL(response.status, 206);
+    CHECK_EQUAL(response.body, "ab");
+    response = get(port, "Range: bytes=0-1\r\nIf-Range: " + std::string(LastModified) + "\r\n");
+    CHECK_EQUAL(response.status, 206);
+    response = get(port, "Range: bytes=0-1\r\nIf-Range: W/\"b1\"\r\n");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, Body);
+    response = get(port, "Range: bytes=0-1\r\nIf-Range: \"b2\"\r\n");
+    CHECK_EQUAL(response.status, 200);
+    response = get(port, "Range: bytes=99-\r\nIf-Range: \"b2\"\r\n");
+    CHECK_EQUAL(response.status, 200);
+    // HEAD gets the same head as GET and no body
+    response = get(port, "", "HEAD");
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.header("Content-Length"), "26");
+    CHECK_EQUAL(response.body, "");
+    response = get(port, "Range: bytes=-3\r\n", "HEAD");
+    CHECK_EQUAL(response.status, 206);
+    CHECK_EQUAL(response.header("Content-Range"), "bytes 23-25/26");
+    CHECK_EQUAL(response.header("Content-Length"), "3");
+    CHECK_EQUAL(response.body, "");
+    Response get_multi = get(port, "Range: bytes=0-1, 5-6\r\n");
+    response = get(port, "Range: bytes=0-1, 5-6\r\n", "HEAD");
+    CHECK_EQUAL(response.status, 206);
+    CHECK_EQUAL(response.header("Content-Length"), get_multi.header("Content-Length"));
+    CHECK_EQUAL(response.body, "");
+    // other methods ignore Range
+    response = parse_response(exchange(port, "POST /r HTTP/1.1\r\nHost: a\r\n"
+        "Content-Length: 0\r\nRange: bytes=0-1\r\nConnection: close\r\n\r\n"));
+    CHECK_EQUAL(response.status, 200);
+    CHECK_EQUAL(response.body, Body);
+}
+
+template<typename T>
+void run(uint16_t port) {
+    Application<T> app({
+        {"/r", [](Connection &conn) {
+            conn.add_header("Content-Type", "text/plain");
+            conn.add_header("ETag", ETag);
+            conn.add_header("Last-Modified", LastModified);
+            conn.write_ranges(Body.size(), [&conn](uint64_t offset, uint64_t length) {
+                return conn.write(Body.data() + offset, length);
+            });
+        }, {HTTPMethod::GET, HTTPMethod::HEAD, HTTPMethod::POST}},
+    });
+    app.listen(port);
+    IOLoop &loop = IOLoop::get_instance();
+    std::thread client([&]() {
+        test_write_ranges(port);
+        loop.post([&]() {
+            app.shutdown(1000);
+        });
+    });
+    loop.start();
+    client.join();
+}
+
+int main() {
+    test_parse_range();
+    test_if_range();
+    run<HTTPServer>(18121);
+    run<EpollServer>(18122);
+    return test_result("range");
+}
@@ -0,0 +1,104 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// graceful shutdown while a Blocking handler is still running on a worker thread
+
+template<typename T>
+void test_deadline(uint16_t port) {
+    std::atomic<bool> started(false), done(false), queued_ran(false);
+    Application<T> app({
+        {"/slow", [&](Connection &conn) {
+            started = true;
+            sleep_ms(600);
+            // the request has been abandoned by now, this must not touch freed state
+            conn.add_header("X-Late", "1");
+            conn.write("late");
+            done = true;
+        }, {HTTPMethod::GET}, Blocking},
+        {"/queued", [&](Connection &conn) {
+            queued_ran = true;
+        }, {HTTPMethod::GET}, Blocking},
+    });
+    app.set_workers(1, 16);
+    app.listen(port);
+    std::string slow, queued;
+    std::thread client([&]() {
+        slow = exchange(port, "GET /slow HTTP/1.1\r\nHost: a\r\n\r\n", 3000);
+    });
+    std::thread second([&]() {
+        while (!started) {
+            sleep_ms(5);
+        }
+        queued = exchange(port, "GET /queued HTTP/1.1\r\nHost: a\r\n\r\n", 3000);
+    });
+    IOLoop &loop = IOLoop::get_instance();
+    std::function<void ()> wait_started;
+    wait_started = [&]() {
+        if (!started) {
+            loop.call_later(10, wait_started);
+            return;
+        }
+        // let the second request reach the worker queue
+        loop.call_later(100, [&]() {
+            app.shutdown(100);
+        });
+    };
+    loop.call_soon(wait_started);
+    auto begin = std::chrono::steady_clock::now();
+    loop.start();
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    // the loop only ends after the running handler has returned
+    CHECK(done);
+    CHECK(elapsed >= std::chrono::milliseconds(500));
+    // the queued job was dropped at the deadline
+    CHECK(!queued_ran);
+    client.join();
+    second.join();
+    CHECK(slow.find("200 OK") == std::string::npos);
+    CHECK(queued.find("200 OK") == std::string::npos);
+}
+
+template<typename T>
+void test_graceful(uint16_t port) {
+    std::atomic<bool> started(false);
+    Application<T> app({
+        {"/slow", [&](Connection &conn) {
+            started = true;
+            sleep_ms(200);
+            conn.write("finished");
+        }, {HTTPMethod::GET}, Blocking},
+    });
+    app.listen(port);
+    std::string response;
+    std::thread client([&]() {
+        response = exchange(port, "GET /slow HTTP/1.1\r\nHost: a\r\n\r\n", 3000);
+    });
+    IOLoop &loop = IOLoop::get_instance();
+    std::function<void ()> wait_started;
+    wait_started = [&]() {
+        if (!started) {
+            loop.call_later(10, wait_started);
+            return;
+        }
+        app.shutdown(5000);
+    };
+    loop.call_soon(wait_started);
+    loop.start();
+    client.join();
+    // the in-flight request completes before the loop ends
+    CHECK(response.find("200 OK") != std::string::npos);
+    CHECK(response.find("finished") != std::string::npos);
+}
+
+int main() {
+    test_deadline<HTTPServer>(18101);
+    test_deadline<EpollServer>(18102);
+    test_graceful<HTTPServer>(18103);
+    test_graceful<EpollServer>(18104);
+    return test_result("shutdown");
+}
@@ -0,0 +1,180 @@
+#ifndef RECYCLED_TEST_TESTING_H
+#define RECYCLED_TEST_TESTING_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+// shared helpers for the self-checking tests, each test exits non-zero on failure
+
+static int test_failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", \
+                __FILE__, __LINE__, #condition); \
+        ++test_failures; \
+    } \
+} while (0)
+
+#define CHECK_EQUAL(actual, expected) do { \
+    if (!((actual) == (expected))) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s == %s\n", \
+                __FILE__, __LINE__, #actual, #expected); \
+        ++test_failures; \
+    } \
+} while (0)
+
+inline int test_result(const char *name) {
+    if (test_failures) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+inline void sleep_ms(int ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline int connect_local(uint16_t port) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        // the server may not be listening yet
+        sleep_ms(10);
+    }
+    return -1;
+}
+
+/**
+ * Sends the pieces with a delay between them, then reads until the server
+ * closes the connection or nothing arrives for timeout_ms.
+ */
+inline std::string exchange(uint16_t port, const std::vector<std::string> &pieces,
+                            int delay_ms = 0, int timeout_ms = 2000) {
+    int fd = connect_local(port);
+    if (fd < 0) {
+        return "";
+    }
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (i && delay_ms) {
+            sleep_ms(delay_ms);
+        }
+        if (send(fd, pieces[i].data(), pieces[i].size(), MSG_NOSIGNAL) < 0) {
+            break;
+        }
+    }
+    std::string response;
+    char buffer[4096];
+    while (true) {
+        pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, timeout_ms) <= 0) {
+            break;
+        }
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        response.append(buffer, n);
+    }
+    close(fd);
+    return response;
+}
+
+inline std::string exchange(uint16_t port, const std::string &request,
+                            int timeout_ms = 2000) {
+    return exchange(port, std::vector<std::string>{request}, 0, timeout_ms);
+}
+
+/**
+ * One response with a Content-Length body, as read by exchange.
+ */
+struct Response {
+    int status;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    /**
+     * The value of the first header with this name, or "" when missing.
+     */
+    std::string header(const char *name) const {
+        for (const auto &h : headers) {
+            if (strcasecmp(h.first.c_str(), name) == 0) {
+                return h.second;
+            }
+        }
+        return "";
+    }
+
+    bool has_header(const char *name) const {
+        for (const auto &h : headers) {
+            if (strcasecmp(h.first.c_str(), name) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * Splits raw into status, headers and everything after the head. The body is
+ * not cut at Content-Length so that extra bytes show up in the checks.
+ */
+inline Response parse_response(const std::string &raw) {
+    Response response = {0, {}, ""};
+    size_t end = raw.find("\r\n\r\n");
+    if (raw.compare(0, 9, "HTTP/1.1 ") != 0 || end == std::string::npos) {
+        return response;
+    }
+    response.status = atoi(raw.c_str() + 9);
+    size_t line = raw.find("\r\n") + 2;
+    while (line < end + 2) {
+        size_t eol = raw.find("\r\n", line);
+        size_t colon = raw.find(':', line);
+        if (colon < eol) {
+            size_t value = raw.find_first_not_of(' ', colon + 1);
+            response.headers.push_back(std::make_pair(
+                raw.substr(line, colon - line),
+                value < eol ? raw.substr(value, eol - value) : ""));
+        }
+        line = eol + 2;
+    }
+    response.body = raw.substr(end + 4);
+    return response;
+}
+
+/**
+ * Counts the occurrences of needle in haystack.
+ */
+inline size_t count(const std::string &haystack, const std::string &needle) {
+    size_t n = 0;
+    for (size_t pos = haystack.find(needle); pos != std::string::npos;
+         pos = haystack.find(needle, pos + needle.size())) {
+        ++n;
+    }
+    return n;
+}
+#endif
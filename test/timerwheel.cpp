@@ -0,0 +1,251 @@
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <recycled.h>
+#include "testing.h"
+
+using namespace recycled;
+
+// TimerWheel firing order and delays, and call_every on a real IOLoop
+
+static const uint64_t Level1 = 1ULL << 8;
+static const uint64_t Level2 = 1ULL << 14;
+static const uint64_t Level3 = 1ULL << 20;
+static const uint64_t Level4 = 1ULL << 26;
+
+static uint64_t random_state = 12345;
+
+static uint64_t next_random() {
+    random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return random_state >> 33;
+}
+
+/**
+ * Delays on both sides of every level boundary, plus random ones.
+ */
+static std::vector<uint64_t> test_delays(uint64_t limit) {
+    std::vector<uint64_t> delays = {0, 1, 2};
+    for (uint64_t boundary : {Level1, Level2, Level3, Level4}) {
+        if (boundary + 2 > limit) {
+            break;
+        }
+        for (uint64_t d = boundary - 2; d <= boundary + 2; ++d) {
+            delays.push_back(d);
+        }
+        delays.push_back(boundary * 2 - 1);
+        delays.push_back(boundary * 2);
+    }
+    for (int i = 0; i < 500; ++i) {
+        delays.push_back(next_random() % limit);
+    }
+    return delays;
+}
+
+/**
+ * Adds timers at now + delay and advances with steps of at most max_step
+ * ticks, each timer must fire in the step that contains its expiry.
+ */
+static void check_schedule(uint64_t now, const std::vector<uint64_t> &delays,
+                           uint64_t max_step) {
+    TimerWheel wheel(now);
+    std::vector<uint64_t> fired;
+    for (uint64_t delay : delays) {
+        uint64_t expires = now + delay;
+        wheel.add(expires, 0, [&fired, expires]() {
+            fired.push_back(expires);
+        });
+    }
+    CHECK_EQUAL(wheel.size(), delays.size());
+    uint64_t last = now + *std::max_element(delays.begin(), delays.end());
+    // tick now itself has not been processed yet
+    for (uint64_t first = now; first <= last;) {
+        uint64_t target = first + (max_step > 1 ? next_random() % max_step : 0);
+        size_t before = fired.size();
+        wheel.advance(target);
+        for (size_t i = before; i < fired.size(); ++i) {
+            if (fired[i] < first || fired[i] > target) {
+                fprintf(stderr, "timer for %llu fired advancing %llu..%llu\n",
+                        (unsigned long long)fired[i], (unsigned long long)first,
+                        (unsigned long long)target);
+                ++test_failures;
+                break;
+            }
+        }
+        first = target + 1;
+    }
+    CHECK_EQUAL(fired.size(), delays.size());
+    CHECK_EQUAL(wheel.size(), 0u);
+    for (size_t i = 1; i < fired.size(); ++i) {
+        if (fired[i] < fired[i - 1]) {
+            fprintf(stderr, "timer for %llu fired after %llu\n",
+                    (unsigned long long)fired[i], (unsigned long long)fired[i - 1]);
+            ++test_failures;
+            break;
+        }
+    }
+}
+
+static void test_order() {
+    // one tick at a time every timer fires exactly at its expiry
+    check_schedule(0, test_delays(Level3 * 2), 1);
+    check_schedule(1000, test_delays(Level3 * 2), 1);
+    check_schedule(Level2 - 3, test_delays(Level3 * 2), 1);
+    // larger steps, as when the loop wakes up late
+    check_schedule(777, test_delays(Level4 * 2), 5000);
+    check_schedule(Level4 - 1, test_delays(Level4 * 2), 100000);
+}
+
+static void test_next_tick() {
+    // advancing to next_tick, as IOLoop does, reaches each timer without passing it
+    TimerWheel wheel(500);
+    std::vector<uint64_t> fired;
+    uint64_t target = 500;
+    for (uint64_t delay : {Level1 + 7, Level2 + 300, Level3 + 5, uint64_t(3)}) {
+        wheel.add(500 + delay, 0, [&fired, &target]() {
+            fired.push_back(target);
+        });
+    }
+    CHECK_EQUAL(wheel.next_tick(), 503u);
+    for (int i = 0; i < 10000 && wheel.size(); ++i) {
+        target = wheel.next_tick();
+        CHECK(target >= wheel.get_tick());
+        wheel.advance(target);
+    }
+    CHECK_EQUAL(fired.size(), 4u);
+    std::vector<uint64_t> expected = {503, 500 + Level1 + 7, 500 + Level2 + 300,
+                                      500 + Level3 + 5};
+    CHECK(fired == expected);
+    CHECK_EQUAL(wheel.next_tick(), 0u);
+    // the farthest delay is clamped to what the wheel can hold
+    wheel.add(wheel.get_tick() + (1ULL << 40), 0, []() {});
+    CHECK(wheel.next_tick() > 0);
+    wheel.advance(wheel.get_tick() + (1ULL << 32));
+    CHECK_EQUAL(wheel.size(), 0u);
+}
+
+static void test_cancel() {
+    TimerWheel wheel(0);
+    std::vector<int> fired;
+    TimerID same_tick = 0, later = 0, self = 0;
+    bool cancelled_same = false, cancelled_later = false, cancelled_self = true;
+    // a callback cancels a timer in the same tick, one in a later tick and itself
+    self = wheel.add(10, 0, [&]() {
+        fired.push_back(1);
+        cancelled_same = wheel.cancel(same_tick);
+        cancelled_later = wheel.cancel(later);
+        cancelled_self = wheel.cancel(self);
+    });
+    same_tick = wheel.add(10, 0, [&]() {
+        fired.push_back(2);
+    });
+    later = wheel.add(Level1 + 10, 0, [&]() {
+        fired.push_back(3);
+    });
+    wheel.add(Level1 + 11, 0, [&]() {
+        fired.push_back(4);
+    });
+    // whichever of the two in tick 10 runs first decides whether 2 runs
+    wheel.advance(Level1 * 2);
+    CHECK(cancelled_later);
+    CHECK(!cancelled_self);
+    if (cancelled_same) {
+        CHECK(fired == std::vector<int>({1, 4}));
+    } else {
+        CHECK(fired == std::vector<int>({2, 1, 4}));
+    }
+    CHECK_EQUAL(wheel.size(), 0u);
+    // a fired or cancelled ID does not reach the timer that reuses its slot
+    TimerID old = wheel.add(wheel.get_tick() + 1, 0, []() {});
+    CHECK(wheel.cancel(old));
+    CHECK(!wheel.cancel(old));
+    bool reused_fired = false;
+    wheel.add(wheel.get_tick() + 1, 0, [&]() {
+        reused_fired = true;
+    });
+    CHECK(!wheel.cancel(old));
+    wheel.advance(wheel.get_tick() + 1);
+    CHECK(reused_fired);
+    CHECK(!wheel.cancel(0));
+    CHECK(!wheel.cancel(UINT64_MAX));
+}
+
+static void test_repeat() {
+    TimerWheel wheel(100);
+    uint64_t target = 100;
+    std::vector<uint64_t> ticks;
+    TimerID every = 0;
+    // re-armed from the scheduled tick, cancelled from its own callback
+    every = wheel.add(100 + Level1 - 6, Level1 - 6, [&]() {
+        ticks.push_back(target);
+        if (ticks.size() == 5) {
+            CHECK(wheel.cancel(every));
+        }
+    });
+    for (; target < 100 + Level1 * 10; ++target) {
+        wheel.advance(target);
+    }
+    std::vector<uint64_t> expected;
+    for (uint64_t i = 1; i <= 5; ++i) {
+        expected.push_back(100 + (Level1 - 6) * i);
+    }
+    CHECK(ticks == expected);
+    CHECK_EQUAL(wheel.size(), 0u);
+    CHECK(!wheel.cancel(every));
+    // a timer added by a callback for the current tick runs in the next one
+    std::vector<uint64_t> order;
+    wheel.add(target + 1, 0, [&]() {
+        order.push_back(target);
+        wheel.add(0, 0, [&]() {
+            order.push_back(target);
+        });
+    });
+    ++target;
+    wheel.advance(target);
+    CHECK_EQUAL(order.size(), 1u);
+    ++target;
+    wheel.advance(target);
+    CHECK(order == std::vector<uint64_t>({target - 1, target}));
+}
+
+static void test_ioloop() {
+    IOLoop &loop = IOLoop::get_instance();
+    uint64_t begin = IOLoop::monotonic_time();
+    std::vector<uint64_t> ticks;
+    int late = 0;
+    TimerID every = loop.call_every(20, [&]() {
+        ticks.push_back(IOLoop::monotonic_time() - begin);
+        if (ticks.size() == 5) {
+            CHECK(loop.cancel_timer(every));
+            // nothing more may fire before the loop stops
+            loop.call_later(100, [&]() {
+                loop.stop();
+            });
+        }
+    });
+    TimerID cancelled = loop.call_later(50, [&]() {
+        ++late;
+    });
+    loop.call_later(10, [&]() {
+        CHECK(loop.cancel_timer(cancelled));
+    });
+    // fail instead of hanging when the timers never fire
+    TimerID watchdog = loop.call_later(3000, [&]() {
+        loop.stop();
+    });
+    loop.start();
+    CHECK(loop.cancel_timer(watchdog));
+    CHECK_EQUAL(ticks.size(), 5u);
+    CHECK_EQUAL(late, 0);
+    for (size_t i = 0; i < ticks.size(); ++i) {
+        CHECK(ticks[i] >= 20 * (i + 1));
+    }
+}
+
+int main() {
+    test_order();
+    test_next_tick();
+    test_cancel();
+    test_repeat();
+    test_ioloop();
+    return test_result("timerwheel");
+}